@@ -0,0 +1,95 @@
+/* so_gzip.c -- compresses a module for the loader's streaming inflate
+ *
+ * Usage: so_gzip <module.so> [output]
+ *
+ * Writes a gzip file (<module.so>.gz by default) that so_file_load inflates on
+ * the fly. The loader takes the inflated size from the gzip trailer, so the
+ * input has to be a single ELF file under 4 GB, which is checked here.
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "elf.h"
+
+#define CHUNK_SZ 0x40000
+
+int main(int argc, char *argv[]) {
+	char out_path[1024];
+	static uint8_t in[CHUNK_SZ], out[CHUNK_SZ];
+	z_stream zs;
+
+	if (argc < 2) {
+		printf("Usage: %s <module.so> [output]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 2)
+		snprintf(out_path, sizeof(out_path), "%s", argv[2]);
+	else
+		snprintf(out_path, sizeof(out_path), "%s.gz", argv[1]);
+
+	FILE *src = fopen(argv[1], "rb");
+	if (!src) {
+		printf("Error could not open %s.\n", argv[1]);
+		return 1;
+	}
+	size_t n = fread(in, 1, CHUNK_SZ, src);
+	if (n < SELFMAG || memcmp(in, ELFMAG, SELFMAG) != 0) {
+		printf("Error %s isn't an ELF file.\n", argv[1]);
+		fclose(src);
+		return 1;
+	}
+
+	FILE *dst = fopen(out_path, "wb");
+	if (!dst) {
+		printf("Error could not create %s.\n", out_path);
+		fclose(src);
+		return 1;
+	}
+
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+		fclose(src);
+		fclose(dst);
+		return 1;
+	}
+
+	// A short read is the end of the file, the first chunk is already in
+	unsigned long long in_size = 0, out_size = 0;
+	int res, flush;
+	for (;;) {
+		in_size += n;
+		flush = n < CHUNK_SZ ? Z_FINISH : Z_NO_FLUSH;
+		zs.next_in = in;
+		zs.avail_in = n;
+		do {
+			zs.next_out = out;
+			zs.avail_out = CHUNK_SZ;
+			res = deflate(&zs, flush);
+			size_t len = CHUNK_SZ - zs.avail_out;
+			if (fwrite(out, 1, len, dst) != len)
+				res = Z_ERRNO;
+			out_size += len;
+		} while (zs.avail_out == 0 && res != Z_ERRNO);
+
+		if (flush == Z_FINISH || res == Z_ERRNO)
+			break;
+		n = fread(in, 1, CHUNK_SZ, src);
+	}
+
+	deflateEnd(&zs);
+	fclose(src);
+	if (fclose(dst) != 0 || res != Z_STREAM_END || in_size > 0xFFFFFFFFull) {
+		printf("Error could not write %s.\n", out_path);
+		remove(out_path);
+		return 1;
+	}
+
+	printf("%s: %llu -> %llu bytes (%.1f%%)\n", out_path, in_size, out_size, 100.0 * out_size / in_size);
+	return 0;
+}
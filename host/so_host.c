@@ -0,0 +1,528 @@
+/* so_host.c -- loads a module with the host build of so_util and times each step
+ *
+ * Usage: so_host <module.so> [load address] [profile.bin]
+ *        so_host -bench
+ *        so_host -test
+ *
+ * With a profile recorded on the Vita, its folded stacks are written to stdout instead.
+ * A <module.so>.gz next to the module (see so_gzip) gets its load timed as well.
+ * With -bench, the loader's steps are timed over synthetic modules instead.
+ * With -test, checks that need no module are run, exiting non-zero on a failure.
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "so_util.h"
+#include "so_prof.h"
+#include "sha1.h"
+
+#define DEFAULT_LOAD_ADDRESS 0x98000000
+
+// Provided by main.c, dialog.c and vitaGL on the Vita
+void fatal_error(const char *fmt, ...) {
+	va_list list;
+	va_start(list, fmt);
+	vfprintf(stderr, fmt, list);
+	va_end(list);
+	exit(1);
+}
+
+int debugPrintf(char *text, ...) {
+	return 0;
+}
+
+int ret0() {
+	return 0;
+}
+
+// Same linear string search as vitaGL, over the names the benchmarks export
+static char **vgl_procs;
+static int num_vgl_procs;
+
+void *vglGetProcAddress(const char *name) {
+	for (int i = 0; i < num_vgl_procs; i++) {
+		if (strcmp(vgl_procs[i], name) == 0)
+			return (void *)&ret0;
+	}
+	return NULL;
+}
+
+static so_default_dynlib default_dynlib[] = {
+	{ "ret0", (uintptr_t)&ret0 },
+};
+
+/*
+ * Synthetic modules for the benchmarks: each name becomes an undefined symbol,
+ * imported through a GLOB_DAT in .rel.dyn and a JUMP_SLOT in .rel.plt, after
+ * num_relative R_ARM_RELATIVE entries. Every relocation targets its own word.
+ */
+static char **synth_names(const char *prefix, int num) {
+	char **names = malloc(num * sizeof(char *));
+	for (int i = 0; i < num; i++) {
+		names[i] = malloc(strlen(prefix) + 16);
+		sprintf(names[i], "%s%d", prefix, i);
+	}
+	return names;
+}
+
+static void synth_names_free(char **names, int num) {
+	for (int i = 0; i < num; i++)
+		free(names[i]);
+	free(names);
+}
+
+static void synth_module(so_module *mod, char **imports, int num_imports, int num_relative) {
+	memset(mod, 0, sizeof(so_module));
+
+	size_t size = 1;
+	for (int i = 0; i < num_imports; i++)
+		size += strlen(imports[i]) + 1;
+	mod->dynstr = malloc(size);
+	mod->dynstr[0] = '\0';
+
+	mod->num_dynsym = num_imports + 1;
+	mod->dynsym = calloc(mod->num_dynsym, sizeof(Elf32_Sym));
+	size_t offset = 1;
+	for (int i = 0; i < num_imports; i++) {
+		mod->dynsym[i + 1].st_name = offset;
+		mod->dynsym[i + 1].st_info = ELF32_ST_INFO(STB_GLOBAL, STT_FUNC);
+		mod->dynsym[i + 1].st_shndx = SHN_UNDEF;
+		strcpy(mod->dynstr + offset, imports[i]);
+		offset += strlen(imports[i]) + 1;
+	}
+
+	mod->num_reldyn = num_relative + num_imports;
+	mod->num_relplt = num_imports;
+	mod->reldyn = malloc(mod->num_reldyn * sizeof(Elf32_Rel));
+	mod->relplt = malloc(mod->num_relplt * sizeof(Elf32_Rel));
+	mod->text_size = (mod->num_reldyn + mod->num_relplt) * sizeof(uintptr_t);
+	mod->text_base = (uintptr_t)calloc(1, mod->text_size);
+
+	uint32_t word = 0;
+	for (int i = 0; i < num_relative; i++, word += sizeof(uintptr_t)) {
+		mod->reldyn[i].r_offset = word;
+		mod->reldyn[i].r_info = ELF32_R_INFO(0, R_ARM_RELATIVE);
+	}
+	for (int i = 0; i < num_imports; i++, word += sizeof(uintptr_t)) {
+		mod->reldyn[num_relative + i].r_offset = word;
+		mod->reldyn[num_relative + i].r_info = ELF32_R_INFO(i + 1, R_ARM_GLOB_DAT);
+	}
+	for (int i = 0; i < num_imports; i++, word += sizeof(uintptr_t)) {
+		mod->relplt[i].r_offset = word;
+		mod->relplt[i].r_info = ELF32_R_INFO(i + 1, R_ARM_JUMP_SLOT);
+	}
+}
+
+static void synth_module_free(so_module *mod) {
+	free((void *)mod->text_base);
+	free(mod->reldyn);
+	free(mod->relplt);
+	free(mod->dynsym);
+	free(mod->dynstr);
+	free(mod->sym_index);
+}
+
+#define BENCH_DYNLIB 300
+#define BENCH_VGL 150
+
+// Import resolution as it was before the hashed index: strcmp over default_dynlib, then vitaGL
+static int resolve_linear(so_module *mod, so_default_dynlib *default_dynlib, int num_dynlib) {
+	int resolved = 0;
+	for (int i = 0; i < mod->num_reldyn + mod->num_relplt; i++) {
+		Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
+		Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
+		uintptr_t *ptr = (uintptr_t *)(mod->text_base + rel->r_offset);
+		if (ELF32_R_TYPE(rel->r_info) == R_ARM_RELATIVE || sym->st_shndx != SHN_UNDEF)
+			continue;
+
+		uintptr_t f = 0;
+		for (int j = 0; j < num_dynlib; j++) {
+			if (strcmp(mod->dynstr + sym->st_name, default_dynlib[j].symbol) == 0) {
+				f = default_dynlib[j].func;
+				break;
+			}
+		}
+		if (!f)
+			f = (uintptr_t)vglGetProcAddress(mod->dynstr + sym->st_name);
+		if (f) {
+			*ptr = f;
+			resolved++;
+		}
+	}
+	return resolved;
+}
+
+static void bench_imports(void) {
+	so_module mod;
+	SceUInt64 start;
+
+	// Imports from both default_dynlib and vitaGL, as libsmb2.so has
+	char **names = synth_names("import_", BENCH_DYNLIB + BENCH_VGL);
+	so_default_dynlib *dynlib = malloc(BENCH_DYNLIB * sizeof(so_default_dynlib));
+	for (int i = 0; i < BENCH_DYNLIB; i++) {
+		dynlib[i].symbol = names[i];
+		dynlib[i].func = (uintptr_t)&ret0;
+	}
+	vgl_procs = names + BENCH_DYNLIB;
+	num_vgl_procs = BENCH_VGL;
+	synth_module(&mod, names, BENCH_DYNLIB + BENCH_VGL, 0);
+
+	start = sceKernelGetProcessTimeWide();
+	int resolved = resolve_linear(&mod, dynlib, BENCH_DYNLIB);
+	SceUInt64 linear = sceKernelGetProcessTimeWide() - start;
+
+	start = sceKernelGetProcessTimeWide();
+	so_resolve(&mod, dynlib, BENCH_DYNLIB * sizeof(so_default_dynlib), 1);
+	SceUInt64 hashed = sceKernelGetProcessTimeWide() - start;
+
+	printf("imports: linear %llu us, hashed %llu us (%.1fx, %d relocations)\n", linear, hashed,
+		hashed ? (double)linear / hashed : 0.0, resolved);
+
+	vgl_procs = NULL;
+	num_vgl_procs = 0;
+	synth_module_free(&mod);
+	free(dynlib);
+	synth_names_free(names, BENCH_DYNLIB + BENCH_VGL);
+}
+
+#define BENCH_RELATIVE 0x40000
+
+// The fused relocation pass against so_relocate followed by so_resolve
+static void bench_relocate(void) {
+	so_module mod;
+	SceUInt64 start;
+
+	char **names = synth_names("import_", BENCH_DYNLIB);
+	so_default_dynlib *dynlib = malloc(BENCH_DYNLIB * sizeof(so_default_dynlib));
+	for (int i = 0; i < BENCH_DYNLIB; i++) {
+		dynlib[i].symbol = names[i];
+		dynlib[i].func = (uintptr_t)&ret0;
+	}
+	synth_module(&mod, names, BENCH_DYNLIB, BENCH_RELATIVE);
+
+	// Once beforehand, so that the import index is built and the table is in cache
+	so_relocate_resolve(&mod, dynlib, BENCH_DYNLIB * sizeof(so_default_dynlib), 1);
+
+	start = sceKernelGetProcessTimeWide();
+	so_relocate(&mod);
+	so_resolve(&mod, dynlib, BENCH_DYNLIB * sizeof(so_default_dynlib), 1);
+	SceUInt64 separate = sceKernelGetProcessTimeWide() - start;
+
+	start = sceKernelGetProcessTimeWide();
+	so_relocate_resolve(&mod, dynlib, BENCH_DYNLIB * sizeof(so_default_dynlib), 1);
+	SceUInt64 fused = sceKernelGetProcessTimeWide() - start;
+	printf("relocate: %llu us fused, %llu us separate (%.2fx, %d + %d relocations)\n", fused, separate,
+		fused ? (double)separate / fused : 0.0, mod.num_reldyn, mod.num_relplt);
+
+	synth_module_free(&mod);
+	free(dynlib);
+	synth_names_free(names, BENCH_DYNLIB);
+}
+
+// The same module gzip compressed by so_gzip, if there's one next to it, loaded past the first copy
+static void bench_gzip_load(so_module *mod, const char *path, SceUInt64 raw) {
+	char gz_path[1024];
+	SceIoStat stat;
+	so_module gz_mod;
+
+	snprintf(gz_path, sizeof(gz_path), "%s.gz", path);
+	if (sceIoGetstat(gz_path, &stat) < 0)
+		return;
+
+	uintptr_t end = mod->text_base + mod->text_size;
+	for (int i = 0; i < mod->n_data; i++) {
+		if (mod->data_base[i] + mod->data_size[i] > end)
+			end = mod->data_base[i] + mod->data_size[i];
+	}
+
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	if (so_file_load(&gz_mod, gz_path, ALIGN_MEM(end, 0x1000000) + 0x1000000) < 0)
+		fatal_error("Error could not load %s.\n", gz_path);
+	SceUInt64 elapsed = sceKernelGetProcessTimeWide() - start;
+	printf("load (gzip): %llu us (%.2fx, %s digest)\n", elapsed, elapsed ? (double)raw / elapsed : 0.0,
+		memcmp(gz_mod.sha1, mod->sha1, SHA1_BLOCK_SIZE) == 0 ? "same" : "different");
+}
+
+#define BENCH_SYMBOLS 0x10000
+#define BENCH_LINEAR_STEP 256 // the linear scan only gets every 256th lookup
+
+// Hash functions as the linker uses them for .hash and .gnu.hash
+static uint32_t elf_hash(const char *name) {
+	uint32_t h = 0, g;
+	while (*name) {
+		h = (h << 4) + (uint8_t)*name++;
+		if ((g = h & 0xf0000000) != 0)
+			h ^= g >> 24;
+		h &= ~g;
+	}
+	return h;
+}
+
+static uint32_t gnu_hash(const char *name) {
+	uint32_t h = 5381;
+	while (*name)
+		h = h * 33 + (uint8_t)*name++;
+	return h;
+}
+
+static uint32_t sort_nbucket;
+
+static int gnu_bucket_cmp(const void *a, const void *b) {
+	uint32_t x = gnu_hash(*(char **)a) % sort_nbucket, y = gnu_hash(*(char **)b) % sort_nbucket;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * A module exporting names, with both hash tables laid out as ld would: dynsym
+ * sorted by .gnu.hash bucket, a Bloom filter of 2 bits per symbol over 32-bit words.
+ */
+static void synth_exports(so_module *mod, char **names, int num) {
+	memset(mod, 0, sizeof(so_module));
+
+	uint32_t nbucket = num / 4 + 1;
+	sort_nbucket = nbucket;
+	qsort(names, num, sizeof(char *), gnu_bucket_cmp);
+
+	size_t size = 1;
+	for (int i = 0; i < num; i++)
+		size += strlen(names[i]) + 1;
+	mod->dynstr = malloc(size);
+	mod->dynstr[0] = '\0';
+
+	mod->num_dynsym = num + 1;
+	mod->dynsym = calloc(mod->num_dynsym, sizeof(Elf32_Sym));
+	size_t offset = 1;
+	for (int i = 0; i < num; i++) {
+		Elf32_Sym *sym = &mod->dynsym[i + 1];
+		sym->st_name = offset;
+		sym->st_value = (i + 1) * 4;
+		sym->st_info = ELF32_ST_INFO(STB_GLOBAL, STT_FUNC);
+		sym->st_shndx = 1;
+		strcpy(mod->dynstr + offset, names[i]);
+		offset += strlen(names[i]) + 1;
+	}
+
+	// .hash: nbucket, nchain, buckets, chains
+	mod->hash = calloc(2 + nbucket + mod->num_dynsym, sizeof(uint32_t));
+	mod->hash[0] = nbucket;
+	mod->hash[1] = mod->num_dynsym;
+	uint32_t *bucket = &mod->hash[2], *chain = &bucket[nbucket];
+	for (int i = 1; i < mod->num_dynsym; i++) {
+		uint32_t b = elf_hash(mod->dynstr + mod->dynsym[i].st_name) % nbucket;
+		chain[i] = bucket[b];
+		bucket[b] = i;
+	}
+
+	// .gnu.hash: nbucket, symoffset, bloom_size, bloom_shift, bloom, buckets, chains
+	uint32_t bloom_size = 1, bloom_shift = 5;
+	while (bloom_size * 32 < (uint32_t)num * 2)
+		bloom_size *= 2;
+	mod->gnu_hash = calloc(4 + bloom_size + nbucket + num, sizeof(uint32_t));
+	mod->gnu_hash[0] = nbucket;
+	mod->gnu_hash[1] = 1;
+	mod->gnu_hash[2] = bloom_size;
+	mod->gnu_hash[3] = bloom_shift;
+	uint32_t *bloom = &mod->gnu_hash[4];
+	bucket = &bloom[bloom_size];
+	chain = &bucket[nbucket];
+	for (int i = 1; i < mod->num_dynsym; i++) {
+		uint32_t h = gnu_hash(mod->dynstr + mod->dynsym[i].st_name);
+		bloom[(h / 32) % bloom_size] |= (1u << (h % 32)) | (1u << ((h >> bloom_shift) % 32));
+		if (!bucket[h % nbucket])
+			bucket[h % nbucket] = i;
+		chain[i - 1] = h & ~1;
+		if (i == mod->num_dynsym - 1 || gnu_hash(mod->dynstr + mod->dynsym[i + 1].st_name) % nbucket != h % nbucket)
+			chain[i - 1] |= 1;
+	}
+}
+
+// Symbol lookup as it was without a usable .hash, a strcmp over the whole dynsym
+static int symbol_linear(so_module *mod, const char *symbol) {
+	for (int i = 1; i < mod->num_dynsym; i++) {
+		if (mod->dynsym[i].st_shndx != SHN_UNDEF && strcmp(mod->dynstr + mod->dynsym[i].st_name, symbol) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static void bench_symbol_pass(so_module *mod, const char *table, int linear, char **hits, char **misses, int num) {
+	SceUInt64 start, elapsed[2];
+	int found[2] = { 0, 0 };
+	int step = linear ? BENCH_LINEAR_STEP : 1;
+
+	for (int pass = 0; pass < 2; pass++) {
+		char **names = pass ? misses : hits;
+		start = sceKernelGetProcessTimeWide();
+		for (int i = 0; i < num; i += step)
+			found[pass] += linear ? symbol_linear(mod, names[i]) >= 0 : so_symbol(mod, names[i]) != 0;
+		elapsed[pass] = sceKernelGetProcessTimeWide() - start;
+	}
+
+	int lookups = (num + step - 1) / step;
+	printf("symbols (%s): hits %.0f ns, misses %.0f ns (%d/%d found, %d/%d rejected)\n", table,
+		elapsed[0] * 1000.0 / lookups, elapsed[1] * 1000.0 / lookups, found[0], lookups, lookups - found[1], lookups);
+}
+
+// Every exported name (hits), then each with a suffix (misses), through each lookup path in turn
+static void bench_symbols(void) {
+	so_module mod;
+
+	char **hits = synth_names("_ZN5synth6symbolEi", BENCH_SYMBOLS);
+	char **misses = malloc(BENCH_SYMBOLS * sizeof(char *));
+	for (int i = 0; i < BENCH_SYMBOLS; i++) {
+		misses[i] = malloc(strlen(hits[i]) + 2);
+		sprintf(misses[i], "%s_", hits[i]);
+	}
+	synth_exports(&mod, hits, BENCH_SYMBOLS);
+	uint32_t *hash = mod.hash, *gnu_hash = mod.gnu_hash;
+
+	bench_symbol_pass(&mod, "linear", 1, hits, misses, BENCH_SYMBOLS);
+	mod.gnu_hash = NULL;
+	bench_symbol_pass(&mod, ".hash", 0, hits, misses, BENCH_SYMBOLS);
+	mod.gnu_hash = gnu_hash;
+	bench_symbol_pass(&mod, ".gnu.hash", 0, hits, misses, BENCH_SYMBOLS);
+	mod.hash = mod.gnu_hash = NULL;
+	bench_symbol_pass(&mod, "index, built on the first lookup", 0, hits, misses, BENCH_SYMBOLS);
+
+	free(hash);
+	free(gnu_hash);
+	synth_module_free(&mod);
+	synth_names_free(hits, BENCH_SYMBOLS);
+	synth_names_free(misses, BENCH_SYMBOLS);
+}
+
+#define TEST_ADDEND 0x10
+
+// An ABS32 data import still waiting on vitaGL when it's rebound keeps its addend
+static int test_rebind(void) {
+	so_module mod;
+	char *name = "ext_data";
+	int failed = 0;
+
+	vgl_procs = &name;
+	num_vgl_procs = 1;
+	synth_module(&mod, &name, 1, 0);
+	mod.reldyn[0].r_info = ELF32_R_INFO(1, R_ARM_ABS32);
+	uintptr_t *abs = (uintptr_t *)(mod.text_base + mod.reldyn[0].r_offset);
+	uintptr_t *plt = (uintptr_t *)(mod.text_base + mod.relplt[0].r_offset);
+	*abs = TEST_ADDEND;
+
+	so_defer_vgl(1);
+	so_relocate_resolve(&mod, default_dynlib, sizeof(default_dynlib), 0);
+	so_rebind(&mod, name, (uintptr_t)&fatal_error);
+	so_rebind(&mod, name, (uintptr_t)&debugPrintf);
+	if (*abs != (uintptr_t)&debugPrintf + TEST_ADDEND || *plt != (uintptr_t)&debugPrintf) {
+		printf("rebind (deferred): FAILED, 0x%x and 0x%x\n", (unsigned)*abs, (unsigned)*plt);
+		failed = 1;
+	}
+
+	// Bound by vitaGL past the first rebind, which stores data imports as is
+	so_defer_vgl(0);
+	so_resolve_vgl();
+	so_rebind(&mod, name, (uintptr_t)&debugPrintf);
+	if (*abs != (uintptr_t)&debugPrintf || *plt != (uintptr_t)&debugPrintf) {
+		printf("rebind (bound late): FAILED, 0x%x and 0x%x\n", (unsigned)*abs, (unsigned)*plt);
+		failed = 1;
+	}
+	if (!failed)
+		printf("rebind: ok\n");
+
+	vgl_procs = NULL;
+	num_vgl_procs = 0;
+	free(mod.rebind_index);
+	free(mod.rebind_slots);
+	synth_module_free(&mod);
+	return failed;
+}
+
+static int test(void) {
+	return test_rebind();
+}
+
+static int bench(void) {
+	bench_imports();
+	bench_relocate();
+	bench_symbols();
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	so_module mod;
+	SceUInt64 start;
+
+	if (argc > 1 && strcmp(argv[1], "-bench") == 0)
+		return bench();
+	if (argc > 1 && strcmp(argv[1], "-test") == 0)
+		return test();
+
+	if (argc < 2) {
+		printf("Usage: %s <module.so> [load address] [profile.bin]\n       %s -bench\n       %s -test\n", argv[0], argv[0], argv[0]);
+		return 1;
+	}
+	uintptr_t load_addr = argc > 2 ? strtoul(argv[2], NULL, 0) : DEFAULT_LOAD_ADDRESS;
+
+	start = sceKernelGetProcessTimeWide();
+	if (so_file_load(&mod, argv[1], load_addr) < 0)
+		fatal_error("Error could not load %s.\n", argv[1]);
+	SceUInt64 raw = sceKernelGetProcessTimeWide() - start;
+	printf("load: %llu us\n", raw);
+	if (argc <= 3)
+		bench_gzip_load(&mod, argv[1], raw);
+
+	if (argc > 3) {
+		so_prof prof;
+		if (so_relocate(&mod) < 0)
+			fatal_error("Error could not relocate %s.\n", argv[1]);
+		so_resolve(&mod, default_dynlib, sizeof(default_dynlib), 0);
+		if (so_prof_init(&prof, &mod) < 0 || so_prof_load(&prof, argv[3]) < 0)
+			fatal_error("Error could not load %s.\n", argv[3]);
+		so_prof_folded(&prof, stdout);
+		so_prof_free(&prof);
+		return 0;
+	}
+
+	// Same kernel that hashes the module while it streams in, over data already in memory
+	SHA1_CTX sha1;
+	uint8_t digest[SHA1_BLOCK_SIZE];
+	start = sceKernelGetProcessTimeWide();
+	sha1_init(&sha1);
+	sha1_update(&sha1, (const uint8_t *)mod.text_base, mod.text_size);
+	sha1_final(&sha1, digest);
+	SceUInt64 elapsed = sceKernelGetProcessTimeWide() - start;
+	printf("sha1: %llu us (%.1f MB/s)\n", elapsed, elapsed ? (double)mod.text_size / elapsed : 0.0);
+
+	start = sceKernelGetProcessTimeWide();
+	if (so_relocate(&mod) < 0)
+		fatal_error("Error could not relocate %s.\n", argv[1]);
+	printf("relocate: %llu us (%d + %d relocations)\n", sceKernelGetProcessTimeWide() - start, mod.num_reldyn, mod.num_relplt);
+
+	start = sceKernelGetProcessTimeWide();
+	so_resolve(&mod, default_dynlib, sizeof(default_dynlib), 0);
+	printf("resolve: %llu us\n", sceKernelGetProcessTimeWide() - start);
+
+	// Every defined symbol once as is (hits), then with a suffix (misses)
+	char name[512];
+	int hits = 0, misses = 0;
+	start = sceKernelGetProcessTimeWide();
+	for (int i = 1; i < mod.num_dynsym; i++) {
+		if (mod.dynsym[i].st_shndx != SHN_UNDEF && so_symbol(&mod, mod.dynstr + mod.dynsym[i].st_name))
+			hits++;
+	}
+	printf("symbol hits: %llu us (%d lookups)\n", sceKernelGetProcessTimeWide() - start, hits);
+
+	start = sceKernelGetProcessTimeWide();
+	for (int i = 1; i < mod.num_dynsym; i++) {
+		snprintf(name, sizeof(name), "%s_", mod.dynstr + mod.dynsym[i].st_name);
+		if (!so_symbol(&mod, name))
+			misses++;
+	}
+	printf("symbol misses: %llu us (%d lookups)\n", sceKernelGetProcessTimeWide() - start, misses);
+
+	return 0;
+}
@@ -0,0 +1,84 @@
+/* so_prelink.c -- makes the prelinked module image on a PC instead of on the first boot
+ *
+ * Usage: so_prelink <libsmb2.so> <libsmb2.img> [load address] [needed path]
+ *
+ * Loads, relocates and patches the module the way the Vita loader does on a boot
+ * without an image, and saves the result with so_image_save. The import and hook
+ * tables are the loader's own (default_dynlib.h, default_hooks.h), as the image is
+ * keyed on their symbol names. Imports missing from default_dynlib are taken to be
+ * vitaGL's, the Vita looks them up when it applies the image.
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "so_util.h"
+
+// Provided by main.c, dialog.c and vitaGL on the Vita
+void fatal_error(const char *fmt, ...) {
+	va_list list;
+	va_start(list, fmt);
+	vfprintf(stderr, fmt, list);
+	va_end(list);
+	exit(1);
+}
+
+int debugPrintf(char *text, ...) {
+	return 0;
+}
+
+int ret0() {
+	return 0;
+}
+
+void *vglGetProcAddress(const char *name) {
+	return (void *)&ret0;
+}
+
+// Only the names end up in the image, the functions are the Vita loader's
+#define DYNLIB(symbol, func) { symbol, (uintptr_t)&ret0 },
+static so_default_dynlib dynlib[] = {
+#include "default_dynlib.h"
+};
+
+#define HOOK(symbol, func) { symbol, (uintptr_t)&ret0, NULL },
+#define HOOK_STATE(symbol, func, state) { symbol, (uintptr_t)&ret0, &(so_hook){ 0 } },
+static so_default_hook hooks[] = {
+#include "default_hooks.h"
+};
+
+int main(int argc, char *argv[]) {
+	so_module mod;
+
+	if (argc < 3) {
+		printf("Usage: %s <libsmb2.so> <libsmb2.img> [load address] [needed path]\n", argv[0]);
+		return 1;
+	}
+	uintptr_t load_addr = argc > 3 ? strtoul(argv[3], NULL, 0) : LOAD_ADDRESS;
+	const char *needed_path = argc > 4 ? argv[4] : ".";
+
+	if (so_file_load(&mod, argv[1], load_addr) < 0)
+		fatal_error("Error could not load %s.\n", argv[1]);
+	mod.lazy_bind = LAZY_BINDING;
+	so_load_needed(&mod, needed_path, dynlib, sizeof(dynlib));
+
+	so_patch_begin(&mod);
+	if (so_relocate_resolve(&mod, dynlib, sizeof(dynlib), 0) < 0)
+		fatal_error("Error could not relocate %s.\n", argv[1]);
+	int missing = so_hook_symbols(&mod, hooks, sizeof(hooks));
+	if (missing)
+		printf("%d hook targets missing from %s.\n", missing, argv[1]);
+#if SCAN_MISALIGNED
+	so_scan_misaligned(&mod, SCAN_MISALIGNED > 1);
+#endif
+	so_patch_commit(&mod);
+
+	if (so_image_save(&mod, argv[2], argv[1], needed_path, dynlib, sizeof(dynlib), hooks, sizeof(hooks)) < 0)
+		fatal_error("Error could not save %s.\n", argv[2]);
+	return 0;
+}
@@ -0,0 +1,187 @@
+/* so_scan_test.c -- misaligned-load scanner against hand assembled code
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "so_scan.h"
+
+#define ARM_NOP 0xE1A00000 // MOV r0, r0
+#define THUMB_NOP 0xBF00
+
+#define VADDR 0x10000
+
+static int failed = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failed++; \
+	} \
+} while (0)
+
+static so_scan_site *find_site(so_scan *s, uintptr_t addr) {
+	for (int i = 0; i < s->num_sites; i++) {
+		if (s->sites[i].addr == addr)
+			return &s->sites[i];
+	}
+	return NULL;
+}
+
+// Expects a site at index (words or halfwords) with kind and fixable, or none for kind -1
+static void check_site(so_scan *s, int index, int unit, int kind, int fixable, int line) {
+	so_scan_site *site = find_site(s, VADDR + index * unit);
+	if (kind < 0) {
+		if (site) {
+			printf("%s:%d: unexpected site at %d\n", __FILE__, line, index);
+			failed++;
+		}
+		return;
+	}
+	if (!site || site->kind != kind || site->fixable != fixable) {
+		printf("%s:%d: site at %d: %s, kind %d, fixable %d (expected %d, %d)\n", __FILE__, line, index,
+			site ? "found" : "missing", site ? site->kind : -1, site ? site->fixable : -1, kind, fixable);
+		failed++;
+	}
+}
+
+#define ARM_SITE(i, kind, fixable) check_site(&s, i, 4, kind, fixable, __LINE__)
+#define THUMB_SITE(i, kind, fixable) check_site(&s, i, 2, kind, fixable, __LINE__)
+
+static void test_arm(void) {
+	uint32_t code[64];
+	for (int i = 0; i < 64; i++)
+		code[i] = ARM_NOP;
+
+	code[0] = 0xE59F0000; // LDR r0, [pc, #0] -> literal at 2
+	code[2] = 0xE891000C; // literal that looks like LDMIA r1, {r2, r3}
+	code[5] = 0xE891000C; // LDMIA r1, {r2, r3}
+	code[6] = 0xE8B1000C; // LDMIA r1!, {r2, r3}
+	code[7] = 0xE89D000C; // LDMIA sp, {r2, r3}
+	code[8] = 0xE911000C; // LDMDB r1, {r2, r3}
+	code[33] = 0xE1C120D8; // LDRD r2, r3, [r1, #8]
+	code[34] = 0xE1C130D8; // LDRD r3, r4, [r1, #8] (odd Rt)
+	code[35] = 0xE14120D8; // LDRD r2, r3, [r1, #-8]
+	code[36] = 0xE1E120D8; // LDRD r2, r3, [r1, #8]!
+	code[37] = 0xE1CD20D8; // LDRD r2, r3, [sp, #8]
+	code[38] = 0xF4200AAF; // VLD1.32 {d0, d1}, [r0:128]
+	code[39] = 0xF4200A8F; // VLD1.32 {d0, d1}, [r0]
+	code[63] = 0xE891000C; // LDMIA r1, {r2, r3}, past the last full prefilter block
+
+	so_scan s;
+	so_scan_init(&s);
+	int found = so_scan_arm(&s, code, sizeof(code), VADDR);
+
+	ARM_SITE(2, -1, 0);
+	ARM_SITE(5, SCAN_LDM, 1);
+	ARM_SITE(6, SCAN_LDM, 0);
+	ARM_SITE(7, -1, 0);
+	ARM_SITE(8, SCAN_LDM, 0);
+	ARM_SITE(33, SCAN_LDRD, 1);
+	ARM_SITE(34, SCAN_LDRD, 0);
+	ARM_SITE(35, SCAN_LDRD, 1);
+	ARM_SITE(36, SCAN_LDRD, 0);
+	ARM_SITE(37, -1, 0);
+	ARM_SITE(38, SCAN_VLD, 1);
+	ARM_SITE(39, -1, 0);
+	ARM_SITE(63, SCAN_LDM, 1);
+	CHECK(found == 9);
+
+	so_scan_free(&s);
+}
+
+static void test_thumb(void) {
+	uint16_t code[96];
+	for (int i = 0; i < 96; i++)
+		code[i] = THUMB_NOP;
+
+	code[0] = 0x4800; // LDR r0, [pc, #0] -> literal at 2-3
+	code[1] = 0xE001; // B.N over the literal
+	code[2] = 0xE891; // literal that looks like LDM.W r1, {r2, r3}
+	code[3] = 0x000C;
+
+	code[4] = 0xC90C; // LDM r1!, {r2, r3}
+	code[5] = 0xE891; code[6] = 0x000C; // LDM.W r1, {r2, r3}
+	code[7] = 0xE8B1; code[8] = 0x000C; // LDM.W r1!, {r2, r3}
+	code[9] = 0xE911; code[10] = 0x000C; // LDMDB r1, {r2, r3}
+	code[11] = 0xE891; code[12] = 0x800C; // LDM.W r1, {r2, r3, pc}
+
+	code[13] = 0xE9D1; code[14] = 0x2302; // LDRD r2, r3, [r1, #8]
+	code[15] = 0xE951; code[16] = 0x2310; // LDRD r2, r3, [r1, #-64]
+	code[17] = 0xE951; code[18] = 0x233F; // LDRD r2, r3, [r1, #-252]
+	code[19] = 0xE951; code[20] = 0x2340; // LDRD r2, r3, [r1, #-256]
+	code[21] = 0xE951; code[22] = 0x23FF; // LDRD r2, r3, [r1, #-1020]
+	code[23] = 0xE9F1; code[24] = 0x2302; // LDRD r2, r3, [r1, #8]!
+	code[25] = 0xE9D1; code[26] = 0x2202; // LDRD r2, r2, [r1, #8]
+	code[27] = 0xE9DD; code[28] = 0x2302; // LDRD r2, r3, [sp, #8]
+
+	code[40] = 0xBF08; // IT EQ
+	code[41] = 0xE891; code[42] = 0x000C; // LDMEQ.W r1, {r2, r3}
+	code[43] = 0xE891; code[44] = 0x000C; // LDM.W r1, {r2, r3}
+	code[45] = 0xBF02; // ITTT EQ
+	code[46] = 0x2000; // MOVEQ r0, #0
+	code[47] = 0xE9D1; code[48] = 0x2302; // LDRDEQ r2, r3, [r1, #8]
+	code[49] = 0xF921; code[50] = 0x0AAF; // VLD1EQ.32 {d0, d1}, [r1:128]
+	code[51] = 0xE9D1; code[52] = 0x2302; // LDRD r2, r3, [r1, #8]
+
+	code[94] = 0xE891; code[95] = 0x000C; // LDM.W r1, {r2, r3}, past the last full prefilter block
+
+	so_scan s;
+	so_scan_init(&s);
+	int found = so_scan_thumb(&s, code, sizeof(code), VADDR);
+
+	THUMB_SITE(2, -1, 0);
+	THUMB_SITE(4, SCAN_LDM, 0);
+	THUMB_SITE(5, SCAN_LDM, 1);
+	THUMB_SITE(7, SCAN_LDM, 0);
+	THUMB_SITE(9, SCAN_LDM, 1);
+	THUMB_SITE(11, SCAN_LDM, 0);
+	THUMB_SITE(13, SCAN_LDRD, 1);
+	THUMB_SITE(15, SCAN_LDRD, 1);
+	THUMB_SITE(17, SCAN_LDRD, 1);
+	THUMB_SITE(19, SCAN_LDRD, 0);
+	THUMB_SITE(21, SCAN_LDRD, 0);
+	THUMB_SITE(23, SCAN_LDRD, 0);
+	THUMB_SITE(25, SCAN_LDRD, 0);
+	THUMB_SITE(27, -1, 0);
+	THUMB_SITE(41, SCAN_LDM, 0);
+	THUMB_SITE(43, SCAN_LDM, 1);
+	THUMB_SITE(47, SCAN_LDRD, 0);
+	THUMB_SITE(49, SCAN_VLD, 1); // only the qualifier changes, fine inside IT
+	THUMB_SITE(51, SCAN_LDRD, 1);
+	THUMB_SITE(94, SCAN_LDM, 1);
+	CHECK(found == 18);
+
+	so_scan_free(&s);
+}
+
+static void test_decode(void) {
+	so_scan_site site;
+
+	uint32_t arm[] = { 0xE891000C, 0xE14120D8, ARM_NOP };
+	CHECK(so_scan_decode(&site, (uintptr_t)&arm[0], 0) == SCAN_LDM && site.fixable && site.instr == arm[0]);
+	CHECK(so_scan_decode(&site, (uintptr_t)&arm[1], 0) == SCAN_LDRD && site.fixable);
+	CHECK(so_scan_decode(&site, (uintptr_t)&arm[2], 0) == -1 && !site.fixable);
+
+	uint16_t thumb[] = { 0xE951, 0x2310, 0xE951, 0x23FF, 0xC90C, 0xE8B1, 0x000C };
+	CHECK(so_scan_decode(&site, (uintptr_t)&thumb[0], 1) == SCAN_LDRD && site.fixable && site.instr == 0x2310E951);
+	CHECK(so_scan_decode(&site, (uintptr_t)&thumb[2], 1) == SCAN_LDRD && !site.fixable);
+	CHECK(so_scan_decode(&site, (uintptr_t)&thumb[4], 1) == SCAN_LDM && !site.fixable && site.instr == 0xC90C);
+	CHECK(so_scan_decode(&site, (uintptr_t)&thumb[5], 1) == SCAN_LDM && !site.fixable);
+}
+
+int main(void) {
+	test_arm();
+	test_thumb();
+	test_decode();
+
+	if (failed) {
+		printf("%d checks failed\n", failed);
+		return 1;
+	}
+	printf("so_scan: all checks passed\n");
+	return 0;
+}
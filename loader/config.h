@@ -10,6 +10,43 @@
 
 #define DATA_PATH "ux0:data/smb2"
 #define SO_PATH DATA_PATH "/" "libsmb2.so"
+#define SO_GZ_PATH SO_PATH ".gz"
+#define CACHE_PATH DATA_PATH "/" "libsmb2.cache"
+#define IMAGE_PATH DATA_PATH "/" "libsmb2.img"
+
+// Misaligned LDM/LDRD/VLDn scan on first boot: 0 = off, 1 = report only, 2 = also patch fixable sites
+#define SCAN_MISALIGNED 1
+
+// Alignment faults emulated by the abort handler before the site gets patched (0 = handler off)
+#define FAULT_THRESHOLD 16
+#define FAULT_REPORT_PATH DATA_PATH "/" "misaligned.txt"
+
+// Bind imports on first call instead of at boot, used ones get listed at exit
+#define LAZY_BINDING 0
+#define IMPORTS_REPORT_PATH DATA_PATH "/" "imports.txt"
+
+// Sampling profiler for libsmb2 code: samples per second (0 = off), PROFILER_COMBO writes the folded stacks
+#define PROFILER_HZ 0
+#define PROFILER_UNWIND 1
+#define PROFILER_COMBO (SCE_CTRL_LTRIGGER | SCE_CTRL_RTRIGGER | SCE_CTRL_SELECT)
+#define PROFILER_PATH DATA_PATH "/" "profile.folded"
+#define PROFILER_RAW_PATH DATA_PATH "/" "profile.bin"
+
+// Route imports through counting thunks (needs LAZY_BINDING 0), per-import calls and time get written to IMPORT_PROFILE_PATH
+#define IMPORT_PROFILER 0
+#define IMPORT_PROFILE_PATH DATA_PATH "/" "imports_profile.txt"
+
+// Entry/exit tracing of the exported libsmb2 functions matching TRACE_FUNCTIONS (comma separated, * and ? wildcards),
+// TRACE_COMBO writes the last calls of every thread as a Chrome trace (chrome://tracing, ui.perfetto.dev)
+#define FUNCTION_TRACING 0
+#define TRACE_FUNCTIONS "_ZN5shark*,_ZN2io*"
+#define TRACE_COMBO (SCE_CTRL_LTRIGGER | SCE_CTRL_RTRIGGER | SCE_CTRL_START)
+#define TRACE_PATH DATA_PATH "/" "trace.json"
+
+// Timeline of main() up to the first frame, each libsmb2 constructor included, written as a Chrome trace
+#define BOOT_TRACE 0
+#define BOOT_TRACE_PATH DATA_PATH "/" "boot_trace.json"
+
 #define TROPHIES_FILE "ux0:data/smb2/trophies.chk"
 
 #define SCREEN_W 960
@@ -0,0 +1,275 @@
+/* default_dynlib.h -- imports of libsmb2.so the loader provides
+ *
+ * One DYNLIB("symbol", function) per import, expanded by main.c and by the host's
+ * so_prelink, which only needs the symbol names the image is keyed on.
+ */
+
+DYNLIB("__aeabi_atexit", __aeabi_atexit)
+DYNLIB("__aeabi_uidiv", __aeabi_uidiv)
+DYNLIB("__aeabi_uidivmod", __aeabi_uidivmod)
+DYNLIB("__aeabi_idiv", __aeabi_idiv)
+DYNLIB("__aeabi_idivmod", __aeabi_idivmod)
+DYNLIB("__android_log_print", __android_log_print)
+DYNLIB("__android_log_vprint", __android_log_vprint)
+DYNLIB("__cxa_atexit", __cxa_atexit)
+DYNLIB("__cxa_finalize", __cxa_finalize)
+DYNLIB("__errno", __errno)
+DYNLIB("__gnu_unwind_frame", __gnu_unwind_frame)
+// DYNLIB("__google_potentially_blocking_region_begin", __google_potentially_blocking_region_begin)
+// DYNLIB("__google_potentially_blocking_region_end", __google_potentially_blocking_region_end)
+DYNLIB("__sF", __sF_fake)
+DYNLIB("__stack_chk_fail", __stack_chk_fail)
+DYNLIB("__stack_chk_guard", __stack_chk_guard_fake)
+DYNLIB("_ctype_", __ctype_)
+DYNLIB("abort", abort)
+// DYNLIB("accept", accept)
+DYNLIB("acos", acos)
+DYNLIB("acosf", acosf)
+DYNLIB("asin", asin)
+DYNLIB("asinf", asinf)
+DYNLIB("atan", atan)
+DYNLIB("atan2", atan2)
+DYNLIB("atan2f", atan2f)
+DYNLIB("atanf", atanf)
+DYNLIB("atoi", atoi)
+DYNLIB("atoll", atoll)
+// DYNLIB("bind", bind)
+DYNLIB("bsearch", bsearch)
+DYNLIB("btowc", btowc)
+DYNLIB("calloc", calloc)
+DYNLIB("ceil", ceil)
+DYNLIB("ceilf", ceilf)
+DYNLIB("clearerr", clearerr)
+DYNLIB("clock", clock)
+DYNLIB("clock_gettime", clock_gettime)
+DYNLIB("close", close)
+DYNLIB("cos", cos)
+DYNLIB("cosf", cosf)
+DYNLIB("cosh", cosh)
+DYNLIB("crc32", crc32)
+DYNLIB("difftime", difftime)
+DYNLIB("div", div)
+DYNLIB("dlopen", ret0)
+DYNLIB("exit", exit)
+DYNLIB("exp", exp)
+DYNLIB("expf", expf)
+DYNLIB("fclose", fclose)
+DYNLIB("fcntl", ret0)
+DYNLIB("fdopen", fdopen)
+DYNLIB("ferror", ferror)
+DYNLIB("fflush", fflush)
+DYNLIB("fgets", fgets)
+DYNLIB("floor", floor)
+DYNLIB("floorf", floorf)
+DYNLIB("fmod", fmod)
+DYNLIB("fmodf", fmodf)
+DYNLIB("fopen", fopen_hook)
+DYNLIB("fprintf", fprintf)
+DYNLIB("fputc", fputc)
+DYNLIB("fputs", fputs)
+DYNLIB("fread", fread)
+DYNLIB("free", free)
+DYNLIB("frexp", frexp)
+DYNLIB("frexpf", frexpf)
+DYNLIB("fscanf", fscanf)
+DYNLIB("fseek", fseek)
+DYNLIB("fstat", fstat_hook)
+DYNLIB("ftell", ftell)
+DYNLIB("fwrite", fwrite)
+DYNLIB("getc", getc)
+DYNLIB("getenv", ret0)
+DYNLIB("getwc", getwc)
+DYNLIB("gettimeofday", gettimeofday)
+DYNLIB("glVertexAttribPointer", glVertexAttribPointer_hook)
+DYNLIB("glEnableVertexAttribArray", glEnableVertexAttribArray_hook)
+DYNLIB("glAlphaFunc", glAlphaFunc)
+DYNLIB("glBindBuffer", glBindBuffer)
+DYNLIB("glBindTexture", glBindTexture)
+DYNLIB("glBlendFunc", glBlendFunc)
+DYNLIB("glBufferData", glBufferData)
+DYNLIB("glClear", glClear)
+DYNLIB("glClearColor", glClearColor)
+DYNLIB("glClearDepthf", glClearDepthf)
+DYNLIB("glColorPointer", glColorPointer)
+DYNLIB("glCompressedTexImage2D", glCompressedTexImage2D)
+DYNLIB("glDeleteBuffers", glDeleteBuffers)
+DYNLIB("glDeleteTextures", glDeleteTextures)
+DYNLIB("glDepthFunc", glDepthFunc)
+DYNLIB("glDepthMask", glDepthMask)
+DYNLIB("glDisable", glDisable)
+DYNLIB("glDrawElements", glDrawElements)
+DYNLIB("glEnable", glEnable)
+DYNLIB("glEnableClientState", glEnableClientState)
+DYNLIB("glGenBuffers", glGenBuffers)
+DYNLIB("glGenTextures", glGenTextures)
+DYNLIB("glGetError", ret0)
+DYNLIB("glLoadIdentity", glLoadIdentity)
+DYNLIB("glMatrixMode", glMatrixMode)
+DYNLIB("glMultMatrixx", glMultMatrixx)
+DYNLIB("glOrthof", glOrthof)
+DYNLIB("glPixelStorei", ret0)
+DYNLIB("glPopMatrix", glPopMatrix)
+DYNLIB("glPushMatrix", glPushMatrix)
+DYNLIB("glTexCoordPointer", glTexCoordPointer)
+DYNLIB("glTexImage2D", glTexImage2D)
+DYNLIB("glTexParameteri", glTexParameteri)
+DYNLIB("glTexSubImage2D", glTexSubImage2D)
+DYNLIB("glTranslatex", glTranslatex)
+DYNLIB("glVertexPointer", glVertexPointer)
+DYNLIB("glViewport", glViewport)
+DYNLIB("gmtime", gmtime)
+DYNLIB("gzopen", ret0)
+DYNLIB("inflate", inflate)
+DYNLIB("inflateEnd", inflateEnd)
+DYNLIB("inflateInit_", inflateInit_)
+DYNLIB("inflateReset", inflateReset)
+DYNLIB("isalnum", isalnum)
+DYNLIB("isalpha", isalpha)
+DYNLIB("iscntrl", iscntrl)
+DYNLIB("islower", islower)
+DYNLIB("ispunct", ispunct)
+DYNLIB("isprint", isprint)
+DYNLIB("isspace", isspace)
+DYNLIB("isupper", isupper)
+DYNLIB("iswalpha", iswalpha)
+DYNLIB("iswcntrl", iswcntrl)
+DYNLIB("iswctype", iswctype)
+DYNLIB("iswdigit", iswdigit)
+DYNLIB("iswdigit", iswdigit)
+DYNLIB("iswlower", iswlower)
+DYNLIB("iswprint", iswprint)
+DYNLIB("iswpunct", iswpunct)
+DYNLIB("iswspace", iswspace)
+DYNLIB("iswupper", iswupper)
+DYNLIB("iswxdigit", iswxdigit)
+DYNLIB("isxdigit", isxdigit)
+DYNLIB("ldexp", ldexp)
+// DYNLIB("listen", listen)
+DYNLIB("localtime", localtime)
+DYNLIB("localtime_r", localtime_r)
+DYNLIB("log", log)
+DYNLIB("log10", log10)
+DYNLIB("longjmp", longjmp)
+DYNLIB("lrand48", lrand48)
+DYNLIB("lrint", lrint)
+DYNLIB("lrintf", lrintf)
+DYNLIB("lseek", lseek)
+DYNLIB("malloc", malloc)
+DYNLIB("mbrtowc", mbrtowc)
+DYNLIB("memchr", sceClibMemchr)
+DYNLIB("memcmp", memcmp)
+DYNLIB("memcpy", sceClibMemcpy)
+DYNLIB("memmove", sceClibMemmove)
+DYNLIB("memset", sceClibMemset)
+DYNLIB("mkdir", mkdir)
+DYNLIB("mktime", mktime)
+DYNLIB("mmap", mmap)
+DYNLIB("munmap", munmap)
+DYNLIB("modf", modf)
+// DYNLIB("poll", poll)
+DYNLIB("open", open_hook)
+DYNLIB("pow", pow)
+DYNLIB("powf", powf)
+DYNLIB("printf", printf)
+DYNLIB("puts", puts)
+DYNLIB("pthread_attr_destroy", ret0)
+DYNLIB("pthread_attr_init", ret0)
+DYNLIB("pthread_attr_setdetachstate", ret0)
+DYNLIB("pthread_cond_broadcast", pthread_cond_broadcast_fake)
+DYNLIB("pthread_cond_wait", pthread_cond_wait_fake)
+DYNLIB("pthread_create", pthread_create_fake)
+DYNLIB("pthread_getschedparam", pthread_getschedparam)
+DYNLIB("pthread_getspecific", pthread_getspecific)
+DYNLIB("pthread_key_create", pthread_key_create)
+DYNLIB("pthread_key_delete", pthread_key_delete)
+DYNLIB("pthread_mutex_destroy", pthread_mutex_destroy_fake)
+DYNLIB("pthread_mutex_init", pthread_mutex_init_fake)
+DYNLIB("pthread_mutex_lock", pthread_mutex_lock_fake)
+DYNLIB("pthread_mutex_unlock", pthread_mutex_unlock_fake)
+DYNLIB("pthread_once", pthread_once_fake)
+DYNLIB("pthread_self", pthread_self)
+DYNLIB("pthread_setschedparam", pthread_setschedparam)
+DYNLIB("pthread_setspecific", pthread_setspecific)
+DYNLIB("putc", putc)
+DYNLIB("putwc", putwc)
+DYNLIB("qsort", qsort)
+DYNLIB("read", read)
+DYNLIB("realloc", realloc)
+DYNLIB("remove", remove)
+// DYNLIB("recv", recv)
+DYNLIB("rint", rint)
+// DYNLIB("send", send)
+// DYNLIB("sendto", sendto)
+DYNLIB("setenv", ret0)
+DYNLIB("setjmp", setjmp)
+// DYNLIB("setlocale", setlocale)
+// DYNLIB("setsockopt", setsockopt)
+DYNLIB("setvbuf", setvbuf)
+DYNLIB("sin", sin)
+DYNLIB("sinf", sinf)
+DYNLIB("sinh", sinh)
+DYNLIB("snprintf", snprintf)
+// DYNLIB("socket", socket)
+DYNLIB("sprintf", sprintf)
+DYNLIB("sqrt", sqrt)
+DYNLIB("sqrtf", sqrtf)
+DYNLIB("srand48", srand48)
+DYNLIB("sscanf", sscanf)
+DYNLIB("stat", stat_hook)
+DYNLIB("strcasecmp", strcasecmp)
+DYNLIB("strcat", strcat)
+DYNLIB("strchr", strchr)
+DYNLIB("strcmp", sceClibStrcmp)
+DYNLIB("strcoll", strcoll)
+DYNLIB("strcpy", strcpy)
+DYNLIB("strcspn", strcspn)
+DYNLIB("strerror", strerror)
+DYNLIB("strftime", strftime)
+DYNLIB("strlen", strlen)
+DYNLIB("strncasecmp", sceClibStrncasecmp)
+DYNLIB("strncat", sceClibStrncat)
+DYNLIB("strncmp", sceClibStrncmp)
+DYNLIB("strncpy", sceClibStrncpy)
+DYNLIB("strpbrk", strpbrk)
+DYNLIB("strrchr", sceClibStrrchr)
+DYNLIB("strdup", strdup)
+DYNLIB("strstr", sceClibStrstr)
+DYNLIB("strtod", strtod)
+DYNLIB("strtol", strtol)
+DYNLIB("strtok", strtok)
+DYNLIB("strtoul", strtoul)
+DYNLIB("strxfrm", strxfrm)
+DYNLIB("sysconf", ret0)
+DYNLIB("tan", tan)
+DYNLIB("tanf", tanf)
+DYNLIB("tanh", tanh)
+DYNLIB("time", time)
+DYNLIB("tolower", tolower)
+DYNLIB("toupper", toupper)
+DYNLIB("towlower", towlower)
+DYNLIB("towupper", towupper)
+DYNLIB("ungetc", ungetc)
+DYNLIB("ulink", ulink)
+DYNLIB("ungetwc", ungetwc)
+DYNLIB("usleep", usleep)
+DYNLIB("vfprintf", vfprintf)
+DYNLIB("vprintf", vprintf)
+DYNLIB("vsnprintf", vsnprintf)
+DYNLIB("vsprintf", vsprintf)
+DYNLIB("vswprintf", vswprintf)
+DYNLIB("wcrtomb", wcrtomb)
+DYNLIB("wcscoll", wcscoll)
+DYNLIB("wcscmp", wcscmp)
+DYNLIB("wcsncpy", wcsncpy)
+DYNLIB("wcsftime", wcsftime)
+DYNLIB("wcslen", wcslen)
+DYNLIB("wcsxfrm", wcsxfrm)
+DYNLIB("wctob", wctob)
+DYNLIB("wctype", wctype)
+DYNLIB("wmemchr", wmemchr)
+DYNLIB("wmemcmp", wmemcmp)
+DYNLIB("wmemcpy", wmemcpy)
+DYNLIB("wmemmove", wmemmove)
+DYNLIB("wmemset", wmemset)
+DYNLIB("write", write)
+// DYNLIB("writev", writev)
@@ -0,0 +1,16 @@
+/* default_hooks.h -- libsmb2.so functions replaced by the loader
+ *
+ * HOOK("symbol", function), or HOOK_STATE("symbol", function, state) for hooks whose
+ * so_hook is kept to call the original. Expanded by main.c and by the host's so_prelink.
+ */
+
+HOOK("_ZN5shark19AndroidJNIInterface14FlurryLogEventEPKcSt3mapISsSsSt4lessISsESaISt4pairIKSsSsEEE", ret0)
+HOOK("_ZN7android9GetJNIEnvEv", GetJNIEnv)
+HOOK("_ZN7android16LogJavaExceptionEb", ret0)
+HOOK("_ZN17GameCircleWrapper8IsAmazonEv", ret0)
+HOOK("_ZN5shark19AndroidJNIInterface14SetMusicVolumeEf", SetMusicVolume)
+HOOK("_ZN5shark19AndroidJNIInterface9PlaySoundEidffb", PlaySound)
+HOOK_STATE("_ZN2io13Accelerometer6EnableEv", EnableAccelerometer, accel_hook)
+HOOK("_ZN5shark19AndroidJNIInterface9SetVolumeEif", SetVolume)
+HOOK("_ZN5shark19AndroidJNIInterface8SetPitchEif", SetPitch)
+HOOK("_ZN18AchievementManager17UnlockAchievementEi", UnlockAchievement)
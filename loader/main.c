@@ -40,6 +40,10 @@
 #include "config.h"
 #include "dialog.h"
 #include "so_util.h"
+#include "so_fault.h"
+#include "so_prof.h"
+#include "so_calls.h"
+#include "so_boot.h"
 #include "sha1.h"
 #include "trophies.h"
 
@@ -329,17 +333,47 @@ void UnlockAchievement(void *this, int id) {
 	trophies_unlock(id + 1);
 }
 
-void patch_game(void) {
-	hook_addr(so_symbol(&smb2_mod, "_ZN5shark19AndroidJNIInterface14FlurryLogEventEPKcSt3mapISsSsSt4lessISsESaISt4pairIKSsSsEEE"), (uintptr_t)&ret0);
-	hook_addr(so_symbol(&smb2_mod, "_ZN7android9GetJNIEnvEv"), (uintptr_t)&GetJNIEnv);
-	hook_addr(so_symbol(&smb2_mod, "_ZN7android16LogJavaExceptionEb"), (uintptr_t)&ret0);
-	hook_addr(so_symbol(&smb2_mod, "_ZN17GameCircleWrapper8IsAmazonEv"), (uintptr_t)&ret0);
-	hook_addr(so_symbol(&smb2_mod, "_ZN5shark19AndroidJNIInterface14SetMusicVolumeEf"), (uintptr_t)&SetMusicVolume);
-	hook_addr(so_symbol(&smb2_mod, "_ZN5shark19AndroidJNIInterface9PlaySoundEidffb"), (uintptr_t)&PlaySound);
-	accel_hook = hook_addr(so_symbol(&smb2_mod, "_ZN2io13Accelerometer6EnableEv"), (uintptr_t)&EnableAccelerometer);
-	hook_addr(so_symbol(&smb2_mod, "_ZN5shark19AndroidJNIInterface9SetVolumeEif"), (uintptr_t)&SetVolume);
-	hook_addr(so_symbol(&smb2_mod, "_ZN5shark19AndroidJNIInterface8SetPitchEif"), (uintptr_t)&SetPitch);
-	hook_addr(so_symbol(&smb2_mod, "_ZN18AchievementManager17UnlockAchievementEi"), (uintptr_t)&UnlockAchievement);
+#define HOOK(symbol, func) { symbol, (uintptr_t)&func, NULL },
+#define HOOK_STATE(symbol, func, state) { symbol, (uintptr_t)&func, &state },
+static so_default_hook default_hooks[] = {
+#include "default_hooks.h"
+};
+
+typedef struct {
+	const char *sha1; // hex digest of the uncompressed libsmb2.so
+	const char *name;
+	so_default_hook *hooks; // applied on top of default_hooks after the image is saved, NULL if none
+	int size_hooks;
+} game_version;
+
+// Supported libsmb2.so builds (lib/armeabi-v7a of the paid APKs), picked by the digest taken while the module
+// streams in. Any other digest is refused before anything is patched. The digests still have to be filled in
+// from the release APKs, an empty one matches nothing.
+static game_version game_versions[] = {
+	{ "", "v1.0", NULL, 0 },
+	{ "", "v1.1", NULL, 0 },
+	{ "", "v1.2", NULL, 0 },
+};
+
+static char game_sha1[SHA1_BLOCK_SIZE * 2 + 1];
+static game_version *version;
+
+static game_version *detect_version(so_module *mod) {
+	for (int i = 0; i < SHA1_BLOCK_SIZE; i++)
+		sprintf(&game_sha1[i * 2], "%02x", mod->sha1[i]);
+
+	for (int i = 0; i < sizeof(game_versions) / sizeof(game_version); i++) {
+		if (strcasecmp(game_versions[i].sha1, game_sha1) == 0) {
+			printf("libsmb2.so: %s\n", game_versions[i].name);
+			return &game_versions[i];
+		}
+	}
+	printf("libsmb2.so: unsupported build (sha1 %s)\n", game_sha1);
+	return NULL;
+}
+
+int patch_game(void) {
+	return so_hook_symbols(&smb2_mod, default_hooks, sizeof(default_hooks));
 }
 
 extern void *__aeabi_atexit;
@@ -415,276 +449,9 @@ void glEnableVertexAttribArray_hook(GLuint index) {
 		skip_next_attrib_array = GL_FALSE;
 }
 
+#define DYNLIB(symbol, func) { symbol, (uintptr_t)&func },
 static so_default_dynlib default_dynlib[] = {
-	{ "__aeabi_atexit", (uintptr_t)&__aeabi_atexit },
-	{ "__aeabi_uidiv", (uintptr_t)&__aeabi_uidiv },
-	{ "__aeabi_uidivmod", (uintptr_t)&__aeabi_uidivmod },
-	{ "__aeabi_idiv", (uintptr_t)&__aeabi_idiv },
-	{ "__aeabi_idivmod", (uintptr_t)&__aeabi_idivmod },
-	{ "__android_log_print", (uintptr_t)&__android_log_print },
-	{ "__android_log_vprint", (uintptr_t)&__android_log_vprint },
-	{ "__cxa_atexit", (uintptr_t)&__cxa_atexit },
-	{ "__cxa_finalize", (uintptr_t)&__cxa_finalize },
-	{ "__errno", (uintptr_t)&__errno },
-	{ "__gnu_unwind_frame", (uintptr_t)&__gnu_unwind_frame },
-	// { "__google_potentially_blocking_region_begin", (uintptr_t)&__google_potentially_blocking_region_begin },
-	// { "__google_potentially_blocking_region_end", (uintptr_t)&__google_potentially_blocking_region_end },
-	{ "__sF", (uintptr_t)&__sF_fake },
-	{ "__stack_chk_fail", (uintptr_t)&__stack_chk_fail },
-	{ "__stack_chk_guard", (uintptr_t)&__stack_chk_guard_fake },
-	{ "_ctype_", (uintptr_t)&__ctype_ },
-	{ "abort", (uintptr_t)&abort },
-	// { "accept", (uintptr_t)&accept },
-	{ "acos", (uintptr_t)&acos },
-	{ "acosf", (uintptr_t)&acosf },
-	{ "asin", (uintptr_t)&asin },
-	{ "asinf", (uintptr_t)&asinf },
-	{ "atan", (uintptr_t)&atan },
-	{ "atan2", (uintptr_t)&atan2 },
-	{ "atan2f", (uintptr_t)&atan2f },
-	{ "atanf", (uintptr_t)&atanf },
-	{ "atoi", (uintptr_t)&atoi },
-	{ "atoll", (uintptr_t)&atoll },
-	// { "bind", (uintptr_t)&bind },
-	{ "bsearch", (uintptr_t)&bsearch },
-	{ "btowc", (uintptr_t)&btowc },
-	{ "calloc", (uintptr_t)&calloc },
-	{ "ceil", (uintptr_t)&ceil },
-	{ "ceilf", (uintptr_t)&ceilf },
-	{ "clearerr", (uintptr_t)&clearerr },
-	{ "clock", (uintptr_t)&clock },
-	{ "clock_gettime", (uintptr_t)&clock_gettime },
-	{ "close", (uintptr_t)&close },
-	{ "cos", (uintptr_t)&cos },
-	{ "cosf", (uintptr_t)&cosf },
-	{ "cosh", (uintptr_t)&cosh },
-	{ "crc32", (uintptr_t)&crc32 },
-	{ "difftime", (uintptr_t)&difftime },
-	{ "div", (uintptr_t)&div },
-	{ "dlopen", (uintptr_t)&ret0 },
-	{ "exit", (uintptr_t)&exit },
-	{ "exp", (uintptr_t)&exp },
-	{ "expf", (uintptr_t)&expf },
-	{ "fclose", (uintptr_t)&fclose },
-	{ "fcntl", (uintptr_t)&ret0 },
-	{ "fdopen", (uintptr_t)&fdopen },
-	{ "ferror", (uintptr_t)&ferror },
-	{ "fflush", (uintptr_t)&fflush },
-	{ "fgets", (uintptr_t)&fgets },
-	{ "floor", (uintptr_t)&floor },
-	{ "floorf", (uintptr_t)&floorf },
-	{ "fmod", (uintptr_t)&fmod },
-	{ "fmodf", (uintptr_t)&fmodf },
-	{ "fopen", (uintptr_t)&fopen_hook },
-	{ "fprintf", (uintptr_t)&fprintf },
-	{ "fputc", (uintptr_t)&fputc },
-	{ "fputs", (uintptr_t)&fputs },
-	{ "fread", (uintptr_t)&fread },
-	{ "free", (uintptr_t)&free },
-	{ "frexp", (uintptr_t)&frexp },
-	{ "frexpf", (uintptr_t)&frexpf },
-	{ "fscanf", (uintptr_t)&fscanf },
-	{ "fseek", (uintptr_t)&fseek },
-	{ "fstat", (uintptr_t)&fstat_hook },
-	{ "ftell", (uintptr_t)&ftell },
-	{ "fwrite", (uintptr_t)&fwrite },
-	{ "getc", (uintptr_t)&getc },
-	{ "getenv", (uintptr_t)&ret0 },
-	{ "getwc", (uintptr_t)&getwc },
-	{ "gettimeofday", (uintptr_t)&gettimeofday },
-	{ "glVertexAttribPointer", (uintptr_t)&glVertexAttribPointer_hook },
-	{ "glEnableVertexAttribArray", (uintptr_t)&glEnableVertexAttribArray_hook },
-	{ "glAlphaFunc", (uintptr_t)&glAlphaFunc },
-	{ "glBindBuffer", (uintptr_t)&glBindBuffer },
-	{ "glBindTexture", (uintptr_t)&glBindTexture },
-	{ "glBlendFunc", (uintptr_t)&glBlendFunc },
-	{ "glBufferData", (uintptr_t)&glBufferData },
-	{ "glClear", (uintptr_t)&glClear },
-	{ "glClearColor", (uintptr_t)&glClearColor },
-	{ "glClearDepthf", (uintptr_t)&glClearDepthf },
-	{ "glColorPointer", (uintptr_t)&glColorPointer },
-	{ "glCompressedTexImage2D", (uintptr_t)&glCompressedTexImage2D },
-	{ "glDeleteBuffers", (uintptr_t)&glDeleteBuffers },
-	{ "glDeleteTextures", (uintptr_t)&glDeleteTextures },
-	{ "glDepthFunc", (uintptr_t)&glDepthFunc },
-	{ "glDepthMask", (uintptr_t)&glDepthMask },
-	{ "glDisable", (uintptr_t)&glDisable },
-	{ "glDrawElements", (uintptr_t)&glDrawElements },
-	{ "glEnable", (uintptr_t)&glEnable },
-	{ "glEnableClientState", (uintptr_t)&glEnableClientState },
-	{ "glGenBuffers", (uintptr_t)&glGenBuffers },
-	{ "glGenTextures", (uintptr_t)&glGenTextures },
-	{ "glGetError", (uintptr_t)&ret0 },
-	{ "glLoadIdentity", (uintptr_t)&glLoadIdentity },
-	{ "glMatrixMode", (uintptr_t)&glMatrixMode },
-	{ "glMultMatrixx", (uintptr_t)&glMultMatrixx },
-	{ "glOrthof", (uintptr_t)&glOrthof },
-	{ "glPixelStorei", (uintptr_t)&ret0 },
-	{ "glPopMatrix", (uintptr_t)&glPopMatrix },
-	{ "glPushMatrix", (uintptr_t)&glPushMatrix },
-	{ "glTexCoordPointer", (uintptr_t)&glTexCoordPointer },
-	{ "glTexImage2D", (uintptr_t)&glTexImage2D },
-	{ "glTexParameteri", (uintptr_t)&glTexParameteri },
-	{ "glTexSubImage2D", (uintptr_t)&glTexSubImage2D },
-	{ "glTranslatex", (uintptr_t)&glTranslatex },
-	{ "glVertexPointer", (uintptr_t)&glVertexPointer },
-	{ "glViewport", (uintptr_t)&glViewport },
-	{ "gmtime", (uintptr_t)&gmtime },
-	{ "gzopen", (uintptr_t)&ret0 },
-	{ "inflate", (uintptr_t)&inflate },
-	{ "inflateEnd", (uintptr_t)&inflateEnd },
-	{ "inflateInit_", (uintptr_t)&inflateInit_ },
-	{ "inflateReset", (uintptr_t)&inflateReset },
-	{ "isalnum", (uintptr_t)&isalnum },
-	{ "isalpha", (uintptr_t)&isalpha },
-	{ "iscntrl", (uintptr_t)&iscntrl },
-	{ "islower", (uintptr_t)&islower },
-	{ "ispunct", (uintptr_t)&ispunct },
-	{ "isprint", (uintptr_t)&isprint },
-	{ "isspace", (uintptr_t)&isspace },
-	{ "isupper", (uintptr_t)&isupper },
-	{ "iswalpha", (uintptr_t)&iswalpha },
-	{ "iswcntrl", (uintptr_t)&iswcntrl },
-	{ "iswctype", (uintptr_t)&iswctype },
-	{ "iswdigit", (uintptr_t)&iswdigit },
-	{ "iswdigit", (uintptr_t)&iswdigit },
-	{ "iswlower", (uintptr_t)&iswlower },
-	{ "iswprint", (uintptr_t)&iswprint },
-	{ "iswpunct", (uintptr_t)&iswpunct },
-	{ "iswspace", (uintptr_t)&iswspace },
-	{ "iswupper", (uintptr_t)&iswupper },
-	{ "iswxdigit", (uintptr_t)&iswxdigit },
-	{ "isxdigit", (uintptr_t)&isxdigit },
-	{ "ldexp", (uintptr_t)&ldexp },
-	// { "listen", (uintptr_t)&listen },
-	{ "localtime", (uintptr_t)&localtime },
-	{ "localtime_r", (uintptr_t)&localtime_r },
-	{ "log", (uintptr_t)&log },
-	{ "log10", (uintptr_t)&log10 },
-	{ "longjmp", (uintptr_t)&longjmp },
-	{ "lrand48", (uintptr_t)&lrand48 },
-	{ "lrint", (uintptr_t)&lrint },
-	{ "lrintf", (uintptr_t)&lrintf },
-	{ "lseek", (uintptr_t)&lseek },
-	{ "malloc", (uintptr_t)&malloc },
-	{ "mbrtowc", (uintptr_t)&mbrtowc },
-	{ "memchr", (uintptr_t)&sceClibMemchr },
-	{ "memcmp", (uintptr_t)&memcmp },
-	{ "memcpy", (uintptr_t)&sceClibMemcpy },
-	{ "memmove", (uintptr_t)&sceClibMemmove },
-	{ "memset", (uintptr_t)&sceClibMemset },
-	{ "mkdir", (uintptr_t)&mkdir },
-	{ "mktime", (uintptr_t)&mktime },
-	{ "mmap", (uintptr_t)&mmap},
-	{ "munmap", (uintptr_t)&munmap},
-	{ "modf", (uintptr_t)&modf },
-	// { "poll", (uintptr_t)&poll },
-	{ "open", (uintptr_t)&open_hook },
-	{ "pow", (uintptr_t)&pow },
-	{ "powf", (uintptr_t)&powf },
-	{ "printf", (uintptr_t)&printf },
-	{ "puts", (uintptr_t)&puts },
-	{ "pthread_attr_destroy", (uintptr_t)&ret0 },
-	{ "pthread_attr_init", (uintptr_t)&ret0 },
-	{ "pthread_attr_setdetachstate", (uintptr_t)&ret0 },
-	{ "pthread_cond_broadcast", (uintptr_t)&pthread_cond_broadcast_fake},
-	{ "pthread_cond_wait", (uintptr_t)&pthread_cond_wait_fake},
-	{ "pthread_create", (uintptr_t)&pthread_create_fake },
-	{ "pthread_getschedparam", (uintptr_t)&pthread_getschedparam },
-	{ "pthread_getspecific", (uintptr_t)&pthread_getspecific },
-	{ "pthread_key_create", (uintptr_t)&pthread_key_create },
-	{ "pthread_key_delete", (uintptr_t)&pthread_key_delete },
-	{ "pthread_mutex_destroy", (uintptr_t)&pthread_mutex_destroy_fake },
-	{ "pthread_mutex_init", (uintptr_t)&pthread_mutex_init_fake },
-	{ "pthread_mutex_lock", (uintptr_t)&pthread_mutex_lock_fake },
-	{ "pthread_mutex_unlock", (uintptr_t)&pthread_mutex_unlock_fake },
-	{ "pthread_once", (uintptr_t)&pthread_once_fake },
-	{ "pthread_self", (uintptr_t)&pthread_self },
-	{ "pthread_setschedparam", (uintptr_t)&pthread_setschedparam },
-	{ "pthread_setspecific", (uintptr_t)&pthread_setspecific },
-	{ "putc", (uintptr_t)&putc },
-	{ "putwc", (uintptr_t)&putwc },
-	{ "qsort", (uintptr_t)&qsort },
-	{ "read", (uintptr_t)&read },
-	{ "realloc", (uintptr_t)&realloc },
-	{ "remove", (uintptr_t)&remove },
-	// { "recv", (uintptr_t)&recv },
-	{ "rint", (uintptr_t)&rint },
-	// { "send", (uintptr_t)&send },
-	// { "sendto", (uintptr_t)&sendto },
-	{ "setenv", (uintptr_t)&ret0 },
-	{ "setjmp", (uintptr_t)&setjmp },
-	// { "setlocale", (uintptr_t)&setlocale },
-	// { "setsockopt", (uintptr_t)&setsockopt },
-	{ "setvbuf", (uintptr_t)&setvbuf },
-	{ "sin", (uintptr_t)&sin },
-	{ "sinf", (uintptr_t)&sinf },
-	{ "sinh", (uintptr_t)&sinh },
-	{ "snprintf", (uintptr_t)&snprintf },
-	// { "socket", (uintptr_t)&socket },
-	{ "sprintf", (uintptr_t)&sprintf },
-	{ "sqrt", (uintptr_t)&sqrt },
-	{ "sqrtf", (uintptr_t)&sqrtf },
-	{ "srand48", (uintptr_t)&srand48 },
-	{ "sscanf", (uintptr_t)&sscanf },
-	{ "stat", (uintptr_t)&stat_hook },
-	{ "strcasecmp", (uintptr_t)&strcasecmp },
-	{ "strcat", (uintptr_t)&strcat },
-	{ "strchr", (uintptr_t)&strchr },
-	{ "strcmp", (uintptr_t)&sceClibStrcmp },
-	{ "strcoll", (uintptr_t)&strcoll },
-	{ "strcpy", (uintptr_t)&strcpy },
-	{ "strcspn", (uintptr_t)&strcspn },
-	{ "strerror", (uintptr_t)&strerror },
-	{ "strftime", (uintptr_t)&strftime },
-	{ "strlen", (uintptr_t)&strlen },
-	{ "strncasecmp", (uintptr_t)&sceClibStrncasecmp },
-	{ "strncat", (uintptr_t)&sceClibStrncat },
-	{ "strncmp", (uintptr_t)&sceClibStrncmp },
-	{ "strncpy", (uintptr_t)&sceClibStrncpy },
-	{ "strpbrk", (uintptr_t)&strpbrk },
-	{ "strrchr", (uintptr_t)&sceClibStrrchr },
-	{ "strdup", (uintptr_t)&strdup },
-	{ "strstr", (uintptr_t)&sceClibStrstr },
-	{ "strtod", (uintptr_t)&strtod },
-	{ "strtol", (uintptr_t)&strtol },
-	{ "strtok", (uintptr_t)&strtok },
-	{ "strtoul", (uintptr_t)&strtoul },
-	{ "strxfrm", (uintptr_t)&strxfrm },
-	{ "sysconf", (uintptr_t)&ret0 },
-	{ "tan", (uintptr_t)&tan },
-	{ "tanf", (uintptr_t)&tanf },
-	{ "tanh", (uintptr_t)&tanh },
-	{ "time", (uintptr_t)&time },
-	{ "tolower", (uintptr_t)&tolower },
-	{ "toupper", (uintptr_t)&toupper },
-	{ "towlower", (uintptr_t)&towlower },
-	{ "towupper", (uintptr_t)&towupper },
-	{ "ungetc", (uintptr_t)&ungetc },
-	{ "ulink", (uintptr_t)&ulink },
-	{ "ungetwc", (uintptr_t)&ungetwc },
-	{ "usleep", (uintptr_t)&usleep },
-	{ "vfprintf", (uintptr_t)&vfprintf },
-	{ "vprintf", (uintptr_t)&vprintf },
-	{ "vsnprintf", (uintptr_t)&vsnprintf },
-	{ "vsprintf", (uintptr_t)&vsprintf },
-	{ "vswprintf", (uintptr_t)&vswprintf },
-	{ "wcrtomb", (uintptr_t)&wcrtomb },
-	{ "wcscoll", (uintptr_t)&wcscoll },
-	{ "wcscmp", (uintptr_t)&wcscmp },
-	{ "wcsncpy", (uintptr_t)&wcsncpy },
-	{ "wcsftime", (uintptr_t)&wcsftime },
-	{ "wcslen", (uintptr_t)&wcslen },
-	{ "wcsxfrm", (uintptr_t)&wcsxfrm },
-	{ "wctob", (uintptr_t)&wctob },
-	{ "wctype", (uintptr_t)&wctype },
-	{ "wmemchr", (uintptr_t)&wmemchr },
-	{ "wmemcmp", (uintptr_t)&wmemcmp },
-	{ "wmemcpy", (uintptr_t)&wmemcpy },
-	{ "wmemmove", (uintptr_t)&wmemmove },
-	{ "wmemset", (uintptr_t)&wmemset },
-	{ "write", (uintptr_t)&write },
-	// { "writev", (uintptr_t)&writev },
+#include "default_dynlib.h"
 };
 
 int check_kubridge(void) {
@@ -883,7 +650,181 @@ void CallVoidMethodV(void *env, void *obj, int methodID, uintptr_t *args) {
 
 int GetIntField(void *env, void *obj, int fieldID) { return 0; }
 
+#if LAZY_BINDING
+static void imports_report(void) {
+	so_lazy_report(&smb2_mod, IMPORTS_REPORT_PATH);
+}
+#endif
+
+/*
+ * Boot runs as a task graph: loading and linking libsmb2.so and starting SoLoud
+ * get cores of their own, while this thread brings up vitaGL and the trophy
+ * context, the two needing the display. Imports missing from default_dynlib are
+ * looked up with vglGetProcAddress, so linking leaves them to a small task run
+ * here once both are done. Everything meets again before the constructors run.
+ * Errors found off this thread are reported once it joins, as the dialog needs
+ * vitaGL.
+ */
+static char load_error[256];
+static const char *so_path;
+static int prelinked;
+
+#if PROFILER_HZ
+static so_prof prof;
+#endif
+
+static void boot_load(void) {
+	// Map the image prelinked on a previous boot, or load libsmb2.so from scratch (gzip compressed if available)
+	so_path = file_exists(SO_GZ_PATH) ? SO_GZ_PATH : SO_PATH;
+	smb2_mod.lazy_bind = LAZY_BINDING;
+	so_boot_begin("so_image_load");
+	prelinked = so_image_load(&smb2_mod, IMAGE_PATH, so_path, DATA_PATH, default_dynlib, sizeof(default_dynlib), default_hooks, sizeof(default_hooks)) >= 0;
+	so_boot_end();
+	if (!prelinked) {
+		so_boot_begin("so_file_load");
+		if (so_file_load(&smb2_mod, so_path, LOAD_ADDRESS) < 0) {
+			snprintf(load_error, sizeof(load_error), "Error could not load %s.", so_path);
+			so_boot_end();
+			return;
+		}
+		so_boot_end();
+		smb2_mod.lazy_bind = LAZY_BINDING;
+	}
+#if LAZY_BINDING
+	atexit(imports_report);
+#endif
+	version = detect_version(&smb2_mod);
+	if (!version)
+		snprintf(load_error, sizeof(load_error), "Error this libsmb2.so is an unsupported build (sha1 %s), please use v1.0 to v1.2 of the game (before free-to-play).", game_sha1);
+}
+
+static void boot_link(void) {
+	if (load_error[0])
+		return;
+
+	so_boot_begin("so_load_needed");
+	so_load_needed(&smb2_mod, DATA_PATH, default_dynlib, sizeof(default_dynlib));
+	so_boot_end();
+
+	// Replay relocations, imports and hooks from a previous boot if libsmb2.so didn't change
+	so_boot_begin("patch");
+	so_patch_begin(&smb2_mod);
+	if (prelinked) {
+		so_image_fixup(&smb2_mod, default_dynlib, sizeof(default_dynlib), default_hooks, sizeof(default_hooks));
+	} else if (so_cache_load(&smb2_mod, CACHE_PATH, default_dynlib, sizeof(default_dynlib), default_hooks, sizeof(default_hooks)) < 0) {
+		so_cache_begin(&smb2_mod, default_dynlib, sizeof(default_dynlib), default_hooks, sizeof(default_hooks));
+		so_boot_begin("so_relocate_resolve");
+		if (so_relocate_resolve(&smb2_mod, default_dynlib, sizeof(default_dynlib), 0) < 0) {
+			snprintf(load_error, sizeof(load_error), "Error could not relocate %s.", so_path);
+			so_boot_end();
+			so_boot_end();
+			return;
+		}
+		so_boot_end();
+
+		so_boot_begin("patch_game");
+		if (patch_game()) {
+			snprintf(load_error, sizeof(load_error), "Error could not patch %s (%s).", so_path, version->name);
+			so_boot_end();
+			so_boot_end();
+			return;
+		}
+		so_boot_end();
+#if SCAN_MISALIGNED
+		so_boot_begin("so_scan_misaligned");
+		so_scan_misaligned(&smb2_mod, SCAN_MISALIGNED > 1);
+		so_boot_end();
+#endif
+		so_cache_save(&smb2_mod, CACHE_PATH);
+	}
+	so_patch_commit(&smb2_mod);
+	so_boot_end();
+	if (!prelinked) {
+		so_boot_begin("so_image_save");
+		so_image_save(&smb2_mod, IMAGE_PATH, so_path, DATA_PATH, default_dynlib, sizeof(default_dynlib), default_hooks, sizeof(default_hooks));
+		so_boot_end();
+	}
+	if (version->hooks)
+		so_hook_symbols(&smb2_mod, version->hooks, version->size_hooks);
+#ifdef ENABLE_DEBUG
+	so_arena_stats(&smb2_mod);
+#endif
+}
+
+static void boot_audio(void) {
+	audio_player_init();
+}
+
+static void boot_vgl(void) {
+	vglSetSemanticBindingMode(VGL_MODE_SHADER_PAIR);
+	vglSetupGarbageCollector(127, 0x20000);
+	vglInitExtended(0, SCREEN_W, SCREEN_H, MEMORY_VITAGL_THRESHOLD_MB * 1024 * 1024, SCE_GXM_MULTISAMPLE_4X);
+	eglSwapInterval(0, 2);
+}
+
+static void boot_trophies(void) {
+	SceIoStat st;
+	int r = trophies_init();
+	if (r < 0 && sceIoGetstat(TROPHIES_FILE, &st) < 0) {
+		FILE *f = fopen(TROPHIES_FILE, "w");
+		fclose(f);
+		warning("This game features unlockable trophies but NoTrpDrm is not installed. If you want to be able to unlock trophies, please install it.");
+	}
+}
+
+static void boot_vgl_imports(void) {
+	int num = so_resolve_vgl();
+	debugPrintf("Bound %d vitaGL imports.\n", num);
+}
+
+static void boot_initialize(void) {
+	// vitaGL is up by now, so not through fatal_error, and only one common dialog can be up at a time
+	if (load_error[0]) {
+		while (trophies_dialog_running())
+			vglSwapBuffers(GL_TRUE);
+		warning(load_error);
+		sceKernelExitProcess(0);
+	}
+
+#if FAULT_THRESHOLD
+	so_fault_init(&smb2_mod, FAULT_THRESHOLD, FAULT_REPORT_PATH);
+#endif
+
+#if PROFILER_HZ
+	// This thread runs both the initializers and the game loop
+	if (so_prof_init(&prof, &smb2_mod) == 0)
+		so_sampler_start(&prof, sceKernelGetThreadId(), 1000000 / PROFILER_HZ, PROFILER_UNWIND);
+#endif
+
+#if IMPORT_PROFILER
+	// After the image is saved, the thunks aren't part of it
+	so_calls_init(&smb2_mod, IMPORT_PROFILE_PATH);
+#endif
+#if FUNCTION_TRACING
+	so_calls_trace(&smb2_mod, TRACE_FUNCTIONS);
+#endif
+
+	so_boot_begin("so_initialize");
+	so_initialize(&smb2_mod);
+	so_boot_end();
+}
+
+// Threaded tasks start at once, the others run here in this order
+static so_boot_task boot_tasks[] = {
+	{ "load", &boot_load, SCE_KERNEL_CPU_MASK_USER_1 },
+	{ "audio_player_init", &boot_audio, SCE_KERNEL_CPU_MASK_USER_2 },
+	{ "vglInitExtended", &boot_vgl, 0 },
+	{ "trophies_init", &boot_trophies, 0, { "vglInitExtended" } },
+	{ "link", &boot_link, SCE_KERNEL_CPU_MASK_USER_1, { "load" } },
+	{ "vgl_imports", &boot_vgl_imports, 0, { "link", "vglInitExtended" } },
+	{ "initialize", &boot_initialize, 0, { "vgl_imports" } },
+};
+
 int main(int argc, char *argv[]) {
+#if BOOT_TRACE
+	so_boot_start();
+	int boot_tracing = 1;
+#endif
 	SceAppUtilInitParam init_param;
 	SceAppUtilBootParam boot_param;
 	memset(&init_param, 0, sizeof(SceAppUtilInitParam));
@@ -911,38 +852,20 @@ int main(int argc, char *argv[]) {
 	}
 	printf("use_analogs is %u\n", use_analogs);
 
+	so_boot_begin("checks");
 	if (check_kubridge() < 0)
 		fatal_error("Error kubridge.skprx is not installed.");
 
 	if (!file_exists("ur0:/data/libshacccg.suprx") && !file_exists("ur0:/data/external/libshacccg.suprx"))
 		fatal_error("Error libshacccg.suprx is not installed.");
+	so_boot_end();
 
-	if (so_file_load(&smb2_mod, SO_PATH, LOAD_ADDRESS) < 0)
-		fatal_error("Error could not load %s.", SO_PATH);
-
-	so_relocate(&smb2_mod);
-	so_resolve(&smb2_mod, default_dynlib, sizeof(default_dynlib), 0);
-
-	patch_game();
-	so_flush_caches(&smb2_mod);
-
-	so_initialize(&smb2_mod);
-	
-	audio_player_init();
-	
-	vglSetSemanticBindingMode(VGL_MODE_SHADER_PAIR);
-	vglSetupGarbageCollector(127, 0x20000);
-	vglInitExtended(0, SCREEN_W, SCREEN_H, MEMORY_VITAGL_THRESHOLD_MB * 1024 * 1024, SCE_GXM_MULTISAMPLE_4X);
-	eglSwapInterval(0, 2);
-	
-	// Initing trophy system
-	SceIoStat st;
-	int r = trophies_init();
-	if (r < 0 && sceIoGetstat(TROPHIES_FILE, &st) < 0) {
-		FILE *f = fopen(TROPHIES_FILE, "w");
-		fclose(f);
-		warning("This game features unlockable trophies but NoTrpDrm is not installed. If you want to be able to unlock trophies, please install it.");
-	}
+	so_defer_vgl(1);
+	so_boot_run(boot_tasks, sizeof(boot_tasks));
+	so_boot_report(boot_tasks, sizeof(boot_tasks));
+#if PROFILER_HZ || FUNCTION_TRACING
+	uint32_t combo_buttons = 0;
+#endif
 	
 	if (use_analogs)
 		sceCtrlSetSamplingModeExt(SCE_CTRL_MODE_ANALOG_WIDE);
@@ -983,7 +906,9 @@ int main(int argc, char *argv[]) {
 	*(uintptr_t *)(fake_env + 0x2A8) = (uintptr_t)ret0;
 	*(uintptr_t *)(fake_env + 0x36C) = (uintptr_t)GetJavaVM;
 	
+	so_boot_begin("audio_player_reinit");
 	audio_player_init();
+	so_boot_end();
 
 	int (* Java_com_ooi_android_SharkInterface_SetAssetPath)(void *env, void *obj, char *path) = (void *)so_symbol(&smb2_mod, "Java_com_ooi_android_SharkInterface_SetAssetPath");
 	int (* Java_com_ooi_android_SharkInterface_SetUserPath)(void *env, void *obj, char *path) = (void *)so_symbol(&smb2_mod, "Java_com_ooi_android_SharkInterface_SetUserPath");
@@ -994,10 +919,19 @@ int main(int argc, char *argv[]) {
 	int (* Java_com_ooi_android_SharkInterface_ScreenTouchUp)(void *env, void *obj, float x, float y, int id) = (void *)so_symbol(&smb2_mod, "Java_com_ooi_android_SharkInterface_ScreenTouchUp");
 	void (* FeedAccelData)(float x, float y, float z) = (void *)so_symbol(&smb2_mod, "_ZN2io13Accelerometer13FeedAccelDataEfff");
 	
+	so_boot_begin("nativeInit");
 	Java_com_ooi_android_SharkWrapper_nativeInit();
+	so_boot_end();
+	so_boot_begin("SetAssetPath");
 	Java_com_ooi_android_SharkInterface_SetAssetPath(fake_env, NULL, DATA_PATH "/assets/assets_android/");
+	so_boot_end();
+	so_boot_begin("SetUserPath");
 	Java_com_ooi_android_SharkInterface_SetUserPath(fake_env, NULL, DATA_PATH);
+	so_boot_end();
+	so_boot_begin("nativeOpenGLInit");
 	Java_com_ooi_android_SharkRenderer_nativeOpenGLInit(fake_env, NULL, 1);
+	so_boot_end();
+	so_boot_begin("first frame");
 	
 	
 	int lastX[SCE_TOUCH_MAX_REPORT] = {-1, -1, -1, -1, -1, -1, -1, -1};
@@ -1037,8 +971,41 @@ int main(int argc, char *argv[]) {
 			}
 		}
 
+#if FAULT_THRESHOLD
+		so_fault_poll();
+#endif
+#if PROFILER_HZ || FUNCTION_TRACING
+		SceCtrlData combo;
+		sceCtrlPeekBufferPositive(0, &combo, 1);
+#endif
+#if PROFILER_HZ
+		if ((combo.buttons & PROFILER_COMBO) == PROFILER_COMBO && (combo_buttons & PROFILER_COMBO) != PROFILER_COMBO) {
+			// Samples keep accumulating, every dump covers the whole session so far
+			so_prof_dump(&prof, PROFILER_PATH);
+			so_prof_save(&prof, PROFILER_RAW_PATH);
+			debugPrintf("Profile: %u samples, %u outside, %u dropped\n", prof.samples, prof.outside, prof.dropped);
+		}
+#endif
+#if FUNCTION_TRACING
+		if ((combo.buttons & TRACE_COMBO) == TRACE_COMBO && (combo_buttons & TRACE_COMBO) != TRACE_COMBO)
+			so_calls_trace_dump(TRACE_PATH);
+#endif
+#if PROFILER_HZ || FUNCTION_TRACING
+		combo_buttons = combo.buttons;
+#endif
+#if IMPORT_PROFILER
+		so_calls_frame();
+#endif
 		Java_com_ooi_android_SharkRenderer_nativeRender();
-		vglSwapBuffers(GL_FALSE);
+		// The trophy setup dialog may still be up during the first frames
+		vglSwapBuffers(trophies_dialog_running() ? GL_TRUE : GL_FALSE);
+#if BOOT_TRACE
+		// Boot ends once the first frame is presented
+		if (boot_tracing) {
+			so_boot_dump(BOOT_TRACE_PATH);
+			boot_tracing = 0;
+		}
+#endif
 	}
 
 	return 0;
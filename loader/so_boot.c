@@ -0,0 +1,297 @@
+/* so_boot.c -- boot timeline tracing and scheduling
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "so_util.h"
+#include "so_boot.h"
+
+/*
+ * The phases main() goes through before the first frame, with every module
+ * constructor nested under so_initialize, as spans on the thread running them.
+ * Times come from the process clock, so the gap before main() shows up too.
+ * Constructors are mostly local functions; they're recorded by address and
+ * symbolized (when their name was exported) only when the trace is written.
+ */
+
+typedef struct {
+	const char *name; // NULL for constructors
+	so_module *mod;
+	uintptr_t func;
+	uint32_t start, dur;
+	SceUID thid;
+} so_boot_event;
+
+typedef struct {
+	SceUID thid;
+	const char *name;
+} so_boot_thread;
+
+static so_boot_event boot_events[BOOT_MAX_EVENTS];
+static int boot_num;
+static int boot_enabled;
+static so_boot_thread boot_threads[BOOT_MAX_TASKS + 1];
+static int boot_num_threads;
+
+static __thread int boot_stack[BOOT_MAX_DEPTH];
+static __thread int boot_depth;
+
+static void so_boot_push(const char *name, so_module *mod, uintptr_t func) {
+	// Spans past the limits still balance their end, they're just not recorded
+	int idx = __atomic_fetch_add(&boot_num, 1, __ATOMIC_RELAXED);
+	if (idx < BOOT_MAX_EVENTS) {
+		so_boot_event *e = &boot_events[idx];
+		e->name = name;
+		e->mod = mod;
+		e->func = func;
+		e->dur = 0;
+		e->thid = sceKernelGetThreadId();
+		e->start = sceKernelGetProcessTimeLow();
+	} else {
+		idx = -1;
+	}
+	if (boot_depth < BOOT_MAX_DEPTH)
+		boot_stack[boot_depth] = idx;
+	boot_depth++;
+}
+
+static void so_boot_pop(void) {
+	if (boot_depth == 0)
+		return;
+	boot_depth--;
+	if (boot_depth < BOOT_MAX_DEPTH && boot_stack[boot_depth] >= 0) {
+		so_boot_event *e = &boot_events[boot_stack[boot_depth]];
+		e->dur = sceKernelGetProcessTimeLow() - e->start;
+	}
+}
+
+static void so_boot_name_thread(SceUID thid, const char *name) {
+	if (boot_num_threads < BOOT_MAX_TASKS + 1) {
+		boot_threads[boot_num_threads].thid = thid;
+		boot_threads[boot_num_threads].name = name;
+		boot_num_threads++;
+	}
+}
+
+static void so_boot_init_observer(so_module *mod, uintptr_t func, int done) {
+	if (!boot_enabled)
+		return;
+	if (done)
+		so_boot_pop();
+	else
+		so_boot_push(NULL, mod, func);
+}
+
+void so_boot_start(void) {
+	boot_num = boot_num_threads = 0;
+	so_boot_name_thread(sceKernelGetThreadId(), "boot");
+	boot_enabled = 1;
+	so_set_init_observer(so_boot_init_observer);
+}
+
+void so_boot_begin(const char *name) {
+	if (boot_enabled)
+		so_boot_push(name, NULL, 0);
+}
+
+void so_boot_end(void) {
+	if (boot_enabled)
+		so_boot_pop();
+}
+
+int so_boot_dump(const char *path) {
+	if (!boot_enabled)
+		return -1;
+
+	while (boot_depth)
+		so_boot_pop();
+	boot_enabled = 0;
+	so_set_init_observer(NULL);
+
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return -1;
+
+	int num = boot_num < BOOT_MAX_EVENTS ? boot_num : BOOT_MAX_EVENTS;
+	fprintf(f, "{\"traceEvents\":[");
+	for (int i = 0; i < boot_num_threads; i++)
+		fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", i ? "," : "", boot_threads[i].thid, boot_threads[i].name);
+	for (int i = 0; i < num; i++) {
+		so_boot_event *e = &boot_events[i];
+		if (e->name) {
+			fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"ts\":%u,\"dur\":%u,\"pid\":0,\"tid\":%d}", e->name, e->start, e->dur, e->thid);
+			continue;
+		}
+
+		uintptr_t offset = 0;
+		const char *sym = so_addr2sym(e->mod, e->func & ~1, &offset);
+		fprintf(f, ",\n{\"name\":\"");
+		if (sym && !offset)
+			fprintf(f, "%s", sym);
+		else
+			fprintf(f, "%s+0x%x", e->mod->soname ? e->mod->soname : "module", e->func - e->mod->text_base);
+		fprintf(f, "\",\"cat\":\"ctor\",\"ph\":\"X\",\"ts\":%u,\"dur\":%u,\"pid\":0,\"tid\":%d,\"args\":{\"addr\":\"0x%08X\"}}", e->start, e->dur, e->thid, e->func);
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+
+	if (boot_num > BOOT_MAX_EVENTS)
+		printf("boot trace: %d events dropped.\n", boot_num - BOOT_MAX_EVENTS);
+	return num;
+}
+
+/*
+ * Boot tasks: the ones with a core of their own start right away on a thread
+ * there, the rest run in table order on the calling thread. Each waits for its
+ * dependencies on one event flag, a bit per task. A task's gate is whichever of
+ * them (or of the tasks before it on the same thread) finished last, so following
+ * gates back from the last task to finish gives the critical path.
+ */
+
+typedef struct {
+	so_boot_task *task;
+	int index;
+	uint32_t deps;
+	int prev; // previous task on the calling thread, -1 for the first one and for threaded tasks
+} so_boot_job;
+
+static so_boot_task *boot_tasks;
+static SceUID boot_evf;
+
+static void so_boot_exec(so_boot_job *job) {
+	so_boot_task *t = job->task;
+	if (job->deps)
+		sceKernelWaitEventFlag(boot_evf, job->deps, SCE_EVENT_WAITAND, NULL, NULL);
+
+	t->gate = job->prev;
+	for (int i = 0; i < BOOT_MAX_TASKS; i++) {
+		if ((job->deps & (1 << i)) && (t->gate < 0 || boot_tasks[i].end > boot_tasks[t->gate].end))
+			t->gate = i;
+	}
+
+	t->start = sceKernelGetProcessTimeLow();
+	so_boot_begin(t->name);
+	t->func();
+	so_boot_end();
+	t->end = sceKernelGetProcessTimeLow();
+	sceKernelSetEventFlag(boot_evf, 1 << job->index);
+}
+
+static int so_boot_thread_entry(SceSize args, void *argp) {
+	so_boot_exec(*(so_boot_job **)argp);
+	return 0;
+}
+
+int so_boot_run(so_boot_task *tasks, int size_tasks) {
+	int num = size_tasks / sizeof(so_boot_task);
+	so_boot_job jobs[BOOT_MAX_TASKS];
+	SceUID thids[BOOT_MAX_TASKS];
+
+	if (num > BOOT_MAX_TASKS) {
+		printf("Too many boot tasks: %d\n", num);
+		return -1;
+	}
+
+	boot_tasks = tasks;
+	boot_evf = sceKernelCreateEventFlag("so_boot", SCE_EVENT_WAITMULTIPLE, 0, NULL);
+	if (boot_evf < 0)
+		return boot_evf;
+
+	int prev = -1;
+	for (int i = 0; i < num; i++) {
+		so_boot_job *job = &jobs[i];
+		job->task = &tasks[i];
+		job->index = i;
+		job->deps = 0;
+		job->prev = tasks[i].cpu ? -1 : prev;
+		if (!tasks[i].cpu)
+			prev = i;
+
+		for (int j = 0; j < BOOT_MAX_DEPS && tasks[i].deps[j]; j++) {
+			int k;
+			for (k = 0; k < num; k++) {
+				if (strcmp(tasks[k].name, tasks[i].deps[j]) == 0)
+					break;
+			}
+			if (k == num) {
+				printf("Unknown boot task dependency: %s needs %s\n", tasks[i].name, tasks[i].deps[j]);
+				continue;
+			}
+			if (!tasks[i].cpu && !tasks[k].cpu && k >= i) {
+				// It would wait forever on the thread that has yet to run it
+				printf("Boot task %s must come after %s\n", tasks[i].name, tasks[k].name);
+				continue;
+			}
+			job->deps |= 1 << k;
+		}
+	}
+
+	for (int i = 0; i < num; i++) {
+		thids[i] = -1;
+		if (!tasks[i].cpu)
+			continue;
+
+		so_boot_job *job = &jobs[i];
+		thids[i] = sceKernelCreateThread(tasks[i].name, &so_boot_thread_entry, 0x10000100, BOOT_STACK_SIZE, 0, tasks[i].cpu, NULL);
+		if (thids[i] < 0) {
+			// Nothing is waiting on it yet, it can just as well run on this thread
+			printf("Failed to create boot thread %s: 0x%08X\n", tasks[i].name, thids[i]);
+			continue;
+		}
+		so_boot_name_thread(thids[i], tasks[i].name);
+		sceKernelStartThread(thids[i], sizeof(job), &job);
+	}
+
+	for (int i = 0; i < num; i++) {
+		if (thids[i] < 0)
+			so_boot_exec(&jobs[i]);
+	}
+
+	for (int i = 0; i < num; i++) {
+		if (thids[i] >= 0) {
+			sceKernelWaitThreadEnd(thids[i], NULL, NULL);
+			sceKernelDeleteThread(thids[i]);
+		}
+	}
+	sceKernelDeleteEventFlag(boot_evf);
+	return 0;
+}
+
+void so_boot_report(so_boot_task *tasks, int size_tasks) {
+	int num = size_tasks / sizeof(so_boot_task);
+	if (!num)
+		return;
+
+	uint32_t first = tasks[0].start;
+	int last = 0;
+	uint32_t busy = 0;
+	for (int i = 0; i < num; i++) {
+		if ((int32_t)(tasks[i].start - first) < 0)
+			first = tasks[i].start;
+		if ((int32_t)(tasks[i].end - tasks[last].end) > 0)
+			last = i;
+		busy += tasks[i].end - tasks[i].start;
+	}
+
+	printf("boot tasks:\n");
+	for (int i = 0; i < num; i++)
+		printf("  %-20s %8u - %8u us (%u us)\n", tasks[i].name, tasks[i].start - first, tasks[i].end - first, tasks[i].end - tasks[i].start);
+
+	// Walked backwards from the last task to finish, printed in order
+	int path[BOOT_MAX_TASKS], depth = 0;
+	uint32_t serial = 0;
+	for (int i = last; i >= 0 && depth < BOOT_MAX_TASKS; i = tasks[i].gate) {
+		path[depth++] = i;
+		serial += tasks[i].end - tasks[i].start;
+	}
+	printf("critical path:");
+	while (depth--)
+		printf(" %s%s", tasks[path[depth]].name, depth ? " >" : "");
+	printf("\n%u us total, %u us on the critical path, %u us of work\n", tasks[last].end - first, serial, busy);
+}
@@ -0,0 +1,35 @@
+#ifndef __SO_BOOT_H__
+#define __SO_BOOT_H__
+
+#include "so_util.h"
+
+#define BOOT_MAX_EVENTS 2048 // phases and constructors, the rest is dropped
+#define BOOT_MAX_DEPTH 16 // nested phases per thread
+#define BOOT_MAX_TASKS 32
+#define BOOT_MAX_DEPS 4
+#define BOOT_STACK_SIZE 0x40000 // same as the main thread
+
+typedef struct {
+  const char *name;
+  void (*func)(void);
+  int cpu; // SCE_KERNEL_CPU_MASK_USER_* for a thread of its own, 0 to run on the calling thread in table order
+  const char *deps[BOOT_MAX_DEPS]; // tasks that must be done first, by name
+  // Filled in by so_boot_run
+  uint32_t start, end;
+  int gate; // task that finished last among the ones this one waited for, -1 if none
+} so_boot_task;
+
+// Starts recording, including every constructor so_initialize runs
+void so_boot_start(void);
+// Nested phases of the calling thread, no-ops unless recording
+void so_boot_begin(const char *name);
+void so_boot_end(void);
+// Closes the caller's open phases, stops recording and writes a Chrome trace-event JSON
+int so_boot_dump(const char *path);
+
+// Runs tasks as a dependency graph, returns once all of them are done
+int so_boot_run(so_boot_task *tasks, int size_tasks);
+// Per task times and the chain of tasks that decided when the last one finished
+void so_boot_report(so_boot_task *tasks, int size_tasks);
+
+#endif
@@ -0,0 +1,406 @@
+/* so_calls.c -- per-import call counting through GOT thunks
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "so_util.h"
+#include "so_calls.h"
+
+/*
+ * Every resolved JUMP_SLOT gets a 16 byte ARM thunk in the patch arena that loads
+ * its so_call_stat into r12 and enters so_calls_entry. The entry counts the call,
+ * pushes the return address on a per-thread shadow stack and calls the real import
+ * with lr on so_calls_exit, so stack arguments are left untouched. The exit adds
+ * the elapsed time and returns to the caller. Frames abandoned by longjmp or an
+ * exception get dropped by comparing the sp each call was made with. Calls nested
+ * deeper than CALLS_MAX_DEPTH keep their own lr and go straight to the target,
+ * only counted in calls_untracked.
+ *
+ * Traced functions of the module itself go through the same thunks, entered from
+ * a hook on the function and continuing into the hook trampoline. Their calls are
+ * also written as complete events to a ring owned by the calling thread, which
+ * only that thread writes to; so_calls_trace_dump pauses recording to read them.
+ * An exception can't unwind through a traced function, its return address is
+ * so_calls_exit.
+ */
+
+#define CALLS_REPORT_FRAMES 600
+
+typedef struct {
+	so_call_stat *stat;
+	uintptr_t lr, sp;
+	uint32_t start;
+} so_call_frame;
+
+typedef struct {
+	so_call_stat *stat;
+	uint32_t start, dur;
+} so_trace_event;
+
+typedef struct so_trace_ring {
+	struct so_trace_ring *next;
+	SceUID thid;
+	uint32_t head;
+	so_trace_event events[TRACE_RING_SZ];
+} so_trace_ring;
+
+// Never return normally, return twice or unwind through their caller
+static const char *calls_skip[] = {
+	"__cxa_throw", "__cxa_rethrow", "__cxa_end_cleanup", "__aeabi_read_tp",
+	"setjmp", "_setjmp", "sigsetjmp", "longjmp", "_longjmp", "siglongjmp",
+	"exit", "_exit", "abort", "pthread_exit", "__stack_chk_fail", "vfork",
+};
+
+static so_call_stat **calls_list = NULL;
+static int calls_num, calls_cap, calls_frames;
+static uint32_t calls_untracked;
+static const char *calls_report_path;
+static so_trace_ring *trace_rings = NULL;
+static int trace_enabled;
+
+static __thread so_call_frame calls_stack[CALLS_MAX_DEPTH];
+static __thread int calls_depth;
+static __thread so_trace_ring *trace_ring;
+
+void plt0_stub();
+void so_lazy_stub();
+void so_calls_exit(void);
+
+// Returns the function to enter in r0 and the lr to enter it with in r1
+uint64_t so_calls_enter(so_call_stat *s, uintptr_t lr, uintptr_t sp) {
+	// Anything deeper than this call is gone
+	while (calls_depth && calls_stack[calls_depth - 1].sp < sp)
+		calls_depth--;
+	if (calls_depth == CALLS_MAX_DEPTH) {
+		__atomic_add_fetch(&calls_untracked, 1, __ATOMIC_RELAXED);
+		return ((uint64_t)lr << 32) | s->func;
+	}
+
+	so_call_frame *f = &calls_stack[calls_depth++];
+	f->stat = s;
+	f->lr = lr;
+	f->sp = sp;
+	__atomic_add_fetch(&s->calls, 1, __ATOMIC_RELAXED);
+	f->start = sceKernelGetProcessTimeLow();
+	return ((uint64_t)(uintptr_t)&so_calls_exit << 32) | s->func;
+}
+
+static void so_trace_record(so_call_stat *s, uint32_t start, uint32_t dur) {
+	so_trace_ring *r = trace_ring;
+	if (!r) {
+		r = calloc(1, sizeof(so_trace_ring));
+		if (!r)
+			return;
+		r->thid = sceKernelGetThreadId();
+		r->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&trace_rings, &r->next, r, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+		trace_ring = r;
+	}
+
+	so_trace_event *e = &r->events[r->head & (TRACE_RING_SZ - 1)];
+	e->stat = s;
+	e->start = start;
+	e->dur = dur;
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+uintptr_t so_calls_leave(uintptr_t sp) {
+	uint32_t now = sceKernelGetProcessTimeLow();
+	// Only calls with a frame return here, and theirs was made with this same sp
+	while (calls_depth > 1 && calls_stack[calls_depth - 1].sp < sp)
+		calls_depth--;
+
+	so_call_frame *f = &calls_stack[--calls_depth];
+	__atomic_add_fetch(&f->stat->time, now - f->start, __ATOMIC_RELAXED);
+	if (f->stat->trace && __atomic_load_n(&trace_enabled, __ATOMIC_ACQUIRE))
+		so_trace_record(f->stat, f->start, now - f->start);
+	return f->lr;
+}
+
+__attribute__((naked)) void so_calls_entry(void)
+{
+	asm volatile(
+		"push {r0-r3}\n"
+		"mov r0, r12\n"
+		"mov r1, lr\n"
+		"add r2, sp, #16\n"
+		"bl so_calls_enter\n"
+		"mov r12, r0\n"
+		"mov lr, r1\n"
+		"pop {r0-r3}\n"
+		"bx r12\n"
+	);
+}
+
+__attribute__((naked)) void so_calls_exit(void)
+{
+	asm volatile(
+		"push {r0-r3}\n" // r0-r3 all carry results for the __aeabi_*divmod helpers
+		"add r0, sp, #16\n"
+		"bl so_calls_leave\n"
+		"mov lr, r0\n"
+		"pop {r0-r3}\n"
+		"bx lr\n"
+	);
+}
+
+static int so_calls_skipped(const char *symbol) {
+	for (int i = 0; i < sizeof(calls_skip) / sizeof(*calls_skip); i++) {
+		if (strcmp(calls_skip[i], symbol) == 0)
+			return 1;
+	}
+	return strncmp(symbol, "_Unwind_", 8) == 0 || strncmp(symbol, "__gnu_Unwind_", 13) == 0;
+}
+
+static void so_calls_atexit(void) {
+	so_calls_report(calls_report_path);
+}
+
+// Writes a thunk per stat to the patch arena and starts tracking them, returns the first thunk
+static uintptr_t so_calls_thunks(so_module *mod, so_call_stat *stats, int num) {
+	uint32_t *thunks = malloc(num * 16);
+	uintptr_t base = so_alloc_arena(mod, (uintptr_t)NULL, (uintptr_t)NULL, num * 16);
+	if (!base || !thunks) {
+		free(thunks);
+		return 0;
+	}
+
+	for (int i = 0; i < num; i++) {
+		thunks[i * 4 + 0] = 0xE59FC000; // LDR R12, [PC, #0]
+		thunks[i * 4 + 1] = 0xE59FF000; // LDR PC, [PC, #0]
+		thunks[i * 4 + 2] = (uintptr_t)&stats[i];
+		thunks[i * 4 + 3] = (uintptr_t)&so_calls_entry;
+	}
+	so_memcpy_rx((void *)base, thunks, num * 16);
+	so_flush_rx((void *)base, num * 16);
+	free(thunks);
+
+	if (calls_num + num > calls_cap) {
+		while (calls_num + num > calls_cap)
+			calls_cap = calls_cap ? calls_cap * 2 : 256;
+		calls_list = realloc(calls_list, calls_cap * sizeof(so_call_stat *));
+	}
+	for (int i = 0; i < num; i++)
+		calls_list[calls_num++] = &stats[i];
+	return base;
+}
+
+int so_calls_init(so_module *mod, const char *report_path) {
+	so_call_stat *stats = calloc(mod->num_relplt, sizeof(so_call_stat));
+	uintptr_t **slots = malloc(mod->num_relplt * sizeof(uintptr_t *));
+	int num = 0, lazy = 0;
+
+	calls_report_path = report_path;
+	for (int i = 0; i < mod->num_relplt; i++) {
+		Elf32_Rel *rel = &mod->relplt[i];
+		Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
+		uintptr_t *slot = (uintptr_t *)(mod->text_base + rel->r_offset);
+		const char *symbol = mod->dynstr + sym->st_name;
+		if (ELF32_R_TYPE(rel->r_info) != R_ARM_JUMP_SLOT || sym->st_shndx != SHN_UNDEF || so_calls_skipped(symbol))
+			continue;
+		// Lazy slots want the GOT address in r12, leave them be
+		if (*slot == (uintptr_t)&so_lazy_stub || *slot == (uintptr_t)&plt0_stub) {
+			lazy += *slot == (uintptr_t)&so_lazy_stub;
+			continue;
+		}
+
+		stats[num].name = symbol;
+		stats[num].func = *slot;
+		slots[num++] = slot;
+	}
+	if (lazy)
+		printf("import profiler: %d imports left on lazy binding.\n", lazy);
+
+	uintptr_t base = so_calls_thunks(mod, stats, num);
+	if (!base) {
+		printf("import profiler: unable to allocate %d thunks.\n", num);
+		free(slots);
+		free(stats);
+		return -1;
+	}
+
+	// The thunks are live, switch the GOT over
+	for (int i = 0; i < num; i++)
+		*slots[i] = base + i * 16;
+	free(slots);
+
+	printf("import profiler: %d imports instrumented.\n", num);
+	if (report_path)
+		atexit(so_calls_atexit);
+	return 0;
+}
+
+// Glob over the first len characters of pattern
+static int so_calls_match(const char *pattern, size_t len, const char *name) {
+	if (!len)
+		return !*name;
+	if (*pattern == '*')
+		return so_calls_match(pattern + 1, len - 1, name) || (*name && so_calls_match(pattern, len, name + 1));
+	if (*name && (*pattern == '?' || *pattern == *name))
+		return so_calls_match(pattern + 1, len - 1, name + 1);
+	return 0;
+}
+
+static int so_calls_matches(const char *patterns, const char *name) {
+	while (*patterns) {
+		const char *end = strchr(patterns, ',');
+		size_t len = end ? end - patterns : strlen(patterns);
+		if (len && so_calls_match(patterns, len, name))
+			return 1;
+		patterns += end ? len + 1 : len;
+	}
+	return 0;
+}
+
+static int so_calls_cmp_sym(const void *a, const void *b) {
+	const Elf32_Sym *sa = *(const Elf32_Sym **)a, *sb = *(const Elf32_Sym **)b;
+	return sa->st_value < sb->st_value ? -1 : sa->st_value > sb->st_value;
+}
+
+int so_calls_trace(so_module *mod, const char *patterns) {
+	Elf32_Sym **syms = malloc(mod->num_dynsym * sizeof(Elf32_Sym *));
+	int num = 0, hooked = 0;
+
+	for (int i = 1; i < mod->num_dynsym; i++) {
+		Elf32_Sym *sym = &mod->dynsym[i];
+		if (sym->st_shndx == SHN_UNDEF || ELF32_ST_TYPE(sym->st_info) != STT_FUNC || !sym->st_value)
+			continue;
+		// The hook overwrites 8 bytes, 10 for Thumb functions that aren't word aligned
+		if (sym->st_size < ((sym->st_value & 3) == 3 ? 10 : 8) || !so_calls_matches(patterns, mod->dynstr + sym->st_name))
+			continue;
+		syms[num++] = sym;
+	}
+
+	// Aliases share one hook
+	qsort(syms, num, sizeof(Elf32_Sym *), so_calls_cmp_sym);
+	int unique = 0;
+	for (int i = 0; i < num; i++) {
+		if (!unique || syms[i]->st_value != syms[unique - 1]->st_value)
+			syms[unique++] = syms[i];
+	}
+	num = unique;
+
+	so_call_stat *stats = calloc(num, sizeof(so_call_stat));
+	uintptr_t base = so_calls_thunks(mod, stats, num);
+	if (!base) {
+		printf("function tracing: unable to allocate %d thunks.\n", num);
+		free(syms);
+		free(stats);
+		return -1;
+	}
+
+	// Nothing runs module code yet, so the thunk can learn its trampoline after the hook is in
+	for (int i = 0; i < num; i++) {
+		so_hook h = hook_addr(mod->text_base + syms[i]->st_value, base + i * 16);
+		if (!h.trampoline) {
+			// Prologue can't be relocated, stays untraced
+			unhook(&h);
+			continue;
+		}
+		stats[i].name = mod->dynstr + syms[i]->st_name;
+		stats[i].func = h.trampoline;
+		stats[i].trace = 1;
+		hooked++;
+	}
+	free(syms);
+
+	printf("function tracing: %d/%d functions hooked.\n", hooked, num);
+	__atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+	return hooked;
+}
+
+int so_calls_trace_dump(const char *path) {
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return -1;
+
+	// Calls returning while the rings are read are lost, the ones already being written get time to land
+	__atomic_store_n(&trace_enabled, 0, __ATOMIC_RELEASE);
+	sceKernelDelayThread(1000);
+
+	int n = 0;
+	fprintf(f, "{\"traceEvents\":[");
+	for (so_trace_ring *r = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+		SceKernelThreadInfo info;
+		info.size = sizeof(info);
+		if (sceKernelGetThreadInfo(r->thid, &info) >= 0)
+			fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", n++ ? "," : "", r->thid, info.name);
+
+		uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		for (uint32_t i = head > TRACE_RING_SZ ? head - TRACE_RING_SZ : 0; i != head; i++) {
+			so_trace_event *e = &r->events[i & (TRACE_RING_SZ - 1)];
+			fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%u,\"dur\":%u,\"pid\":0,\"tid\":%d}", n++ ? "," : "", e->stat->name, e->start, e->dur, r->thid);
+		}
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+
+	__atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+	return n;
+}
+
+void so_calls_frame(void) {
+	if (!calls_num)
+		return;
+
+	for (int i = 0; i < calls_num; i++) {
+		so_call_stat *s = calls_list[i];
+		uint32_t calls = __atomic_load_n(&s->calls, __ATOMIC_RELAXED);
+		uint32_t time = __atomic_load_n(&s->time, __ATOMIC_RELAXED);
+		s->frame_calls = calls - s->snap_calls;
+		s->frame_time = time - s->snap_time;
+		s->snap_calls = calls;
+		s->snap_time = time;
+		if (s->frame_calls > s->max_calls)
+			s->max_calls = s->frame_calls;
+		if (s->frame_time > s->max_time)
+			s->max_time = s->frame_time;
+	}
+
+	// Keep the report current, the app is usually killed rather than exited
+	if (++calls_frames % CALLS_REPORT_FRAMES == 0)
+		so_calls_report(calls_report_path);
+}
+
+static int so_calls_cmp_time(const void *a, const void *b) {
+	const so_call_stat *sa = *(const so_call_stat **)a, *sb = *(const so_call_stat **)b;
+	return sa->time < sb->time ? 1 : sa->time > sb->time ? -1 : 0;
+}
+
+int so_calls_report(const char *path) {
+	if (!calls_num || !path)
+		return -1;
+
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return -1;
+
+	so_call_stat **sorted = malloc(calls_num * sizeof(so_call_stat *));
+	memcpy(sorted, calls_list, calls_num * sizeof(so_call_stat *));
+	qsort(sorted, calls_num, sizeof(so_call_stat *), so_calls_cmp_time);
+
+	int frames = calls_frames ? calls_frames : 1;
+	fprintf(f, "# %d frames; session: calls, us, us/call, calls/frame; worst frame: calls, us; last frame: calls, us\n", calls_frames);
+	uint32_t untracked = __atomic_load_n(&calls_untracked, __ATOMIC_RELAXED);
+	if (untracked)
+		fprintf(f, "# %u calls nested deeper than %d not counted\n", untracked, CALLS_MAX_DEPTH);
+	for (int i = 0; i < calls_num; i++) {
+		so_call_stat *s = sorted[i];
+		if (!s->calls)
+			continue;
+		fprintf(f, "%-32s %10u %10u %8.2f %8.1f  %8u %8u  %8u %8u\n", s->name, s->calls, s->time,
+			(float)s->time / s->calls, (float)s->calls / frames, s->max_calls, s->max_time, s->frame_calls, s->frame_time);
+	}
+
+	free(sorted);
+	fclose(f);
+	return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef __SO_CALLS_H__
+#define __SO_CALLS_H__
+
+#include "so_util.h"
+
+#define CALLS_MAX_DEPTH 64 // nested instrumented calls per thread (imports calling back into the module)
+#define TRACE_RING_SZ 0x10000 // events kept per thread, power of two
+
+typedef struct {
+  const char *name;
+  uintptr_t func; // real target
+  uint32_t calls, time; // session totals, time in microseconds and inclusive of callbacks
+  uint32_t frame_calls, frame_time; // last frame
+  uint32_t max_calls, max_time; // worst frame
+  uint32_t snap_calls, snap_time;
+  int trace; // record every call in the thread's trace ring
+} so_call_stat;
+
+// Points every resolved JUMP_SLOT import at a counting thunk, after the module is fully linked
+int so_calls_init(so_module *mod, const char *report_path);
+void so_calls_frame(void);
+int so_calls_report(const char *path);
+
+// Hooks the exported functions matching patterns (comma separated, * and ? wildcards) through the same thunks
+int so_calls_trace(so_module *mod, const char *patterns);
+// Chrome trace-event JSON with the last TRACE_RING_SZ calls of every thread
+int so_calls_trace_dump(const char *path);
+
+#endif
@@ -0,0 +1,382 @@
+/* so_fault.c -- adaptive fixing of unaligned-access aborts
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <kubridge.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "dialog.h"
+#include "so_util.h"
+#include "so_scan.h"
+#include "so_fault.h"
+
+/*
+ * The abort handler runs on the faulting thread: alignment faults coming from the
+ * module get the LDM/LDRD emulated in place and are counted per PC. Once a site
+ * reaches the threshold it's flagged, and so_fault_poll (main thread, once per
+ * frame) rewrites it through the same fixes the static scanner uses, so it stops
+ * trapping. Nothing in the handler allocates, locks or prints.
+ *
+ * Other threads may be running the site while it gets patched, so at runtime only
+ * fixes that are a single aligned store are applied. The rest stay emulated and
+ * are written to the report as deferred, so_fault_init patches those on the next
+ * boot before any module code runs.
+ */
+
+#define FAULT_STATUS_ALIGNMENT 0x001 // DFSR.FS, short-descriptor format
+#define FAULT_IT_MASK 0x0600FC00
+#define FAULT_T_BIT 0x20
+
+enum {
+	FAULT_EMULATED, // counted, below the threshold
+	FAULT_QUEUED, // waiting for so_fault_poll
+	FAULT_PATCHED,
+	FAULT_UNFIXABLE, // keeps being emulated
+	FAULT_DEFERRED, // emulated until the next boot patches it
+};
+
+typedef struct {
+	uintptr_t pc; // 0 if the slot is free
+	uint32_t count;
+	uint8_t thumb;
+	uint8_t in_it;
+	uint8_t state;
+	int8_t kind; // SCAN_* once decoded by so_fault_poll, -1 if not a scanner pattern
+	uint8_t fixable;
+} so_fault_site;
+
+typedef struct __attribute__((__packed__)) {
+	uint32_t v;
+} unaligned_u32;
+
+static so_fault_site fault_sites[FAULT_MAX_SITES];
+static so_module *fault_mod = NULL;
+static uint32_t fault_threshold;
+static int fault_pending, fault_dropped;
+static const char *fault_report_path;
+static KuKernelAbortHandler fault_prev_handler = NULL;
+
+static so_fault_site *so_fault_site_get(uintptr_t pc) {
+	uint32_t slot = ((pc >> 1) * 2654435761u) & (FAULT_MAX_SITES - 1);
+	for (int i = 0; i < FAULT_MAX_SITES; i++) {
+		so_fault_site *site = &fault_sites[(slot + i) & (FAULT_MAX_SITES - 1)];
+		uintptr_t expected = 0;
+		if (site->pc == pc)
+			return site;
+		if (!site->pc && __atomic_compare_exchange_n(&site->pc, &expected, pc, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return site;
+		if (expected == pc)
+			return site;
+	}
+	return NULL;
+}
+
+static void so_fault_ldm(uint32_t *regs, int rn, uint32_t list, uint32_t start, int wback, uint32_t new_base) {
+	// Read everything first, the base register may be in the list
+	uint32_t vals[16];
+	for (int i = 0, n = 0; i < 16; i++) {
+		if (list & (1 << i))
+			vals[i] = ((unaligned_u32 *)(start + 4 * n++))->v;
+	}
+	if (wback)
+		regs[rn] = new_base;
+	for (int i = 0; i < 15; i++) {
+		if (list & (1 << i))
+			regs[i] = vals[i];
+	}
+}
+
+static void so_fault_ldrd(uint32_t *regs, int rt, int rt2, uint32_t addr) {
+	uint32_t lo = ((unaligned_u32 *)addr)->v;
+	uint32_t hi = ((unaligned_u32 *)(addr + 4))->v;
+	regs[rt] = lo;
+	regs[rt2] = hi;
+}
+
+// Returns the size of the emulated instruction, 0 if it isn't one we handle
+static int so_fault_emulate_arm(uint32_t *regs, uint32_t instr) {
+	int rn = (instr >> 16) & 0xF;
+	int up = (instr >> 23) & 1, pre = (instr >> 24) & 1, wback = (instr >> 21) & 1;
+
+	if ((instr >> 28) == 0xF)
+		return 0;
+
+	if ((instr & 0x0E500000) == 0x08100000) {
+		// LDM{IA,IB,DA,DB} Rn{!}, {...} without PC
+		uint32_t list = instr & 0xFFFF;
+		uint32_t n = __builtin_popcount(list);
+		uint32_t base = regs[rn];
+		if (list & 0x8000)
+			return 0;
+		uint32_t start = up ? base + (pre ? 4 : 0) : base - 4 * n + (pre ? 0 : 4);
+		so_fault_ldm(regs, rn, list, start, wback && !(list & (1 << rn)), up ? base + 4 * n : base - 4 * n);
+		return 4;
+	}
+
+	if ((instr & 0x0E1000F0) == 0x000000D0 && (pre || !wback)) {
+		// LDRD Rt, Rt+1, [Rn, #imm/Rm]{!} / [Rn], #imm/Rm
+		int rt = (instr >> 12) & 0xF;
+		uint32_t offs = (instr & 0x00400000) ? ((instr >> 4) & 0xF0) | (instr & 0xF) : regs[instr & 0xF];
+		uint32_t base = regs[rn];
+		uint32_t addr = up ? base + offs : base - offs;
+		if ((rt & 1) || rt == 14)
+			return 0;
+		so_fault_ldrd(regs, rt, rt + 1, pre ? addr : base);
+		if (!pre || wback)
+			regs[rn] = addr;
+		return 4;
+	}
+
+	return 0;
+}
+
+static int so_fault_emulate_thumb(uint32_t *regs, uint16_t hw1, uint16_t hw2) {
+	int rn = hw1 & 0xF;
+
+	if ((hw1 & 0xF800) == 0xC800) {
+		// LDMIA Rn!, {...} (16-bit, no writeback if Rn is in the list)
+		rn = (hw1 >> 8) & 7;
+		uint32_t list = hw1 & 0xFF;
+		uint32_t base = regs[rn];
+		so_fault_ldm(regs, rn, list, base, !(list & (1 << rn)), base + 4 * __builtin_popcount(list));
+		return 2;
+	}
+
+	if ((hw1 & 0xFFD0) == 0xE890 || (hw1 & 0xFFD0) == 0xE910) {
+		// LDM.W / LDMDB Rn{!}, {...} without PC
+		uint32_t list = hw2;
+		uint32_t n = __builtin_popcount(list);
+		uint32_t base = regs[rn];
+		int up = (hw1 & 0xFF80) == 0xE880;
+		if (list & 0x8000)
+			return 0;
+		so_fault_ldm(regs, rn, list, up ? base : base - 4 * n, (hw1 & 0x20) && !(list & (1 << rn)), up ? base + 4 * n : base - 4 * n);
+		return 4;
+	}
+
+	if ((hw1 & 0xFE50) == 0xE850 && (hw1 & 0x0120)) {
+		// LDRD Rt, Rt2, [Rn, #imm]{!} / [Rn], #imm
+		int pre = (hw1 >> 8) & 1, wback = (hw1 >> 5) & 1;
+		uint32_t offs = (hw2 & 0xFF) * 4;
+		uint32_t base = regs[rn];
+		uint32_t addr = (hw1 & 0x80) ? base + offs : base - offs;
+		so_fault_ldrd(regs, hw2 >> 12, (hw2 >> 8) & 0xF, pre ? addr : base);
+		if (wback)
+			regs[rn] = addr;
+		return 4;
+	}
+
+	return 0;
+}
+
+static void so_fault_advance_it(KuKernelAbortContext *ctx) {
+	uint32_t it = ((ctx->SPSR >> 8) & 0xFC) | ((ctx->SPSR >> 25) & 3);
+	if (!it)
+		return;
+	it = (it & 7) ? (it & 0xE0) | ((it << 1) & 0x1F) : 0;
+	ctx->SPSR = (ctx->SPSR & ~FAULT_IT_MASK) | ((it & 0xFC) << 8) | ((it & 3) << 25);
+}
+
+static void so_fault_unhandled(uintptr_t pc, uintptr_t far) {
+	uintptr_t offset;
+	const char *sym = fault_mod ? so_addr2sym(fault_mod, pc, &offset) : NULL;
+	if (sym)
+		fatal_error("Unhandled abort at 0x%08X (%s+0x%X) accessing 0x%08X.", pc, sym, offset, far);
+	fatal_error("Unhandled abort at 0x%08X accessing 0x%08X.", pc, far);
+}
+
+static void so_fault_handler(KuKernelAbortContext *ctx) {
+	uintptr_t pc = ctx->pc;
+	int thumb = (ctx->SPSR & FAULT_T_BIT) != 0;
+	int size = 0;
+
+	if (ctx->abortType == KU_KERNEL_ABORT_TYPE_DATA_ABORT && (ctx->FSR & 0x40F) == FAULT_STATUS_ALIGNMENT &&
+		pc >= fault_mod->text_base && pc < fault_mod->text_base + fault_mod->text_size) {
+		if (thumb)
+			size = so_fault_emulate_thumb(&ctx->r0, *(uint16_t *)pc, *(uint16_t *)(pc + 2));
+		else
+			size = so_fault_emulate_arm(&ctx->r0, *(uint32_t *)pc);
+	}
+
+	if (!size) {
+		if (fault_prev_handler) {
+			fault_prev_handler(ctx);
+			return;
+		}
+		// Returning as is would fault again forever, bail out on the faulting thread instead
+		ctx->r0 = pc;
+		ctx->r1 = ctx->FAR;
+		ctx->lr = pc | thumb;
+		ctx->pc = (uintptr_t)&so_fault_unhandled & ~1;
+		ctx->SPSR = (ctx->SPSR & ~(FAULT_IT_MASK | FAULT_T_BIT)) | (((uintptr_t)&so_fault_unhandled & 1) ? FAULT_T_BIT : 0);
+		return;
+	}
+
+	so_fault_site *site = so_fault_site_get(pc);
+	if (site) {
+		site->thumb = thumb;
+		if ((ctx->SPSR & FAULT_IT_MASK) && thumb)
+			site->in_it = 1;
+		if (__atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED) == fault_threshold) {
+			site->state = FAULT_QUEUED;
+			__atomic_store_n(&fault_pending, 1, __ATOMIC_RELEASE);
+		}
+	} else {
+		__atomic_add_fetch(&fault_dropped, 1, __ATOMIC_RELAXED);
+	}
+
+	if (thumb)
+		so_fault_advance_it(ctx);
+	ctx->pc = pc + size;
+}
+
+static void so_fault_atexit(void) {
+	so_fault_report(fault_report_path);
+}
+
+// A Thumb LDM/LDRD trampoline branch is two halfwords, which straddle a word at 2 mod 4
+static int so_fault_patch_atomic(so_fault_site *site) {
+	return !site->thumb || site->kind == SCAN_VLD || !(site->pc & 2);
+}
+
+// Deferred sites of the previous report, nothing runs module code yet
+static void so_fault_load(const char *path) {
+	char line[512], state[16];
+	uint32_t offset, fix_offset, count = 0;
+	int thumb, deferred = 0;
+
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return;
+
+	// A deferred site line is followed by its so_fix_misaligned line, which has the mode
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "0x%x %*s %u %15s", &offset, &count, state) == 3) {
+			deferred = strcmp(state, "deferred") == 0;
+			continue;
+		}
+		if (!deferred || sscanf(line, " so_fix_misaligned(&mod, mod.text_base + 0x%x, %*[^,], %d);", &fix_offset, &thumb) != 2)
+			continue;
+		deferred = 0;
+		if (fix_offset != offset || offset >= fault_mod->text_size)
+			continue;
+
+		uintptr_t pc = fault_mod->text_base + offset;
+		so_scan_site s;
+		int kind = so_scan_decode(&s, pc, thumb);
+		if (kind < 0 || !s.fixable || so_fix_misaligned(fault_mod, pc, kind, thumb) < 0)
+			continue;
+
+		so_fault_site *site = so_fault_site_get(pc);
+		if (site) {
+			site->count = count;
+			site->thumb = thumb;
+			site->kind = kind;
+			site->fixable = 1;
+			site->state = FAULT_DEFERRED;
+		}
+	}
+
+	fclose(f);
+}
+
+int so_fault_init(so_module *mod, int threshold, const char *report_path) {
+	KuKernelAbortHandlerOpt opt;
+	opt.size = sizeof(opt);
+
+	fault_mod = mod;
+	fault_threshold = threshold;
+	fault_report_path = report_path;
+	memset(fault_sites, 0, sizeof(fault_sites));
+
+	// Build the address index now, the handler can't allocate
+	so_addr2sym(mod, mod->text_base, NULL);
+
+	if (report_path)
+		so_fault_load(report_path);
+
+	int res = kuKernelRegisterAbortHandler(so_fault_handler, &fault_prev_handler, &opt);
+	if (res < 0) {
+		printf("Failed to register abort handler: 0x%08X\n", res);
+		fault_mod = NULL;
+		return res;
+	}
+
+	if (report_path)
+		atexit(so_fault_atexit);
+	return 0;
+}
+
+void so_fault_poll(void) {
+	if (!fault_mod || !__atomic_exchange_n(&fault_pending, 0, __ATOMIC_ACQUIRE))
+		return;
+
+	for (int i = 0; i < FAULT_MAX_SITES; i++) {
+		so_fault_site *site = &fault_sites[i];
+		if (!site->pc || site->state != FAULT_QUEUED)
+			continue;
+
+		so_scan_site s;
+		site->kind = so_scan_decode(&s, site->pc, site->thumb);
+		site->fixable = s.fixable && !site->in_it;
+		if (!site->fixable)
+			site->state = FAULT_UNFIXABLE;
+		else if (!so_fault_patch_atomic(site))
+			site->state = FAULT_DEFERRED;
+		else if (so_fix_misaligned(fault_mod, site->pc, site->kind, site->thumb) == 0)
+			site->state = FAULT_PATCHED;
+		else
+			site->state = FAULT_UNFIXABLE;
+		debugPrintf("Misaligned access at 0x%08X %s after %u faults.\n", site->pc, site->state == FAULT_PATCHED ? "patched" : "left emulated", site->count);
+	}
+
+	// Keep the report current, the app is usually killed rather than exited
+	so_fault_report(fault_report_path);
+}
+
+int so_fault_report(const char *path) {
+	static const char *states[] = { "emulated", "queued", "patched", "unfixable", "deferred" };
+	static const char *kinds[] = { "SCAN_LDM", "SCAN_LDRD", "SCAN_VLD" };
+
+	if (!fault_mod || !path)
+		return -1;
+
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return -1;
+
+	fprintf(f, "# pc, symbol, faults, state; deferred sites get patched on boot while this file is kept,\n");
+	fprintf(f, "# fixable sites can be baked into patch_game with:\n");
+	fprintf(f, "# so_fix_misaligned(&mod, mod.text_base + offset, kind, thumb)\n");
+	for (int i = 0; i < FAULT_MAX_SITES; i++) {
+		so_fault_site *site = &fault_sites[i];
+		if (!site->pc)
+			continue;
+
+		uintptr_t offset = 0;
+		const char *sym = so_addr2sym(fault_mod, site->pc, &offset);
+		int kind = site->kind, fixable = site->fixable;
+		if (site->state == FAULT_EMULATED) {
+			// Never went through so_fault_poll, the instruction is still the original one
+			so_scan_site s;
+			kind = so_scan_decode(&s, site->pc, site->thumb);
+			fixable = s.fixable && !site->in_it;
+		}
+
+		fprintf(f, "0x%08X %s+0x%X %u %s\n", site->pc - fault_mod->text_base, sym ? sym : "?", offset, site->count, states[site->state]);
+		if (fixable)
+			fprintf(f, "\tso_fix_misaligned(&mod, mod.text_base + 0x%08X, %s, %d);\n", site->pc - fault_mod->text_base, kinds[kind], site->thumb);
+	}
+	if (fault_dropped)
+		fprintf(f, "# %d faults from untracked sites (table full)\n", fault_dropped);
+
+	fclose(f);
+	return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef __SO_FAULT_H__
+#define __SO_FAULT_H__
+
+#include "so_util.h"
+
+#define FAULT_MAX_SITES 256
+
+int so_fault_init(so_module *mod, int threshold, const char *report_path);
+void so_fault_poll(void);
+int so_fault_report(const char *path);
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef __SO_PLATFORM_H__
+#define __SO_PLATFORM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef SO_HOST
+// Host builds: the Sce types and the sceIo/sceKernel subset so_util uses, implemented over POSIX
+typedef int SceUID;
+typedef int SceMode;
+typedef unsigned int SceSize;
+typedef unsigned int SceUInt;
+typedef unsigned int SceUInt32;
+typedef unsigned long long SceUInt64;
+typedef long long SceOff;
+typedef int (*SceKernelThreadEntry)(SceSize args, void *argp);
+
+typedef struct {
+  unsigned short year, month, day;
+  unsigned short hour, minute, second;
+  unsigned int microsecond;
+} SceDateTime;
+
+typedef struct {
+  SceMode st_mode;
+  unsigned int st_attr;
+  SceOff st_size;
+  SceDateTime st_ctime, st_atime, st_mtime;
+  unsigned int st_private[6];
+} SceIoStat;
+
+#define SCE_O_RDONLY 0x0001
+#define SCE_O_WRONLY 0x0002
+#define SCE_O_RDWR (SCE_O_RDONLY | SCE_O_WRONLY)
+#define SCE_O_CREAT 0x0200
+#define SCE_O_TRUNC 0x0400
+
+#define SCE_SEEK_SET 0
+#define SCE_SEEK_CUR 1
+#define SCE_SEEK_END 2
+
+#define SCE_KERNEL_CPU_MASK_USER_0 (0x01 << 16)
+#define SCE_KERNEL_CPU_MASK_USER_1 (0x01 << 17)
+#define SCE_KERNEL_CPU_MASK_USER_2 (0x01 << 18)
+
+SceUID sceIoOpen(const char *file, int flags, SceMode mode);
+int sceIoClose(SceUID fd);
+int sceIoRead(SceUID fd, void *data, SceSize size);
+int sceIoWrite(SceUID fd, const void *data, SceSize size);
+SceOff sceIoLseek(SceUID fd, SceOff offset, int whence);
+int sceIoGetstat(const char *file, SceIoStat *stat);
+int sceIoRemove(const char *file);
+
+SceUID sceKernelCreateThread(const char *name, SceKernelThreadEntry entry, int priority, SceSize stack_size, SceUInt attr, int cpu_mask, const void *opt);
+int sceKernelStartThread(SceUID thid, SceSize args, void *argp);
+int sceKernelWaitThreadEnd(SceUID thid, int *stat, SceUInt *timeout);
+int sceKernelDeleteThread(SceUID thid);
+
+SceUID sceKernelCreateSema(const char *name, SceUInt attr, int init_val, int max_val, const void *opt);
+int sceKernelWaitSema(SceUID semaid, int signal, SceUInt *timeout);
+int sceKernelSignalSema(SceUID semaid, int signal);
+int sceKernelDeleteSema(SceUID semaid);
+
+SceUID sceKernelCreateMutex(const char *name, SceUInt attr, int init_count, const void *opt);
+int sceKernelLockMutex(SceUID mutexid, int lock_count, SceUInt *timeout);
+int sceKernelUnlockMutex(SceUID mutexid, int unlock_count);
+
+SceUInt64 sceKernelGetProcessTimeWide(void);
+void *sceClibMemcpy(void *dst, const void *src, SceSize size);
+
+void *vglGetProcAddress(const char *name);
+#else
+#include <vitasdk.h>
+#include <kubridge.h>
+#endif
+
+/*
+ * Module memory: blocks mapped at a fixed address, RX ones being writable only
+ * through so_memcpy_rx. Vita goes through kubridge, host builds use mmap/mprotect.
+ */
+SceUID so_block_alloc(const char *name, int rx, uintptr_t addr, size_t size);
+int so_block_info(SceUID blockid, uintptr_t *base, size_t *size);
+void so_block_free(SceUID blockid);
+void so_memcpy_rx(void *dst, const void *src, size_t size);
+void so_flush_rx(void *addr, size_t size);
+
+#endif
@@ -0,0 +1,311 @@
+/* so_platform_linux.c -- so_util backend for host (Linux) builds
+ *
+ * Lets the loader map, relocate and resolve real modules off-device, for
+ * benchmarking. Module code is never executed: RX blocks are only made
+ * writable for the duration of so_memcpy_rx.
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// <sys/stat.h> aliases these to the timespec fields, SceIoStat has real ones
+#undef st_atime
+#undef st_mtime
+#undef st_ctime
+
+#include "so_platform.h"
+
+#define MAX_HOST_BLOCKS 64
+#define MAX_HOST_OBJECTS 64
+
+typedef struct {
+  uintptr_t base;
+  size_t size;
+  int rx;
+} host_block;
+
+static host_block blocks[MAX_HOST_BLOCKS];
+
+// Block ids start at 1, 0 is the .text cave for so_arena
+SceUID so_block_alloc(const char *name, int rx, uintptr_t addr, size_t size) {
+	int id;
+	for (id = 0; id < MAX_HOST_BLOCKS && blocks[id].base; id++);
+	if (id == MAX_HOST_BLOCKS)
+		return -1;
+
+	size = (size + getpagesize() - 1) & ~(getpagesize() - 1);
+	void *base = mmap((void *)addr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (base == MAP_FAILED)
+		return -1;
+	if ((uintptr_t)base != addr) {
+		munmap(base, size);
+		return -1;
+	}
+	if (rx)
+		mprotect(base, size, PROT_READ | PROT_EXEC);
+
+	blocks[id].base = (uintptr_t)base;
+	blocks[id].size = size;
+	blocks[id].rx = rx;
+	return id + 1;
+}
+
+int so_block_info(SceUID blockid, uintptr_t *base, size_t *size) {
+	if (blockid <= 0 || blockid > MAX_HOST_BLOCKS || !blocks[blockid - 1].base)
+		return -1;
+	if (base)
+		*base = blocks[blockid - 1].base;
+	if (size)
+		*size = blocks[blockid - 1].size;
+	return 0;
+}
+
+void so_block_free(SceUID blockid) {
+	if (blockid <= 0 || blockid > MAX_HOST_BLOCKS || !blocks[blockid - 1].base)
+		return;
+	munmap((void *)blocks[blockid - 1].base, blocks[blockid - 1].size);
+	memset(&blocks[blockid - 1], 0, sizeof(host_block));
+}
+
+void so_memcpy_rx(void *dst, const void *src, size_t size) {
+	uintptr_t start = (uintptr_t)dst & ~(getpagesize() - 1);
+	uintptr_t end = ((uintptr_t)dst + size + getpagesize() - 1) & ~(getpagesize() - 1);
+	host_block *b = NULL;
+	for (int i = 0; i < MAX_HOST_BLOCKS; i++) {
+		if (blocks[i].rx && start >= blocks[i].base && end <= blocks[i].base + blocks[i].size) {
+			b = &blocks[i];
+			break;
+		}
+	}
+
+	if (b)
+		mprotect((void *)start, end - start, PROT_READ | PROT_WRITE);
+	memcpy(dst, src, size);
+	if (b)
+		mprotect((void *)start, end - start, PROT_READ | PROT_EXEC);
+}
+
+void so_flush_rx(void *addr, size_t size) {
+	__builtin___clear_cache((char *)addr, (char *)addr + size);
+}
+
+SceUID sceIoOpen(const char *file, int flags, SceMode mode) {
+	int oflags = (flags & SCE_O_RDWR) == SCE_O_RDWR ? O_RDWR : (flags & SCE_O_WRONLY) ? O_WRONLY : O_RDONLY;
+	if (flags & SCE_O_CREAT)
+		oflags |= O_CREAT;
+	if (flags & SCE_O_TRUNC)
+		oflags |= O_TRUNC;
+	int fd = open(file, oflags, mode);
+	return fd < 0 ? -errno : fd;
+}
+
+int sceIoClose(SceUID fd) {
+	return close(fd);
+}
+
+int sceIoRead(SceUID fd, void *data, SceSize size) {
+	return read(fd, data, size);
+}
+
+int sceIoWrite(SceUID fd, const void *data, SceSize size) {
+	return write(fd, data, size);
+}
+
+SceOff sceIoLseek(SceUID fd, SceOff offset, int whence) {
+	return lseek(fd, offset, whence == SCE_SEEK_END ? SEEK_END : whence == SCE_SEEK_CUR ? SEEK_CUR : SEEK_SET);
+}
+
+static void host_datetime(SceDateTime *dt, const struct timespec *ts) {
+	struct tm tm;
+	gmtime_r(&ts->tv_sec, &tm);
+	dt->year = tm.tm_year + 1900;
+	dt->month = tm.tm_mon + 1;
+	dt->day = tm.tm_mday;
+	dt->hour = tm.tm_hour;
+	dt->minute = tm.tm_min;
+	dt->second = tm.tm_sec;
+	dt->microsecond = ts->tv_nsec / 1000;
+}
+
+int sceIoGetstat(const char *file, SceIoStat *stat) {
+	struct stat st;
+	if (lstat(file, &st) < 0)
+		return -errno;
+	memset(stat, 0, sizeof(SceIoStat));
+	stat->st_mode = st.st_mode;
+	stat->st_size = st.st_size;
+	host_datetime(&stat->st_ctime, &st.st_ctim);
+	host_datetime(&stat->st_atime, &st.st_atim);
+	host_datetime(&stat->st_mtime, &st.st_mtim);
+	return 0;
+}
+
+int sceIoRemove(const char *file) {
+	return unlink(file) < 0 ? -errno : 0;
+}
+
+/*
+ * Kernel objects: threads, semaphores and mutexes share one id space. Only
+ * what the loader relies on is modelled (no timeouts, no recursive locking).
+ */
+typedef struct {
+  int type;
+  pthread_t thread;
+  SceKernelThreadEntry entry;
+  void *args;
+  SceSize args_size;
+  int exit_status;
+  sem_t sema;
+  pthread_mutex_t mutex;
+} host_object;
+
+enum {
+	HOST_FREE,
+	HOST_THREAD,
+	HOST_SEMA,
+	HOST_MUTEX,
+};
+
+static host_object objects[MAX_HOST_OBJECTS];
+static pthread_mutex_t objects_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static SceUID host_object_new(int type) {
+	pthread_mutex_lock(&objects_lock);
+	for (int i = 0; i < MAX_HOST_OBJECTS; i++) {
+		if (objects[i].type == HOST_FREE) {
+			memset(&objects[i], 0, sizeof(host_object));
+			objects[i].type = type;
+			pthread_mutex_unlock(&objects_lock);
+			return i + 1;
+		}
+	}
+	pthread_mutex_unlock(&objects_lock);
+	return -1;
+}
+
+static host_object *host_object_get(SceUID id, int type) {
+	if (id <= 0 || id > MAX_HOST_OBJECTS || objects[id - 1].type != type)
+		return NULL;
+	return &objects[id - 1];
+}
+
+SceUID sceKernelCreateThread(const char *name, SceKernelThreadEntry entry, int priority, SceSize stack_size, SceUInt attr, int cpu_mask, const void *opt) {
+	SceUID thid = host_object_new(HOST_THREAD);
+	if (thid >= 0)
+		objects[thid - 1].entry = entry;
+	return thid;
+}
+
+static void *host_thread(void *arg) {
+	host_object *t = arg;
+	t->exit_status = t->entry(t->args_size, t->args);
+	return NULL;
+}
+
+// Like on the Vita, the argument block is copied for the new thread
+int sceKernelStartThread(SceUID thid, SceSize args, void *argp) {
+	host_object *t = host_object_get(thid, HOST_THREAD);
+	if (!t)
+		return -1;
+	t->args = malloc(args ? args : 1);
+	memcpy(t->args, argp, args);
+	t->args_size = args;
+	return pthread_create(&t->thread, NULL, host_thread, t) ? -1 : 0;
+}
+
+int sceKernelWaitThreadEnd(SceUID thid, int *stat, SceUInt *timeout) {
+	host_object *t = host_object_get(thid, HOST_THREAD);
+	if (!t || pthread_join(t->thread, NULL))
+		return -1;
+	if (stat)
+		*stat = t->exit_status;
+	return 0;
+}
+
+int sceKernelDeleteThread(SceUID thid) {
+	host_object *t = host_object_get(thid, HOST_THREAD);
+	if (!t)
+		return -1;
+	free(t->args);
+	t->type = HOST_FREE;
+	return 0;
+}
+
+SceUID sceKernelCreateSema(const char *name, SceUInt attr, int init_val, int max_val, const void *opt) {
+	SceUID semaid = host_object_new(HOST_SEMA);
+	if (semaid >= 0)
+		sem_init(&objects[semaid - 1].sema, 0, init_val);
+	return semaid;
+}
+
+int sceKernelWaitSema(SceUID semaid, int signal, SceUInt *timeout) {
+	host_object *s = host_object_get(semaid, HOST_SEMA);
+	if (!s)
+		return -1;
+	for (int i = 0; i < signal; i++) {
+		while (sem_wait(&s->sema) < 0 && errno == EINTR);
+	}
+	return 0;
+}
+
+int sceKernelSignalSema(SceUID semaid, int signal) {
+	host_object *s = host_object_get(semaid, HOST_SEMA);
+	if (!s)
+		return -1;
+	for (int i = 0; i < signal; i++)
+		sem_post(&s->sema);
+	return 0;
+}
+
+int sceKernelDeleteSema(SceUID semaid) {
+	host_object *s = host_object_get(semaid, HOST_SEMA);
+	if (!s)
+		return -1;
+	sem_destroy(&s->sema);
+	s->type = HOST_FREE;
+	return 0;
+}
+
+SceUID sceKernelCreateMutex(const char *name, SceUInt attr, int init_count, const void *opt) {
+	SceUID mutexid = host_object_new(HOST_MUTEX);
+	if (mutexid >= 0) {
+		pthread_mutex_init(&objects[mutexid - 1].mutex, NULL);
+		if (init_count)
+			pthread_mutex_lock(&objects[mutexid - 1].mutex);
+	}
+	return mutexid;
+}
+
+int sceKernelLockMutex(SceUID mutexid, int lock_count, SceUInt *timeout) {
+	host_object *m = host_object_get(mutexid, HOST_MUTEX);
+	return m ? pthread_mutex_lock(&m->mutex) : -1;
+}
+
+int sceKernelUnlockMutex(SceUID mutexid, int unlock_count) {
+	host_object *m = host_object_get(mutexid, HOST_MUTEX);
+	return m ? pthread_mutex_unlock(&m->mutex) : -1;
+}
+
+SceUInt64 sceKernelGetProcessTimeWide(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (SceUInt64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void *sceClibMemcpy(void *dst, const void *src, SceSize size) {
+	return memcpy(dst, src, size);
+}
@@ -0,0 +1,55 @@
+/* so_platform_vita.c -- so_util memory backend on top of kubridge
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <string.h>
+
+#include "so_platform.h"
+
+#ifndef SCE_KERNEL_MEMBLOCK_TYPE_USER_RX
+#define SCE_KERNEL_MEMBLOCK_TYPE_USER_RX                 (0x0C20D050)
+#endif
+
+SceUID so_block_alloc(const char *name, int rx, uintptr_t addr, size_t size) {
+	SceKernelAllocMemBlockKernelOpt opt;
+	memset(&opt, 0, sizeof(SceKernelAllocMemBlockKernelOpt));
+	opt.size = sizeof(SceKernelAllocMemBlockKernelOpt);
+	opt.attr = 0x1;
+	opt.field_C = (SceUInt32)addr;
+	return kuKernelAllocMemBlock(name, rx ? SCE_KERNEL_MEMBLOCK_TYPE_USER_RX : SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, size, &opt);
+}
+
+int so_block_info(SceUID blockid, uintptr_t *base, size_t *size) {
+	void *addr;
+	int res = sceKernelGetMemBlockBase(blockid, &addr);
+	if (res < 0)
+		return res;
+	if (base)
+		*base = (uintptr_t)addr;
+
+	if (size) {
+		SceKernelMemBlockInfo info;
+		memset(&info, 0, sizeof(info));
+		info.size = sizeof(info);
+		res = sceKernelGetMemBlockInfoByAddr(addr, &info);
+		if (res < 0)
+			return res;
+		*size = info.mappedSize;
+	}
+
+	return 0;
+}
+
+void so_block_free(SceUID blockid) {
+	sceKernelFreeMemBlock(blockid);
+}
+
+void so_memcpy_rx(void *dst, const void *src, size_t size) {
+	kuKernelCpuUnrestrictedMemcpy(dst, src, size);
+}
+
+void so_flush_rx(void *addr, size_t size) {
+	kuKernelFlushCaches(addr, size);
+}
@@ -0,0 +1,359 @@
+/* so_prof.c -- sample aggregation, EHABI unwinding and folded stack output
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "so_util.h"
+#include "so_prof.h"
+
+/*
+ * Samples are stacks of raw PCs counted in a fixed open-addressing table, so the
+ * sampler can add them from the abort handler. Nothing here touches the Vita
+ * APIs: symbolization goes through so_addr2sym only when writing the folded
+ * output, and stacks saved on the Vita can be loaded back and folded on the host.
+ */
+
+#define PROF_MAGIC 0x31504F53 // SOP1
+#define EXIDX_CANTUNWIND 1
+
+int so_prof_init(so_prof *p, so_module *mod) {
+	memset(p, 0, sizeof(*p));
+	p->mod = mod;
+	p->stacks = calloc(PROF_MAX_STACKS, sizeof(so_prof_stack));
+	if (!p->stacks)
+		return -1;
+
+	// Build the address index now, folding needs it and so would a crash report
+	so_addr2sym(mod, mod->text_base, NULL);
+	return 0;
+}
+
+void so_prof_free(so_prof *p) {
+	free(p->stacks);
+	p->stacks = NULL;
+}
+
+void so_prof_reset(so_prof *p) {
+	memset(p->stacks, 0, PROF_MAX_STACKS * sizeof(so_prof_stack));
+	p->num_stacks = 0;
+	p->samples = 0;
+	p->outside = 0;
+	p->dropped = 0;
+}
+
+void so_prof_add(so_prof *p, const uintptr_t *pcs, int depth, uint32_t count) {
+	uint32_t hash = 2166136261u;
+	if (depth > PROF_MAX_DEPTH)
+		depth = PROF_MAX_DEPTH;
+	for (int i = 0; i < depth; i++)
+		hash = (hash ^ pcs[i]) * 16777619u;
+
+	p->samples += count;
+	for (uint32_t i = 0, slot = hash; i < PROF_MAX_STACKS; i++, slot++) {
+		so_prof_stack *s = &p->stacks[slot & (PROF_MAX_STACKS - 1)];
+		if (!s->count) {
+			// Keep the load factor under 3/4, the table can't grow from the handler
+			if (p->num_stacks >= PROF_MAX_STACKS * 3 / 4)
+				break;
+			s->hash = hash;
+			s->depth = depth;
+			memcpy(s->pcs, pcs, depth * sizeof(uintptr_t));
+			s->count = count;
+			p->num_stacks++;
+			return;
+		}
+		if (s->hash == hash && s->depth == (uint32_t)depth && memcmp(s->pcs, pcs, depth * sizeof(uintptr_t)) == 0) {
+			s->count += count;
+			return;
+		}
+	}
+	p->dropped += count;
+}
+
+/*
+ * ARM EHABI unwinding. Every .ARM.exidx entry is a prel31 function start and either
+ * an inline compact entry (personality 0), EXIDX_CANTUNWIND, or a prel31 to the
+ * .ARM.extab entry. Compact personalities 1/2 and GCC's generic personality routines
+ * all store their unwind opcodes in the same layout, only the leading words differ.
+ */
+
+static uintptr_t so_prel31(const uint32_t *p) {
+	return (uintptr_t)p + ((int32_t)(*p << 1) >> 1);
+}
+
+static const uint32_t *so_exidx_find(so_module *mod, uintptr_t pc) {
+	int lo = 0, hi = mod->num_exidx - 1, found = -1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (so_prel31(&mod->exidx[mid * 2]) <= pc) {
+			found = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return found < 0 ? NULL : &mod->exidx[found * 2];
+}
+
+static int so_unwind_pop(uint32_t *r, uint32_t *vsp, uint32_t mask, uintptr_t lo, uintptr_t hi) {
+	uint32_t sp = *vsp;
+	for (int i = 0; i < 16; i++) {
+		if (!(mask & (1 << i)))
+			continue;
+		if (sp < lo || sp + 4 > hi)
+			return -1;
+		r[i] = *(uint32_t *)sp;
+		sp += 4;
+	}
+	*vsp = (mask & (1 << 13)) ? r[13] : sp;
+	return 0;
+}
+
+// Opcodes are read MSB first, running off the end reads as finish
+static uint32_t so_unwind_op(const uint32_t *w, uint32_t n, uint32_t *pos) {
+	uint32_t i = (*pos)++;
+	return i < 4 * (n + 1) ? (w[i >> 2] >> (24 - 8 * (i & 3))) & 0xFF : 0xB0;
+}
+
+static int so_unwind_frame(so_module *mod, uint32_t *r, uintptr_t pc, uintptr_t lo, uintptr_t hi) {
+	const uint32_t *e = so_exidx_find(mod, pc);
+	const uint32_t *w;
+	uint32_t n, pos;
+
+	if (!e || e[1] == EXIDX_CANTUNWIND)
+		return -1;
+
+	if (e[1] & 0x80000000) {
+		// Inline, only personality 0 fits
+		if ((e[1] >> 24) & 0xF)
+			return -1;
+		w = &e[1];
+		n = 0;
+		pos = 1;
+	} else {
+		w = (const uint32_t *)so_prel31(&e[1]);
+		if ((uintptr_t)w < mod->text_base || (uintptr_t)w >= mod->text_base + mod->text_size)
+			return -1;
+		if (*w & 0x80000000) {
+			uint32_t personality = (*w >> 24) & 0xF;
+			if (personality > 2)
+				return -1;
+			n = personality ? (*w >> 16) & 0xFF : 0;
+			pos = personality ? 2 : 1;
+		} else {
+			// Generic model, skip the personality routine
+			w++;
+			n = *w >> 24;
+			pos = 1;
+		}
+	}
+
+	uint32_t vsp = r[13];
+	int pc_set = 0;
+	while (pos < 4 * (n + 1)) {
+		uint32_t op = so_unwind_op(w, n, &pos);
+		uint32_t mask;
+
+		if ((op & 0xC0) == 0x00) {
+			vsp += ((op & 0x3F) << 2) + 4;
+		} else if ((op & 0xC0) == 0x40) {
+			vsp -= ((op & 0x3F) << 2) + 4;
+		} else if ((op & 0xF0) == 0x80) {
+			// pop {r4-r15} under mask, an empty mask means refuse to unwind
+			uint32_t op2 = so_unwind_op(w, n, &pos);
+			mask = (((op & 0xF) << 8) | op2) << 4;
+			if (!mask || so_unwind_pop(r, &vsp, mask, lo, hi) < 0)
+				return -1;
+			pc_set |= mask & (1 << 15);
+		} else if ((op & 0xF0) == 0x90) {
+			if ((op & 0xF) == 13 || (op & 0xF) == 15)
+				return -1;
+			vsp = r[op & 0xF];
+		} else if ((op & 0xF0) == 0xA0) {
+			// pop {r4-r[4+nnn]}, plus r14 with bit 3
+			mask = ((1 << ((op & 7) + 1)) - 1) << 4;
+			if (op & 8)
+				mask |= 1 << 14;
+			if (so_unwind_pop(r, &vsp, mask, lo, hi) < 0)
+				return -1;
+		} else if (op == 0xB0) {
+			break;
+		} else if (op == 0xB1) {
+			mask = so_unwind_op(w, n, &pos);
+			if (!mask || (mask & 0xF0) || so_unwind_pop(r, &vsp, mask, lo, hi) < 0)
+				return -1;
+		} else if (op == 0xB2) {
+			uint32_t v = 0, shift = 0, b;
+			do {
+				b = so_unwind_op(w, n, &pos);
+				v |= (b & 0x7F) << shift;
+				shift += 7;
+			} while ((b & 0x80) && shift < 32);
+			vsp += 0x204 + (v << 2);
+		} else if (op == 0xB3 || op == 0xC8 || op == 0xC9) {
+			// VFP registers only move vsp, FSTMFDX (0xB3) has an extra word
+			uint32_t op2 = so_unwind_op(w, n, &pos);
+			vsp += ((op2 & 0xF) + 1) * 8 + (op == 0xB3 ? 4 : 0);
+		} else if ((op & 0xF8) == 0xB8) {
+			vsp += ((op & 7) + 1) * 8 + 4;
+		} else if ((op & 0xF8) == 0xD0) {
+			vsp += ((op & 7) + 1) * 8;
+		} else {
+			// iWMMXt and spare encodings, never emitted for the Vita's cores
+			return -1;
+		}
+	}
+
+	r[13] = vsp;
+	if (!pc_set)
+		r[15] = r[14];
+	return 0;
+}
+
+int so_prof_unwind(so_module *mod, const uint32_t *regs, uintptr_t stack_lo, uintptr_t stack_hi, uintptr_t *pcs, int max) {
+	uint32_t r[16];
+	int depth = 0;
+
+	memcpy(r, regs, sizeof(r));
+	pcs[depth++] = r[15] & ~1;
+
+	while (depth < max && mod->exidx) {
+		uint32_t pc = r[15] & ~1, sp = r[13];
+		// Callers are looked up from the call instruction, the return address may be past the function
+		if (so_unwind_frame(mod, r, depth == 1 ? pc : pc - 2, stack_lo, stack_hi) < 0)
+			break;
+		if ((r[15] & ~1) < mod->text_base || (r[15] & ~1) >= mod->text_base + mod->text_size)
+			break;
+		if (r[13] == sp && (r[15] & ~1) == pc)
+			break;
+		pcs[depth++] = r[15] & ~1;
+	}
+
+	return depth;
+}
+
+int so_prof_save(so_prof *p, const char *path) {
+	FILE *f = fopen(path, "wb");
+	if (!f)
+		return -1;
+
+	uint32_t hdr[4] = { PROF_MAGIC, p->mod->text_base, p->num_stacks, p->outside };
+	fwrite(hdr, sizeof(hdr), 1, f);
+	for (int i = 0; i < PROF_MAX_STACKS; i++) {
+		so_prof_stack *s = &p->stacks[i];
+		if (!s->count)
+			continue;
+		uint32_t pcs[PROF_MAX_DEPTH];
+		for (uint32_t j = 0; j < s->depth; j++)
+			pcs[j] = s->pcs[j];
+		fwrite(&s->count, sizeof(uint32_t), 1, f);
+		fwrite(&s->depth, sizeof(uint32_t), 1, f);
+		fwrite(pcs, sizeof(uint32_t), s->depth, f);
+	}
+
+	fclose(f);
+	return 0;
+}
+
+int so_prof_load(so_prof *p, const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return -1;
+
+	uint32_t hdr[4];
+	if (fread(hdr, sizeof(hdr), 1, f) != 1 || hdr[0] != PROF_MAGIC) {
+		fclose(f);
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < hdr[2]; i++) {
+		uint32_t rec[2], pcs[PROF_MAX_DEPTH];
+		uintptr_t stack[PROF_MAX_DEPTH];
+		if (fread(rec, sizeof(rec), 1, f) != 1 || rec[1] > PROF_MAX_DEPTH || fread(pcs, sizeof(uint32_t), rec[1], f) != rec[1]) {
+			fclose(f);
+			return -1;
+		}
+		for (uint32_t j = 0; j < rec[1]; j++)
+			stack[j] = pcs[j] - hdr[1] + p->mod->text_base;
+		so_prof_add(p, stack, rec[1], rec[0]);
+	}
+	p->outside += hdr[3];
+
+	fclose(f);
+	return 0;
+}
+
+typedef struct {
+	char *line;
+	uint32_t count;
+} so_prof_line;
+
+static int so_prof_line_cmp(const void *a, const void *b) {
+	return strcmp(((const so_prof_line *)a)->line, ((const so_prof_line *)b)->line);
+}
+
+static int so_prof_frame(so_prof *p, char *buf, size_t size, uintptr_t pc) {
+	uintptr_t offset;
+	const char *sym = so_addr2sym(p->mod, pc, &offset);
+	if (sym)
+		return snprintf(buf, size, "%s", sym);
+	return snprintf(buf, size, "%s+0x%X", p->mod->soname ? p->mod->soname : "?", (unsigned int)(pc - p->mod->text_base));
+}
+
+int so_prof_folded(so_prof *p, FILE *f) {
+	so_prof_line *lines = malloc(p->num_stacks * sizeof(so_prof_line));
+	int num_lines = 0;
+	char buf[4096];
+
+	if (!lines && p->num_stacks)
+		return -1;
+
+	for (int i = 0; i < PROF_MAX_STACKS; i++) {
+		so_prof_stack *s = &p->stacks[i];
+		if (!s->count)
+			continue;
+
+		size_t len = 0;
+		for (int j = s->depth - 1; j >= 0 && len < sizeof(buf); j--) {
+			// Callers are return addresses, step back into the call so a tail of the function isn't misnamed
+			len += so_prof_frame(p, buf + len, sizeof(buf) - len, j ? s->pcs[j] - 1 : s->pcs[j]);
+			if (j && len < sizeof(buf) - 1)
+				buf[len++] = ';';
+		}
+		buf[sizeof(buf) - 1] = '\0';
+		lines[num_lines].line = strdup(buf);
+		lines[num_lines].count = s->count;
+		num_lines++;
+	}
+
+	// Different PCs in the same functions fold into the same line
+	qsort(lines, num_lines, sizeof(so_prof_line), so_prof_line_cmp);
+	for (int i = 0; i < num_lines; i++) {
+		uint32_t count = lines[i].count;
+		while (i + 1 < num_lines && strcmp(lines[i].line, lines[i + 1].line) == 0) {
+			free(lines[i].line);
+			count += lines[++i].count;
+		}
+		fprintf(f, "%s %u\n", lines[i].line, count);
+		free(lines[i].line);
+	}
+	if (p->outside)
+		fprintf(f, "[outside %s] %u\n", p->mod->soname ? p->mod->soname : "module", p->outside);
+
+	free(lines);
+	return 0;
+}
+
+int so_prof_dump(so_prof *p, const char *path) {
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return -1;
+	int res = so_prof_folded(p, f);
+	fclose(f);
+	return res;
+}
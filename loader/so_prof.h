@@ -0,0 +1,52 @@
+#ifndef __SO_PROF_H__
+#define __SO_PROF_H__
+
+#include <stdio.h>
+
+#include "so_util.h"
+
+#define PROF_MAX_DEPTH 32
+#define PROF_MAX_STACKS 4096 // power of two, preallocated so samples can be added from the abort handler
+
+typedef struct {
+  uint32_t count; // 0 if the slot is free
+  uint32_t hash;
+  uint32_t depth;
+  uintptr_t pcs[PROF_MAX_DEPTH]; // leaf first, callers are return addresses
+} so_prof_stack;
+
+typedef struct {
+  so_module *mod;
+  so_prof_stack *stacks;
+  uint32_t num_stacks;
+  uint32_t samples;
+  uint32_t outside; // sampling windows the thread spent out of the module
+  uint32_t dropped; // table full
+} so_prof;
+
+int so_prof_init(so_prof *p, so_module *mod);
+void so_prof_free(so_prof *p);
+void so_prof_reset(so_prof *p);
+
+// Doesn't allocate, safe from the abort handler as long as a single thread adds samples
+void so_prof_add(so_prof *p, const uintptr_t *pcs, int depth, uint32_t count);
+
+// ARM EHABI unwind through the module's .ARM.exidx, regs is r0-r15 at the sample. Stack
+// reads are kept within [stack_lo, stack_hi). Returns the number of pcs stored.
+int so_prof_unwind(so_module *mod, const uint32_t *regs, uintptr_t stack_lo, uintptr_t stack_hi, uintptr_t *pcs, int max);
+
+// Raw stacks with their counts, so_prof_load rebases them if the module moved
+int so_prof_save(so_prof *p, const char *path);
+int so_prof_load(so_prof *p, const char *path);
+
+// Folded stacks (root;...;leaf count), one line per distinct symbol path
+int so_prof_folded(so_prof *p, FILE *f);
+int so_prof_dump(so_prof *p, const char *path);
+
+#ifndef SO_HOST
+// Samples thid every period_us by trapping its next instruction fetch in the module
+int so_sampler_start(so_prof *p, SceUID thid, int period_us, int unwind);
+void so_sampler_stop(void);
+#endif
+
+#endif
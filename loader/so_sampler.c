@@ -0,0 +1,140 @@
+/* so_sampler.c -- statistical sampling of a thread running module code
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <kubridge.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "so_util.h"
+#include "so_prof.h"
+
+/*
+ * Userland can't read another thread's registers, so the sampler thread takes the
+ * execute permission off the module's .text every period instead. The next fetch
+ * there raises a prefetch abort; the handler records the PC (and the unwound stack)
+ * if it's the sampled thread, gives .text back and lets the fetch retry. When the
+ * thread doesn't enter the module within the window, the sample counts as outside.
+ */
+
+#define SAMPLER_WINDOW_US 500
+#define SAMPLER_T_BIT 0x20
+#define SAMPLER_IT_MASK 0x0600FC00
+
+static so_prof *sampler_prof = NULL;
+static SceUID sampler_thid, sampler_target;
+static uintptr_t sampler_stack_hi;
+static int sampler_period, sampler_unwind;
+static volatile int sampler_running;
+static int sampler_armed;
+static KuKernelAbortHandler sampler_prev_handler = NULL;
+
+static void so_sampler_protect(uint32_t prot) {
+	kuKernelMemProtect((void *)sampler_prof->mod->text_base, sampler_prof->mod->text_size, prot);
+}
+
+static void so_sampler_unhandled(uintptr_t pc, uintptr_t far) {
+	fatal_error("Unhandled abort at 0x%08X accessing 0x%08X.", pc, far);
+}
+
+static void so_sampler_handler(KuKernelAbortContext *ctx) {
+	so_module *mod = sampler_prof->mod;
+	uintptr_t pc = ctx->pc;
+
+	if (ctx->abortType == KU_KERNEL_ABORT_TYPE_PREFETCH_ABORT && pc >= mod->text_base && pc < mod->text_base + mod->text_size) {
+		if (__atomic_exchange_n(&sampler_armed, 0, __ATOMIC_ACQ_REL)) {
+			if (sceKernelGetThreadId() == sampler_target) {
+				uintptr_t pcs[PROF_MAX_DEPTH];
+				int depth = 1;
+				pcs[0] = pc;
+				if (sampler_unwind)
+					depth = so_prof_unwind(mod, &ctx->r0, ctx->sp, sampler_stack_hi, pcs, PROF_MAX_DEPTH);
+				so_prof_add(sampler_prof, pcs, depth, 1);
+			}
+			so_sampler_protect(KU_KERNEL_PROT_READ | KU_KERNEL_PROT_EXEC);
+		}
+		// Retry the fetch, .text is executable again or about to be
+		return;
+	}
+
+	if (sampler_prev_handler) {
+		sampler_prev_handler(ctx);
+		return;
+	}
+	// Same bail out as so_fault, returning would fault again forever
+	ctx->r0 = pc;
+	ctx->r1 = ctx->FAR;
+	ctx->lr = pc | ((ctx->SPSR & SAMPLER_T_BIT) ? 1 : 0);
+	ctx->pc = (uintptr_t)&so_sampler_unhandled & ~1;
+	ctx->SPSR = (ctx->SPSR & ~(SAMPLER_IT_MASK | SAMPLER_T_BIT)) | (((uintptr_t)&so_sampler_unhandled & 1) ? SAMPLER_T_BIT : 0);
+}
+
+static int so_sampler_thread(SceSize args, void *argp) {
+	while (sampler_running) {
+		sceKernelDelayThread(sampler_period);
+
+		__atomic_store_n(&sampler_armed, 1, __ATOMIC_RELEASE);
+		so_sampler_protect(KU_KERNEL_PROT_READ);
+		sceKernelDelayThread(SAMPLER_WINDOW_US);
+
+		if (__atomic_exchange_n(&sampler_armed, 0, __ATOMIC_ACQ_REL)) {
+			so_sampler_protect(KU_KERNEL_PROT_READ | KU_KERNEL_PROT_EXEC);
+			__atomic_add_fetch(&sampler_prof->outside, 1, __ATOMIC_RELAXED);
+		}
+	}
+	return 0;
+}
+
+int so_sampler_start(so_prof *p, SceUID thid, int period_us, int unwind) {
+	KuKernelAbortHandlerOpt opt;
+	SceKernelThreadInfo info;
+	opt.size = sizeof(opt);
+	info.size = sizeof(info);
+
+	if (sampler_prof)
+		return -1;
+
+	int res = sceKernelGetThreadInfo(thid, &info);
+	if (res < 0) {
+		printf("Failed to get sampled thread info: 0x%08X\n", res);
+		return res;
+	}
+
+	sampler_prof = p;
+	sampler_target = thid;
+	sampler_stack_hi = (uintptr_t)info.stack + info.stackSize;
+	sampler_period = period_us > SAMPLER_WINDOW_US ? period_us - SAMPLER_WINDOW_US : 0;
+	sampler_unwind = unwind;
+
+	res = kuKernelRegisterAbortHandler(so_sampler_handler, &sampler_prev_handler, &opt);
+	if (res < 0) {
+		printf("Failed to register abort handler: 0x%08X\n", res);
+		sampler_prof = NULL;
+		return res;
+	}
+
+	// Another core, above the game threads, so the window closes on time
+	sampler_running = 1;
+	sampler_thid = sceKernelCreateThread("so_sampler", &so_sampler_thread, 0x40, 0x4000, 0, SCE_KERNEL_CPU_MASK_USER_2, NULL);
+	if (sampler_thid < 0) {
+		sampler_running = 0;
+		return sampler_thid;
+	}
+	sceKernelStartThread(sampler_thid, 0, NULL);
+	return 0;
+}
+
+void so_sampler_stop(void) {
+	if (!sampler_running)
+		return;
+
+	// The handler stays registered, it just won't find the trap armed anymore
+	sampler_running = 0;
+	sceKernelWaitThreadEnd(sampler_thid, NULL, NULL);
+	sceKernelDeleteThread(sampler_thid);
+}
@@ -0,0 +1,348 @@
+/* so_scan.c -- finds instructions that fault on unaligned data
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "so_scan.h"
+
+/*
+ * Scanning runs in three steps over each function:
+ * - a literal pass marks the words referenced by PC-relative loads, so constants
+ *   in literal pools aren't mistaken for instructions
+ * - a prefilter (NEON where available) tests every word/halfword against the
+ *   coarse encodings of LDM, LDRD and VLDn at once and produces a candidate bitmap
+ * - only candidates get decoded properly (and, for Thumb, only on instruction
+ *   boundaries and outside IT blocks for fixability)
+*/
+
+#define ARM_PATTERNS 3
+static const uint32_t arm_masks[ARM_PATTERNS] = { 0x0E500000, 0x0E1000F0, 0xFF300000 };
+static const uint32_t arm_values[ARM_PATTERNS] = { 0x08100000, 0x000000D0, 0xF4200000 }; // LDM, LDRD, VLDn
+
+#define THUMB_PATTERNS 3
+static const uint16_t thumb_masks[THUMB_PATTERNS] = { 0xF800, 0xFE10, 0xFF30 };
+static const uint16_t thumb_values[THUMB_PATTERNS] = { 0xC800, 0xE810, 0xF920 }; // LDM (16-bit), LDM.W/LDRD, VLDn
+
+#define BIT_TEST(map, i) ((map)[(i) >> 5] & (1u << ((i) & 31)))
+#define BIT_SET(map, i) ((map)[(i) >> 5] |= (1u << ((i) & 31)))
+
+void so_scan_init(so_scan *s) {
+	memset(s, 0, sizeof(so_scan));
+}
+
+void so_scan_free(so_scan *s) {
+	free(s->sites);
+	free(s->lit);
+	free(s->cand);
+	memset(s, 0, sizeof(so_scan));
+}
+
+static int so_scan_reserve(so_scan *s, size_t n) {
+	size_t words = (n + 31) / 32;
+	if (n > s->cap_bits) {
+		size_t cap = words * 32;
+		uint32_t *lit = realloc(s->lit, words * sizeof(uint32_t));
+		uint32_t *cand = realloc(s->cand, words * sizeof(uint32_t));
+		if (lit)
+			s->lit = lit;
+		if (cand)
+			s->cand = cand;
+		if (!lit || !cand)
+			return -1;
+		s->cap_bits = cap;
+	}
+	memset(s->lit, 0, words * sizeof(uint32_t));
+	memset(s->cand, 0, words * sizeof(uint32_t));
+	return 0;
+}
+
+static void so_scan_add(so_scan *s, uintptr_t addr, uint32_t instr, int kind, int thumb, int fixable) {
+	if (s->num_sites == s->cap_sites) {
+		int cap = s->cap_sites ? s->cap_sites * 2 : 64;
+		so_scan_site *sites = realloc(s->sites, cap * sizeof(so_scan_site));
+		if (!sites)
+			return;
+		s->sites = sites;
+		s->cap_sites = cap;
+	}
+	so_scan_site *site = &s->sites[s->num_sites++];
+	site->addr = addr;
+	site->instr = instr;
+	site->kind = kind;
+	site->thumb = thumb;
+	site->fixable = fixable;
+}
+
+// Marks the units (words or halfwords) covering [target, target + bytes)
+static void so_scan_mark(uint32_t *map, size_t n, uintptr_t vaddr, uintptr_t target, size_t bytes, int shift) {
+	if (target < vaddr)
+		return;
+	for (size_t i = (target - vaddr) >> shift; i < n && (i << shift) < target - vaddr + bytes; i++)
+		BIT_SET(map, i);
+}
+
+#ifdef __ARM_NEON
+static uint32_t so_prefilter_arm(const uint32_t *code) {
+	static const uint32_t lanes[4] = { 1, 2, 4, 8 };
+	uint32x4_t w = vld1q_u32(code);
+	uint32x4_t hit = vdupq_n_u32(0);
+	for (int p = 0; p < ARM_PATTERNS; p++)
+		hit = vorrq_u32(hit, vceqq_u32(vandq_u32(w, vdupq_n_u32(arm_masks[p])), vdupq_n_u32(arm_values[p])));
+	uint32x4_t b = vandq_u32(hit, vld1q_u32(lanes));
+	uint32x2_t r = vorr_u32(vget_low_u32(b), vget_high_u32(b));
+	return vget_lane_u32(r, 0) | vget_lane_u32(r, 1);
+}
+
+static uint32_t so_prefilter_thumb(const uint16_t *code) {
+	static const uint16_t lanes[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint16x8_t h = vld1q_u16(code);
+	uint16x8_t hit = vdupq_n_u16(0);
+	for (int p = 0; p < THUMB_PATTERNS; p++)
+		hit = vorrq_u16(hit, vceqq_u16(vandq_u16(h, vdupq_n_u16(thumb_masks[p])), vdupq_n_u16(thumb_values[p])));
+	uint64x2_t b = vpaddlq_u32(vpaddlq_u16(vandq_u16(hit, vld1q_u16(lanes))));
+	return (uint32_t)(vgetq_lane_u64(b, 0) | vgetq_lane_u64(b, 1));
+}
+#else
+static uint32_t so_prefilter_arm(const uint32_t *code) {
+	uint32_t hits = 0;
+	for (int i = 0; i < 4; i++) {
+		for (int p = 0; p < ARM_PATTERNS; p++) {
+			if ((code[i] & arm_masks[p]) == arm_values[p])
+				hits |= 1 << i;
+		}
+	}
+	return hits;
+}
+
+static uint32_t so_prefilter_thumb(const uint16_t *code) {
+	uint32_t hits = 0;
+	for (int i = 0; i < 8; i++) {
+		for (int p = 0; p < THUMB_PATTERNS; p++) {
+			if ((code[i] & thumb_masks[p]) == thumb_values[p])
+				hits |= 1 << i;
+		}
+	}
+	return hits;
+}
+#endif
+
+// VLDn, in ARM layout (Thumb hw1 0xF9xx maps to 0xF4xx)
+static int so_scan_vld(uint32_t w, int *fixable) {
+	if (w & 0x00800000) {
+		// single lane or to all lanes, alignment bits depend on the element size
+		int size = (w >> 10) & 3;
+		if (size == 3)
+			return (w & 0x10) ? SCAN_VLD : -1;
+		return (w & (size == 2 ? 0x30 : 0x10)) ? SCAN_VLD : -1;
+	}
+
+	// multiple structures, an align of 0 is always valid
+	*fixable = 1;
+	return (w & 0x30) ? SCAN_VLD : -1;
+}
+
+static int so_scan_classify_arm(uint32_t w, int *fixable) {
+	int rn = (w >> 16) & 0xF;
+	*fixable = 0;
+
+	if ((w & 0xFF300000) == 0xF4200000)
+		return so_scan_vld(w, fixable);
+	if ((w >> 28) == 0xF)
+		return -1;
+
+	if ((w & 0x0E500000) == 0x08100000) {
+		if (rn == 13)
+			return -1; // stack is always word aligned
+		// LDMIA without writeback, same rule so_symbol_fix_ldmia always used
+		*fixable = (w & 0xFFF00000) == 0xE8900000 && rn < 13;
+		return SCAN_LDM;
+	}
+
+	if ((w & 0x0E1000F0) == 0x000000D0 && ((w >> 21) & 9) != 1) {
+		int rt = (w >> 12) & 0xF;
+		if (rn == 13 || rn == 15)
+			return -1;
+		// LDRD Rt, [Rn, #imm] with an even Rt below R12
+		*fixable = (w >> 28) == 0xE && (w & 0x01600000) == 0x01400000 && !(rt & 1) && rt < 12;
+		return SCAN_LDRD;
+	}
+
+	return -1;
+}
+
+static int so_scan_classify_thumb(uint16_t hw1, uint16_t hw2, int *fixable) {
+	int rn = hw1 & 0xF;
+	*fixable = 0;
+
+	if ((hw1 & 0xF800) == 0xC800)
+		return SCAN_LDM; // 16-bit, too short to branch out of
+	if ((hw1 & 0xFF30) == 0xF920)
+		return so_scan_vld(0xF4000000 | ((hw1 & 0xFF) << 16) | hw2, fixable);
+
+	if ((hw1 & 0xFFD0) == 0xE890 || (hw1 & 0xFFD0) == 0xE910) {
+		if (rn == 13)
+			return -1;
+		*fixable = !(hw1 & 0x20) && rn < 13 && !(hw2 & 0xA000);
+		return SCAN_LDM;
+	}
+
+	if ((hw1 & 0xFE50) == 0xE850 && (hw1 & 0x0120)) {
+		int rt = hw2 >> 12, rt2 = (hw2 >> 8) & 0xF;
+		if (rn == 13 || rn == 15)
+			return -1;
+		// The trampoline's LDR.W only reaches 255 bytes below Rn
+		*fixable = (hw1 & 0x0120) == 0x0100 && rt < 13 && rt2 < 13 && rt != rt2 && ((hw1 & 0x80) || (hw2 & 0xFF) * 4 <= 255);
+		return SCAN_LDRD;
+	}
+
+	return -1;
+}
+
+int so_scan_decode(so_scan_site *site, uintptr_t addr, int thumb) {
+	int fixable, kind;
+	if (thumb) {
+		uint16_t hw1 = *(uint16_t *)addr;
+		uint16_t hw2 = (hw1 & 0xF800) >= 0xE800 ? *(uint16_t *)(addr + 2) : 0;
+		kind = so_scan_classify_thumb(hw1, hw2, &fixable);
+		site->instr = hw1 | (hw2 << 16);
+	} else {
+		site->instr = *(uint32_t *)addr;
+		kind = so_scan_classify_arm(site->instr, &fixable);
+	}
+
+	site->addr = addr;
+	site->kind = kind;
+	site->thumb = thumb;
+	site->fixable = kind >= 0 && fixable;
+	return kind;
+}
+
+int so_scan_arm(so_scan *s, const uint32_t *code, size_t size, uintptr_t vaddr) {
+	size_t n = size / 4;
+	int found = s->num_sites;
+
+	if (so_scan_reserve(s, n) < 0)
+		return 0;
+
+	for (size_t i = 0; i < n; i++) {
+		uint32_t w = code[i];
+		uintptr_t pc = vaddr + i * 4 + 8;
+		if (BIT_TEST(s->lit, i) || (w >> 28) == 0xF)
+			continue;
+
+		int sign = (w & 0x00800000) ? 1 : -1;
+		if ((w & 0x0F3F0000) == 0x051F0000) // LDR/LDRB Rt, [PC, #imm12]
+			so_scan_mark(s->lit, n, vaddr, pc + sign * (int)(w & 0xFFF), 4, 2);
+		else if ((w & 0x0F7F00F0) == 0x014F00D0) // LDRD Rt, [PC, #imm8]
+			so_scan_mark(s->lit, n, vaddr, pc + sign * (int)(((w >> 4) & 0xF0) | (w & 0xF)), 8, 2);
+		else if ((w & 0x0F3F0E00) == 0x0D1F0A00) // VLDR Sd/Dd, [PC, #imm8]
+			so_scan_mark(s->lit, n, vaddr, pc + sign * (int)((w & 0xFF) * 4), (w & 0x100) ? 8 : 4, 2);
+	}
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		s->cand[i >> 5] |= so_prefilter_arm(&code[i]) << (i & 31);
+	for (; i < n; i++) {
+		for (int p = 0; p < ARM_PATTERNS; p++) {
+			if ((code[i] & arm_masks[p]) == arm_values[p])
+				BIT_SET(s->cand, i);
+		}
+	}
+
+	for (i = 0; i < n; i += 32) {
+		uint32_t hits = s->cand[i >> 5] & ~s->lit[i >> 5];
+		while (hits) {
+			size_t j = i + __builtin_ctz(hits);
+			int fixable;
+			int kind = so_scan_classify_arm(code[j], &fixable);
+			if (kind >= 0)
+				so_scan_add(s, vaddr + j * 4, code[j], kind, 0, fixable);
+			hits &= hits - 1;
+		}
+	}
+
+	return s->num_sites - found;
+}
+
+int so_scan_thumb(so_scan *s, const uint16_t *code, size_t size, uintptr_t vaddr) {
+	size_t n = size / 2;
+	int found = s->num_sites;
+
+	if (so_scan_reserve(s, n) < 0)
+		return 0;
+
+	for (size_t i = 0; i < n;) {
+		uint16_t hw1 = code[i];
+		uintptr_t pc = ((vaddr + i * 2) + 4) & ~3;
+		if (BIT_TEST(s->lit, i)) {
+			i++;
+			continue;
+		}
+		if ((hw1 & 0xF800) < 0xE800) {
+			if ((hw1 & 0xF800) == 0x4800) // LDR Rt, [PC, #imm8]
+				so_scan_mark(s->lit, n, vaddr, pc + (hw1 & 0xFF) * 4, 4, 1);
+			i++;
+			continue;
+		}
+		if (i + 1 >= n)
+			break;
+
+		uint16_t hw2 = code[i + 1];
+		int sign = (hw1 & 0x80) ? 1 : -1;
+		if ((hw1 & 0xFF7F) == 0xF85F) // LDR.W Rt, [PC, #imm12]
+			so_scan_mark(s->lit, n, vaddr, pc + sign * (int)(hw2 & 0xFFF), 4, 1);
+		else if ((hw1 & 0xFF7F) == 0xE95F) // LDRD Rt, Rt2, [PC, #imm8]
+			so_scan_mark(s->lit, n, vaddr, pc + sign * (int)((hw2 & 0xFF) * 4), 8, 1);
+		else if ((hw1 & 0xFF3F) == 0xED1F && (hw2 & 0x0E00) == 0x0A00) // VLDR Sd/Dd, [PC, #imm8]
+			so_scan_mark(s->lit, n, vaddr, pc + sign * (int)((hw2 & 0xFF) * 4), (hw2 & 0x100) ? 8 : 4, 1);
+		i += 2;
+	}
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		s->cand[i >> 5] |= so_prefilter_thumb(&code[i]) << (i & 31);
+	for (; i < n; i++) {
+		for (int p = 0; p < THUMB_PATTERNS; p++) {
+			if ((code[i] & thumb_masks[p]) == thumb_values[p])
+				BIT_SET(s->cand, i);
+		}
+	}
+
+	int it = 0;
+	for (i = 0; i < n;) {
+		uint16_t hw1 = code[i];
+		int wide = (hw1 & 0xF800) >= 0xE800;
+		if (BIT_TEST(s->lit, i)) {
+			i++;
+			continue;
+		}
+		if (wide && i + 1 >= n)
+			break;
+
+		// Sites inside an IT block can't be replaced by an unconditional branch
+		int in_it = it > 0;
+		if (it)
+			it--;
+		if ((hw1 & 0xFF00) == 0xBF00 && (hw1 & 0xF))
+			it = 4 - __builtin_ctz(hw1 & 0xF);
+
+		if (BIT_TEST(s->cand, i)) {
+			uint16_t hw2 = wide ? code[i + 1] : 0;
+			int fixable;
+			int kind = so_scan_classify_thumb(hw1, hw2, &fixable);
+			if (kind >= 0)
+				so_scan_add(s, vaddr + i * 2, hw1 | (hw2 << 16), kind, 1, fixable && (kind == SCAN_VLD || !in_it));
+		}
+		i += wide ? 2 : 1;
+	}
+
+	return s->num_sites - found;
+}
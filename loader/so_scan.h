@@ -0,0 +1,40 @@
+#ifndef __SO_SCAN_H__
+#define __SO_SCAN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Instructions that fault on unaligned data even with SCTLR.A cleared
+enum {
+  SCAN_LDM, // LDM/LDMIA/LDMDB (ARM, Thumb-2 and 16-bit Thumb)
+  SCAN_LDRD, // LDRD (immediate and register forms)
+  SCAN_VLD, // VLDn with an alignment qualifier
+};
+
+typedef struct {
+  uintptr_t addr;
+  uint32_t instr; // raw encoding, Thumb-2 as hw1 | hw2 << 16
+  uint8_t kind;
+  uint8_t thumb;
+  uint8_t fixable; // can be rewritten in place or through a trampoline
+} so_scan_site;
+
+typedef struct {
+  so_scan_site *sites;
+  int num_sites, cap_sites;
+  uint32_t *lit; // literal pool words/halfwords of the function being scanned
+  uint32_t *cand; // prefilter hits of the function being scanned
+  size_t cap_bits;
+} so_scan;
+
+void so_scan_init(so_scan *s);
+void so_scan_free(so_scan *s);
+
+// Classifies a single instruction (Thumb IT blocks aren't known here), returns its SCAN_* kind or -1
+int so_scan_decode(so_scan_site *site, uintptr_t addr, int thumb);
+
+// Both return the number of sites appended to s->sites, vaddr is where code runs from
+int so_scan_arm(so_scan *s, const uint32_t *code, size_t size, uintptr_t vaddr);
+int so_scan_thumb(so_scan *s, const uint16_t *code, size_t size, uintptr_t vaddr);
+
+#endif
@@ -6,20 +6,25 @@
  * of the MIT license.	See the LICENSE file for details.
  */
 
-#include <vitasdk.h>
-#include <kubridge.h>
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <zlib.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
 
+#include "so_platform.h"
+#ifdef SO_HOST
+int debugPrintf(char *text, ...);
+int ret0();
+#else
 #include "main.h"
+#endif
 #include "dialog.h"
 #include "so_util.h"
-
-#ifndef SCE_KERNEL_MEMBLOCK_TYPE_USER_RX
-#define SCE_KERNEL_MEMBLOCK_TYPE_USER_RX                 (0x0C20D050)
-#endif
+#include "so_scan.h"
 
 typedef struct b_enc {
 	union {
@@ -52,23 +57,459 @@ typedef struct ldst_enc {
 } ldst_enc;
 
 #define B_RANGE ((1 << 24) - 1)
-#define B_OFFSET(x) (x + 8) // branch jumps into addr - 8, so range is biased forward
+#define B_OFFSET(x) ((uintptr_t)(x) + 8) // branch jumps into addr - 8, so range is biased forward
 #define B(PC, DEST) ((b_enc){.bits = {.cond = 0b1110, .enc = 0b101, .l = 0, .imm24 = (((intptr_t)DEST-(intptr_t)PC) / 4) - 2}})
 #define LDR_OFFS(RT, RN, IMM) ((ldst_enc){.bits = {.cond = 0b1110, .enc = 0b010, .p = 1, .u = (IMM >= 0), .b = 0, .w = 0, .bit20_1 = 1, .rn = RN, .rt = RT, .imm12 = (IMM >= 0) ? IMM : -IMM}})
 
+#define T_B_RANGE ((1 << 24) - 2)
+// B.W encoding (T4), J1/J2 hold I1/I2 inverted and xor'ed with the sign
+#define T_B(HW, PC, DEST) do { \
+	int32_t off = (intptr_t)(DEST) - ((intptr_t)(PC) + 4); \
+	uint32_t s = (off >> 24) & 1; \
+	(HW)[0] = 0xf000 | (s << 10) | ((off >> 12) & 0x3FF); \
+	(HW)[1] = 0x9000 | ((~((off >> 23) ^ s) & 1) << 13) | ((~((off >> 22) ^ s) & 1) << 11) | ((off >> 1) & 0x7FF); \
+} while (0)
+
 #define PATCH_SZ 0x10000 //64 KB-ish arenas
 static so_module *head = NULL, *tail = NULL;
 
+// Relocated-image cache: outcome of so_relocate, so_resolve and hooking for a given .so
+#define CACHE_MAGIC 0x31434F53 // SOC1
+
+enum {
+	CACHE_ADD_BASE, // *ptr += text_base + value
+	CACHE_SET_BASE, // *ptr = text_base + value
+	CACHE_IMPORT, // *ptr = default_dynlib[value].func
+	CACHE_VGL, // *ptr = vglGetProcAddress(dynstr + value)
+	CACHE_LINK, // *ptr = so_resolve_link(dynstr + value)
+	CACHE_LINK_ADD, // *ptr += so_resolve_link(dynstr + value)
+	CACHE_PLT0, // *ptr = plt0_stub
+	CACHE_LAZY, // *ptr = so_lazy_stub
+	CACHE_VGL_PLT, // CACHE_VGL for a JUMP_SLOT, plt0_stub if vitaGL doesn't have it
+};
+
+#define CACHE_OFFSET_MASK 0x0FFFFFFF
+#define CACHE_KIND_SHIFT 28
+
+typedef struct {
+	uint32_t info; // offset from text_base | kind << CACHE_KIND_SHIFT
+	uint32_t value;
+} so_cache_patch;
+
+typedef struct {
+	uint32_t magic;
+	uint8_t sha1[SHA1_BLOCK_SIZE];
+	uint32_t dynlib_sig;
+	uint32_t hooks_sig;
+	uint32_t num_patches;
+	uint32_t num_hooks;
+	uint32_t num_fixes;
+} so_cache_header;
+
+static so_module *cache_mod = NULL;
+static so_cache_patch *cache_patches = NULL;
+static uint32_t *cache_hooks = NULL, *cache_fixes = NULL;
+static int cache_num_patches, cache_cap_patches, cache_num_hooks, cache_num_fixes, cache_cap_fixes;
+static uint32_t cache_dynlib_sig, cache_hooks_sig;
+
+static void so_cache_record(so_module *mod, uint32_t offset, int kind, uint32_t value) {
+	if (mod != cache_mod)
+		return;
+	if (cache_num_patches == cache_cap_patches) {
+		cache_cap_patches = cache_cap_patches ? cache_cap_patches * 2 : 0x4000;
+		cache_patches = realloc(cache_patches, cache_cap_patches * sizeof(so_cache_patch));
+	}
+	cache_patches[cache_num_patches].info = (offset & CACHE_OFFSET_MASK) | (kind << CACHE_KIND_SHIFT);
+	cache_patches[cache_num_patches].value = value;
+	cache_num_patches++;
+}
+
+// Misaligned load fixes, kind is SCAN_* | thumb << 2 (plain offsets are ARM LDMIA fixes)
+static void so_cache_record_fix(so_module *mod, uintptr_t addr, int kind) {
+	if (mod != cache_mod)
+		return;
+	if (cache_num_fixes == cache_cap_fixes) {
+		cache_cap_fixes = cache_cap_fixes ? cache_cap_fixes * 2 : 64;
+		cache_fixes = realloc(cache_fixes, cache_cap_fixes * sizeof(uint32_t));
+	}
+	cache_fixes[cache_num_fixes++] = ((addr - mod->text_base) & CACHE_OFFSET_MASK) | (kind << CACHE_KIND_SHIFT);
+}
+
+// Target an import slot was bound to, so_rebind takes it back out of ABS32 slots
+typedef struct so_rebind_note {
+	uint32_t offset;
+	uintptr_t target;
+} so_rebind_note;
+
+static void so_rebind_note_add(so_module *mod, uint32_t offset, uintptr_t target) {
+	// so_resolve may bind a slot twice in a row, the last target is the one in it
+	if (mod->num_rebind_notes && mod->rebind_notes[mod->num_rebind_notes - 1].offset == offset) {
+		mod->rebind_notes[mod->num_rebind_notes - 1].target = target;
+		return;
+	}
+	if (mod->num_rebind_notes == mod->cap_rebind_notes) {
+		mod->cap_rebind_notes = mod->cap_rebind_notes ? mod->cap_rebind_notes * 2 : 256;
+		mod->rebind_notes = realloc(mod->rebind_notes, mod->cap_rebind_notes * sizeof(so_rebind_note));
+	}
+	mod->rebind_notes[mod->num_rebind_notes].offset = offset;
+	mod->rebind_notes[mod->num_rebind_notes].target = target;
+	mod->num_rebind_notes++;
+}
+
+static so_arena *so_arena_add(so_module *mod, SceUID blockid, uintptr_t base, size_t size);
+static Elf32_Rel *so_lazy_find(so_module *mod, uintptr_t got);
+static void so_global_add(so_module *mod);
+
+static so_module *so_module_from_addr(uintptr_t addr) {
+	for (so_module *curr = head; curr; curr = curr->next) {
+		if (addr >= curr->text_base && addr < curr->text_base + curr->text_size)
+			return curr;
+	}
+	return NULL;
+}
+
+/*
+ * Patch transactions: between so_patch_begin and so_patch_commit, code writes
+ * (hooks, trampolines, LDMIA fixes) are queued instead of going to the kernel one
+ * by one. Commit coalesces them into spans, writes each span with a single
+ * unrestricted copy and flushes only the cache lines the spans cover.
+ */
+#define PATCH_COALESCE_GAP 0x400 // unpatched bytes worth re-copying to save a kernel call
+#define CACHE_LINE_SZ 32
+
+typedef struct {
+	uintptr_t addr;
+	uint32_t size;
+	uint32_t offs; // into patch_tx.data
+} so_patch;
+
+static struct {
+	so_module *mod;
+	so_patch *patches;
+	int num, cap;
+	uint8_t *data;
+	size_t data_size, data_cap;
+} patch_tx;
+
+static void so_patch_write(uintptr_t addr, const void *data, size_t size) {
+	// Outside a transaction writes land right away, so a trampoline is live before the branch into it
+	if (!patch_tx.mod) {
+		so_memcpy_rx((void *)addr, data, size);
+		so_flush_rx((void *)addr, size);
+		return;
+	}
+
+	if (patch_tx.num == patch_tx.cap) {
+		patch_tx.cap = patch_tx.cap ? patch_tx.cap * 2 : 256;
+		patch_tx.patches = realloc(patch_tx.patches, patch_tx.cap * sizeof(so_patch));
+	}
+	if (patch_tx.data_size + size > patch_tx.data_cap) {
+		patch_tx.data_cap = patch_tx.data_cap ? patch_tx.data_cap * 2 : 0x4000;
+		if (patch_tx.data_cap < patch_tx.data_size + size)
+			patch_tx.data_cap = patch_tx.data_size + size;
+		patch_tx.data = realloc(patch_tx.data, patch_tx.data_cap);
+	}
+
+	so_patch *p = &patch_tx.patches[patch_tx.num++];
+	p->addr = addr;
+	p->size = size;
+	p->offs = patch_tx.data_size;
+	memcpy(patch_tx.data + patch_tx.data_size, data, size);
+	patch_tx.data_size += size;
+}
+
+void so_patch_begin(so_module *mod) {
+	patch_tx.mod = mod;
+	patch_tx.num = 0;
+	patch_tx.data_size = 0;
+}
+
+static int so_patch_cmp_addr(const void *a, const void *b) {
+	const so_patch *pa = a, *pb = b;
+	if (pa->addr != pb->addr)
+		return pa->addr < pb->addr ? -1 : 1;
+	return pa->offs < pb->offs ? -1 : 1;
+}
+
+static int so_patch_cmp_queue(const void *a, const void *b) {
+	// Patch data is appended as patches get queued, so offs gives queue order
+	return ((const so_patch *)a)->offs < ((const so_patch *)b)->offs ? -1 : 1;
+}
+
+int so_patch_commit(so_module *mod) {
+	if (patch_tx.mod != mod)
+		return -1;
+	patch_tx.mod = NULL;
+
+#ifdef DEBUG
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+#endif
+	int num_writes = 0;
+	size_t written = 0, flushed = 0;
+
+	qsort(patch_tx.patches, patch_tx.num, sizeof(so_patch), so_patch_cmp_addr);
+
+	for (int i = 0; i < patch_tx.num;) {
+		// Grow the span while the next patch overlaps or sits close enough
+		uintptr_t span_start = patch_tx.patches[i].addr;
+		uintptr_t span_end = span_start + patch_tx.patches[i].size;
+		int j = i + 1;
+		for (; j < patch_tx.num && patch_tx.patches[j].addr <= span_end + PATCH_COALESCE_GAP; j++) {
+			if (patch_tx.patches[j].addr + patch_tx.patches[j].size > span_end)
+				span_end = patch_tx.patches[j].addr + patch_tx.patches[j].size;
+		}
+
+		// Start from current contents so gaps are rewritten unchanged, then apply patches in queue order
+		size_t span_size = span_end - span_start;
+		uint8_t *span = malloc(span_size);
+		memcpy(span, (void *)span_start, span_size);
+		qsort(&patch_tx.patches[i], j - i, sizeof(so_patch), so_patch_cmp_queue);
+		for (int k = i; k < j; k++)
+			memcpy(span + (patch_tx.patches[k].addr - span_start), patch_tx.data + patch_tx.patches[k].offs, patch_tx.patches[k].size);
+		so_memcpy_rx((void *)span_start, span, span_size);
+		free(span);
+
+		uintptr_t line_start = span_start & ~(CACHE_LINE_SZ - 1);
+		uintptr_t line_end = ALIGN_MEM(span_end, CACHE_LINE_SZ);
+		so_flush_rx((void *)line_start, line_end - line_start);
+
+		num_writes++;
+		written += span_size;
+		flushed += line_end - line_start;
+		i = j;
+	}
+
+#ifdef DEBUG
+	printf("patch commit: %d patches, %d writes (%zu bytes), %zu bytes flushed in %llu us.\n",
+		patch_tx.num, num_writes, written, flushed, sceKernelGetProcessTimeWide() - start);
+#endif
+
+	free(patch_tx.patches);
+	free(patch_tx.data);
+	memset(&patch_tx, 0, sizeof(patch_tx));
+	return num_writes;
+}
+
+/*
+ * Trampolines: the instructions a hook overwrites are relocated into the patch arena,
+ * followed by a jump back to the rest of the original function, so SO_CONTINUE can call
+ * the original without unpatching it. PC-relative instructions are rewritten to absolute
+ * literal loads/jumps; anything that can't be safely moved (conditional branches, IT
+ * blocks, other PC operands) makes the hook fall back to the unpatch/call/repatch path.
+ */
+#define TRAMPOLINE_ARM_SZ (10 * sizeof(uint32_t))
+#define TRAMPOLINE_THUMB_SZ (64 * sizeof(uint16_t))
+
+#define ARM_LDR_LIT(RT) (0xe59f0000 | ((RT) << 12)) // LDR RT, [PC, #0]
+#define ARM_B_SKIP 0xea000000 // B PC+8 (skips one literal)
+#define ARM_LDR_DEREF(RT) (0xe5900000 | ((RT) << 16) | ((RT) << 12)) // LDR RT, [RT]
+#define ARM_ADD_LR_PC4 0xe28fe004 // ADD LR, PC, #4
+#define ARM_LDR_PC 0xe51ff004 // LDR PC, [PC, #-0x4]
+
+static uintptr_t so_trampoline_arm(so_module *mod, uintptr_t addr, size_t *size) {
+	uint32_t code[TRAMPOLINE_ARM_SZ / sizeof(uint32_t)];
+	int n = 0;
+
+	for (uintptr_t pc = addr; pc < addr + 8; pc += 4) {
+		uint32_t ins = *(uint32_t *)pc;
+		uint32_t cond = ins >> 28;
+		int rn = (ins >> 16) & 0xF, rd = (ins >> 12) & 0xF;
+
+		if ((ins & 0x0E000000) == 0x0A000000 && (cond == 0xE || cond == 0xF)) {
+			// B/BL/BLX <imm>
+			uintptr_t target = pc + 8 + ((int32_t)(ins << 8) >> 6);
+			if (cond == 0xF)
+				target += ((ins >> 23) & 2) | 1;
+			if (cond == 0xF || (ins & 0x01000000))
+				code[n++] = ARM_ADD_LR_PC4;
+			code[n++] = ARM_LDR_PC;
+			code[n++] = target;
+		} else if (cond == 0xF || (ins & 0x0E000000) == 0x0A000000) {
+			return 0; // conditional branches, unconditional space
+		} else if ((ins & 0x0F7F0000) == 0x051F0000 && cond == 0xE && rd != 15) {
+			// LDR Rt, [PC, #+/-imm12]
+			uintptr_t lit = pc + 8 + ((ins & 0x00800000) ? (ins & 0xFFF) : -(ins & 0xFFF));
+			code[n++] = ARM_LDR_LIT(rd);
+			code[n++] = ARM_B_SKIP;
+			code[n++] = lit;
+			code[n++] = ARM_LDR_DEREF(rd);
+		} else if (((ins & 0x0FFF0000) == 0x028F0000 || (ins & 0x0FFF0000) == 0x024F0000) && cond == 0xE && rd != 15) {
+			// ADR Rd, <label> (ADD/SUB Rd, PC, #imm)
+			uint32_t rot = ((ins >> 8) & 0xF) * 2, imm = ins & 0xFF;
+			imm = rot ? ((imm >> rot) | (imm << (32 - rot))) : imm;
+			code[n++] = ARM_LDR_LIT(rd);
+			code[n++] = ARM_B_SKIP;
+			code[n++] = (ins & 0x00800000) ? pc + 8 + imm : pc + 8 - imm;
+		} else {
+			int cls = (ins >> 25) & 7;
+			int movw = (ins & 0x0FB00000) == 0x03000000;
+			if ((cls <= 3 && !movw && rn == 15) || ((cls == 0 || cls == 3) && (ins & 0xF) == 15) || ((cls == 4 || cls == 6) && rn == 15))
+				return 0; // Some other PC operand, VLDR/LDC literals included
+			code[n++] = ins;
+		}
+	}
+
+	code[n++] = ARM_LDR_PC;
+	code[n++] = addr + 8;
+
+	uintptr_t tramp = so_alloc_arena(mod, (uintptr_t)NULL, (uintptr_t)NULL, n * sizeof(uint32_t));
+	if (!tramp)
+		return 0;
+	so_patch_write(tramp, code, n * sizeof(uint32_t));
+	*size = n * sizeof(uint32_t);
+	return tramp;
+}
+
+typedef struct {
+	uintptr_t base;
+	uint16_t code[TRAMPOLINE_THUMB_SZ / sizeof(uint16_t)];
+	int n;
+} thumb_emitter;
+
+static void t_emit(thumb_emitter *t, uint16_t hw) {
+	t->code[t->n++] = hw;
+}
+
+static void t_align(thumb_emitter *t) {
+	if ((t->base + t->n * 2) & 2)
+		t_emit(t, 0xbf00); // NOP
+}
+
+static void t_word(thumb_emitter *t, uint32_t w) {
+	t_emit(t, w & 0xFFFF);
+	t_emit(t, w >> 16);
+}
+
+// LDR.W RT, =value (literal stored inline and jumped over)
+static void t_load_const(thumb_emitter *t, int rt, uint32_t value) {
+	t_align(t);
+	t_emit(t, 0xf8df);
+	t_emit(t, (rt << 12) | 4); // LDR.W RT, [PC, #4]
+	t_emit(t, 0xe002); // B.N over the literal
+	t_emit(t, 0xbf00);
+	t_word(t, value);
+}
+
+static void t_jump(thumb_emitter *t, uint32_t target) {
+	t_align(t);
+	t_emit(t, 0xf8df);
+	t_emit(t, 0xf000); // LDR.W PC, [PC, #0]
+	t_word(t, target);
+}
+
+// LDR.W Rt, [Rn, #imm], imm in [-255, 4095]
+static void t_ldr(thumb_emitter *t, int rt, int rn, int imm) {
+	if (imm >= 0) {
+		t_emit(t, 0xf8d0 | rn);
+		t_emit(t, (rt << 12) | imm);
+	} else {
+		t_emit(t, 0xf850 | rn);
+		t_emit(t, (rt << 12) | 0xc00 | -imm);
+	}
+}
+
+static uintptr_t so_trampoline_thumb(so_module *mod, uintptr_t addr, size_t len, size_t *size) {
+	thumb_emitter t;
+	uintptr_t pc = addr;
+
+	t.base = so_alloc_arena(mod, (uintptr_t)NULL, (uintptr_t)NULL, TRAMPOLINE_THUMB_SZ);
+	t.n = 0;
+	if (!t.base)
+		return 0;
+
+	while (pc < addr + len) {
+		uint16_t hw1 = *(uint16_t *)pc;
+		uintptr_t pc_align = (pc + 4) & ~3;
+
+		if ((hw1 & 0xF800) < 0xE800) {
+			// 16-bit instructions
+			if ((hw1 & 0xF800) == 0x4800) {
+				// LDR Rt, [PC, #imm8]
+				int rt = (hw1 >> 8) & 7;
+				t_load_const(&t, rt, pc_align + (hw1 & 0xFF) * 4);
+				t_emit(&t, 0xf8d0 | rt);
+				t_emit(&t, rt << 12); // LDR.W Rt, [Rt]
+			} else if ((hw1 & 0xF800) == 0xA000) {
+				// ADR Rd, <label>
+				t_load_const(&t, (hw1 >> 8) & 7, pc_align + (hw1 & 0xFF) * 4);
+			} else if ((hw1 & 0xF800) == 0xE000) {
+				// B.N <label>
+				t_jump(&t, (pc + 4 + ((int32_t)((uint32_t)hw1 << 21) >> 20)) | 1);
+			} else if ((hw1 & 0xF000) == 0xD000 || (hw1 & 0xF500) == 0xB100 || ((hw1 & 0xFF00) == 0xBF00 && (hw1 & 0xF))) {
+				goto err; // B<cond>, CBZ/CBNZ, IT
+			} else if ((hw1 & 0xFC00) == 0x4400 && (((hw1 >> 3) & 0xF) == 15 || (((hw1 >> 4) & 8) | (hw1 & 7)) == 15) && (hw1 & 0xFF00) != 0x4700) {
+				goto err; // ADD/CMP/MOV with PC
+			} else if ((hw1 & 0xFF00) == 0x4700 && ((hw1 >> 3) & 0xF) == 15) {
+				goto err; // BX/BLX PC
+			} else {
+				t_emit(&t, hw1);
+			}
+			pc += 2;
+			continue;
+		}
+
+		// 32-bit instructions
+		uint16_t hw2 = *(uint16_t *)(pc + 2);
+		if ((hw1 & 0xF800) == 0xF000 && (hw2 & 0x8000)) {
+			if ((hw2 & 0x5000) == 0) // B<cond>.W, misc control
+				goto err;
+			uint32_t s = (hw1 >> 10) & 1;
+			uint32_t i1 = !(((hw2 >> 13) & 1) ^ s), i2 = !(((hw2 >> 11) & 1) ^ s);
+			int32_t imm = (s << 24) | (i1 << 23) | (i2 << 22) | ((hw1 & 0x3FF) << 12) | ((hw2 & 0x7FF) << 1);
+			imm = (imm << 7) >> 7;
+			uint32_t target = (hw2 & 0x1000) ? ((pc + 4 + imm) | 1) : ((pc_align + imm) & ~3);
+			if (hw2 & 0x4000) {
+				// BL/BLX: return into the trampoline, right past the jump
+				t_align(&t);
+				t_load_const(&t, 14, (t.base + t.n * 2 + 12 + 8) | 1);
+			}
+			t_jump(&t, target);
+		} else if ((hw1 & 0xFF7F) == 0xF85F && (hw2 >> 12) != 15) {
+			// LDR.W Rt, [PC, #+/-imm12]
+			int rt = hw2 >> 12;
+			t_load_const(&t, rt, (hw1 & 0x80) ? pc_align + (hw2 & 0xFFF) : pc_align - (hw2 & 0xFFF));
+			t_emit(&t, 0xf8d0 | rt);
+			t_emit(&t, rt << 12);
+		} else if (((hw1 & 0xFE00) == 0xE800 || (hw1 & 0xFE00) == 0xF800 || (hw1 & 0xEE00) == 0xEC00 || (hw1 & 0xFBFF) == 0xF20F || (hw1 & 0xFBFF) == 0xF2AF) && (hw1 & 0xF) == 15) {
+			goto err; // Other loads (VLDR/LDC literals too), TBB/TBH or ADR.W off PC
+		} else {
+			t_emit(&t, hw1);
+			t_emit(&t, hw2);
+		}
+		pc += 4;
+	}
+
+	t_jump(&t, pc | 1);
+
+	// Give back the unused part of the worst-case allocation
+	*size = ALIGN_MEM(t.n * 2, 4);
+	so_free_arena(mod, t.base + *size, TRAMPOLINE_THUMB_SZ - *size);
+
+	so_patch_write(t.base, t.code, t.n * 2);
+	return t.base | 1;
+
+err:
+	so_free_arena(mod, t.base, TRAMPOLINE_THUMB_SZ);
+	return 0;
+}
+
 so_hook hook_thumb(uintptr_t addr, uintptr_t dst) {
 	so_hook h;
+	memset(&h, 0, sizeof(h));
 	printf("THUMB HOOK\n");
 	if (addr == 0)
-		return;
+		return h;
 	h.thumb_addr = addr;
 	addr &= ~1;
+
+	so_module *mod = so_module_from_addr(addr);
+	if (mod)
+		h.trampoline = so_trampoline_thumb(mod, addr, (addr & 2) ? 10 : 8, &h.trampoline_size);
+
 	if (addr & 2) {
 		uint16_t nop = 0xbf00;
-		kuKernelCpuUnrestrictedMemcpy((void *)addr, &nop, sizeof(nop));
+		h.orig_pad = *(uint16_t *)addr;
+		so_patch_write(addr, &nop, sizeof(nop));
 		addr += 2;
 		printf("THUMB UNALIGNED\n");
 	}
@@ -76,138 +517,416 @@ so_hook hook_thumb(uintptr_t addr, uintptr_t dst) {
 	h.addr = addr;
 	h.patch_instr[0] = 0xf000f8df; // LDR PC, [PC]
 	h.patch_instr[1] = dst;
-	kuKernelCpuUnrestrictedMemcpy(&h.orig_instr, (void *)addr, sizeof(h.orig_instr));
-	kuKernelCpuUnrestrictedMemcpy((void *)addr, h.patch_instr, sizeof(h.patch_instr));
+	so_memcpy_rx(&h.orig_instr, (void *)addr, sizeof(h.orig_instr));
+	so_patch_write(addr, h.patch_instr, sizeof(h.patch_instr));
 
 	return h;
 }
 
 so_hook hook_arm(uintptr_t addr, uintptr_t dst) {
+	so_hook h;
+	memset(&h, 0, sizeof(h));
 	printf("ARM HOOK\n");
 	if (addr == 0)
-		return;
-	uint32_t hook[2];
-	so_hook h;
+		return h;
 	h.thumb_addr = 0;
 	h.addr = addr;
+
+	so_module *mod = so_module_from_addr(addr);
+	if (mod)
+		h.trampoline = so_trampoline_arm(mod, addr, &h.trampoline_size);
+
 	h.patch_instr[0] = 0xe51ff004; // LDR PC, [PC, #-0x4]
 	h.patch_instr[1] = dst;
-	kuKernelCpuUnrestrictedMemcpy(&h.orig_instr, (void *)addr, sizeof(h.orig_instr));
-	kuKernelCpuUnrestrictedMemcpy((void *)addr, h.patch_instr, sizeof(h.patch_instr));
+	so_memcpy_rx(&h.orig_instr, (void *)addr, sizeof(h.orig_instr));
+	so_patch_write(addr, h.patch_instr, sizeof(h.patch_instr));
 
 	return h;
 }
 
 so_hook hook_addr(uintptr_t addr, uintptr_t dst) {
-	if (addr == 0)
-		return;
+	if (addr == 0) {
+		so_hook h;
+		memset(&h, 0, sizeof(h));
+		return h;
+	}
 	if (addr & 1)
 		return hook_thumb(addr, dst);
 	else
 		return hook_arm(addr, dst);
 }
 
+void unhook(so_hook *h) {
+	if (!h->addr)
+		return;
+
+	so_patch_write(h->addr, h->orig_instr, sizeof(h->orig_instr));
+	if (h->thumb_addr && (h->thumb_addr & ~1) != h->addr)
+		so_patch_write(h->thumb_addr & ~1, &h->orig_pad, sizeof(h->orig_pad));
+
+	so_module *mod = so_module_from_addr(h->addr);
+	if (mod && h->trampoline)
+		so_free_arena(mod, h->trampoline & ~1, h->trampoline_size);
+
+	memset(h, 0, sizeof(so_hook));
+}
+
 void so_flush_caches(so_module *mod) {
-	kuKernelFlushCaches((void *)mod->text_base, mod->text_size);
+	so_flush_rx((void *)mod->text_base, mod->text_size);
+}
+
+/*
+ * so_stream: sequential reader over a .so file or memory buffer. Every byte goes
+ * through it exactly once, in file order, so the module can be hashed while it's
+ * being loaded and segment data can be read straight into its final memblock.
+ */
+#define STREAM_CHUNK_SZ 0x40000 // 256 KB bounce buffer for RX segments and skipped bytes
+
+/*
+ * so_inflate: gzip decompression for so_stream. A reader thread on another core
+ * keeps a ring of compressed buffers filled from the memory card while the
+ * loading thread inflates straight into the destination (segment memblocks for
+ * RW data, the bounce buffer for RX).
+ */
+#define INFLATE_BUF_SZ 0x20000 // 128 KB of compressed input per read
+#define INFLATE_NUM_BUFS 4
+
+typedef struct {
+	z_stream zs;
+	SceUID fd;
+	SceUID thid, sema_full, sema_empty;
+	uint8_t *bufs[INFLATE_NUM_BUFS];
+	int lens[INFLATE_NUM_BUFS];
+	int head, tail; // next buffer to inflate / to fill
+	int held; // the loading thread is still inflating bufs[head - 1]
+	volatile int abort;
+} so_inflate;
+
+static int so_inflate_thread(SceSize args, void *argp) {
+	so_inflate *z = *(so_inflate **)argp;
+	for (;;) {
+		sceKernelWaitSema(z->sema_empty, 1, NULL);
+		if (z->abort)
+			break;
+
+		int n = sceIoRead(z->fd, z->bufs[z->tail], INFLATE_BUF_SZ);
+		z->lens[z->tail] = n;
+		z->tail = (z->tail + 1) % INFLATE_NUM_BUFS;
+		sceKernelSignalSema(z->sema_full, 1);
+		if (n <= 0)
+			break;
+	}
+	return 0;
+}
+
+static void so_inflate_close(so_inflate *z) {
+	if (z->thid >= 0) {
+		z->abort = 1;
+		sceKernelSignalSema(z->sema_empty, INFLATE_NUM_BUFS);
+		sceKernelWaitThreadEnd(z->thid, NULL, NULL);
+		sceKernelDeleteThread(z->thid);
+	}
+	if (z->sema_full >= 0)
+		sceKernelDeleteSema(z->sema_full);
+	if (z->sema_empty >= 0)
+		sceKernelDeleteSema(z->sema_empty);
+	inflateEnd(&z->zs);
+	free(z->bufs[0]);
+	free(z);
+}
+
+// fd has to be positioned at the start of the gzip member
+static so_inflate *so_inflate_open(SceUID fd) {
+	so_inflate *z = calloc(1, sizeof(so_inflate));
+	if (!z)
+		return NULL;
+	z->fd = fd;
+	z->thid = z->sema_full = z->sema_empty = -1;
+	if (inflateInit2(&z->zs, 16 + MAX_WBITS) != Z_OK) {
+		free(z);
+		return NULL;
+	}
+
+	z->bufs[0] = malloc(INFLATE_BUF_SZ * INFLATE_NUM_BUFS);
+	z->sema_full = sceKernelCreateSema("so_inflate_full", 0, 0, INFLATE_NUM_BUFS, NULL);
+	z->sema_empty = sceKernelCreateSema("so_inflate_empty", 0, INFLATE_NUM_BUFS, INFLATE_NUM_BUFS, NULL);
+	if (!z->bufs[0] || z->sema_full < 0 || z->sema_empty < 0) {
+		so_inflate_close(z);
+		return NULL;
+	}
+	for (int i = 1; i < INFLATE_NUM_BUFS; i++)
+		z->bufs[i] = z->bufs[0] + i * INFLATE_BUF_SZ;
+
+	z->thid = sceKernelCreateThread("so_inflate", &so_inflate_thread, 0x10000100, 0x4000, 0, SCE_KERNEL_CPU_MASK_USER_1, NULL);
+	if (z->thid < 0) {
+		so_inflate_close(z);
+		return NULL;
+	}
+	sceKernelStartThread(z->thid, sizeof(z), &z);
+	return z;
+}
+
+static int so_inflate_read(so_inflate *z, void *dst, size_t size) {
+	z->zs.next_out = dst;
+	z->zs.avail_out = size;
+	while (z->zs.avail_out) {
+		if (!z->zs.avail_in) {
+			// Hand the drained buffer back to the reader and wait for the next one
+			if (z->held)
+				sceKernelSignalSema(z->sema_empty, 1);
+			sceKernelWaitSema(z->sema_full, 1, NULL);
+			int n = z->lens[z->head];
+			z->zs.next_in = z->bufs[z->head];
+			z->zs.avail_in = n > 0 ? n : 0;
+			z->head = (z->head + 1) % INFLATE_NUM_BUFS;
+			z->held = 1;
+			if (n <= 0)
+				return -1;
+		}
+
+		int res = inflate(&z->zs, Z_NO_FLUSH);
+		if (res == Z_STREAM_END && z->zs.avail_out)
+			return -1;
+		if (res != Z_OK && res != Z_STREAM_END)
+			return -1;
+	}
+
+	return 0;
+}
+
+typedef struct {
+	SceUID fd;
+	const uint8_t *buf;
+	size_t size;
+	size_t pos;
+	uint8_t *chunk;
+	SHA1_CTX sha1;
+	so_inflate *z; // gzip compressed file, size is the inflated size
+} so_stream;
+
+static int so_stream_read(so_stream *s, void *dst, size_t size) {
+	if (s->pos + size > s->size)
+		return -1;
+
+	if (s->buf)
+		sceClibMemcpy(dst, s->buf + s->pos, size);
+	else if (s->z) {
+		if (so_inflate_read(s->z, dst, size) < 0)
+			return -1;
+	} else if (sceIoRead(s->fd, dst, size) != (int)size)
+		return -1;
+
+	sha1_update(&s->sha1, dst, size);
+	s->pos += size;
+	return 0;
+}
+
+static int so_stream_skip(so_stream *s, size_t offset) {
+	while (s->pos < offset) {
+		size_t n = offset - s->pos;
+		if (n > STREAM_CHUNK_SZ)
+			n = STREAM_CHUNK_SZ;
+		if (so_stream_read(s, s->chunk, n) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+// Reads file range [offset, offset + size) into dst, head holds the bytes already consumed with the ELF headers
+static int so_stream_segment(so_stream *s, const uint8_t *head, size_t head_size, uintptr_t dst, size_t offset, size_t size, int rx) {
+	if (offset < s->pos) {
+		size_t n = s->pos - offset;
+		if (n > size)
+			n = size;
+		if (offset + n > head_size)
+			return -1;
+		if (rx)
+			so_memcpy_rx((void *)dst, head + offset, n);
+		else
+			sceClibMemcpy((void *)dst, head + offset, n);
+		dst += n;
+		offset += n;
+		size -= n;
+	}
+
+	if (so_stream_skip(s, offset) < 0)
+		return -1;
+
+	if (!rx)
+		return so_stream_read(s, (void *)dst, size);
+
+	// RX blocks can't be written from userland, go through the bounce buffer
+	while (size) {
+		size_t n = size > STREAM_CHUNK_SZ ? STREAM_CHUNK_SZ : size;
+		if (so_stream_read(s, s->chunk, n) < 0)
+			return -1;
+		so_memcpy_rx((void *)dst, s->chunk, n);
+		dst += n;
+		size -= n;
+	}
+
+	return 0;
 }
 
-int _so_load(so_module *mod, SceUID so_blockid, void *so_data, uintptr_t load_addr) {
+static void so_zero_rx(uint8_t *chunk, uintptr_t dst, size_t size) {
+	memset(chunk, 0, size > STREAM_CHUNK_SZ ? STREAM_CHUNK_SZ : size);
+	while (size) {
+		size_t n = size > STREAM_CHUNK_SZ ? STREAM_CHUNK_SZ : size;
+		so_memcpy_rx((void *)dst, chunk, n);
+		dst += n;
+		size -= n;
+	}
+}
+
+int _so_load(so_module *mod, so_stream *stream, uintptr_t load_addr) {
 	int res = 0;
 	uintptr_t data_addr = 0;
-	
-	if (memcmp(so_data, ELFMAG, SELFMAG) != 0) {
+	uint8_t *hdrs = NULL, *sh_data = NULL;
+	size_t hdrs_size, sh_off;
+	uintptr_t prog_data[MAX_DATA_SEG + 1];
+	int load_order[MAX_DATA_SEG + 1], n_load = 0;
+
+	sha1_init(&stream->sha1);
+	stream->chunk = malloc(STREAM_CHUNK_SZ);
+	if (!stream->chunk)
+		return -1;
+
+	// ELF and program headers, kept around as the module headers
+	Elf32_Ehdr ehdr;
+	if (so_stream_read(stream, &ehdr, sizeof(ehdr)) < 0 || memcmp(&ehdr, ELFMAG, SELFMAG) != 0 || ehdr.e_phoff < sizeof(ehdr)) {
 		res = -1;
-		goto err_free_so;
+		goto err_free_stream;
 	}
 
-	mod->ehdr = (Elf32_Ehdr *)so_data;
-	mod->phdr = (Elf32_Phdr *)((uintptr_t)so_data + mod->ehdr->e_phoff);
-	mod->shdr = (Elf32_Shdr *)((uintptr_t)so_data + mod->ehdr->e_shoff);
+	hdrs_size = ehdr.e_phoff + ehdr.e_phnum * sizeof(Elf32_Phdr);
+	hdrs = malloc(hdrs_size);
+	memcpy(hdrs, &ehdr, sizeof(ehdr));
+	if (so_stream_read(stream, hdrs + sizeof(ehdr), hdrs_size - sizeof(ehdr)) < 0) {
+		res = -1;
+		goto err_free_stream;
+	}
 
-	mod->shstr = (char *)((uintptr_t)so_data + mod->shdr[mod->ehdr->e_shstrndx].sh_offset);
+	mod->ehdr = (Elf32_Ehdr *)hdrs;
+	mod->phdr = (Elf32_Phdr *)(hdrs + ehdr.e_phoff);
 
 	for (int i = 0; i < mod->ehdr->e_phnum; i++) {
 		if (mod->phdr[i].p_type == PT_LOAD) {
-			void *prog_data;
 			size_t prog_size;
 
+			if (n_load > MAX_DATA_SEG) {
+				res = -1;
+				goto err_free_data;
+			}
+
 			if ((mod->phdr[i].p_flags & PF_X) == PF_X) {
 				// Allocate arena for code patches, trampolines, etc
 				// Sits exactly under the desired allocation space
-				mod->patch_size = ALIGN_MEM(PATCH_SZ, mod->phdr[i].p_align);
-				SceKernelAllocMemBlockKernelOpt opt;
-				memset(&opt, 0, sizeof(SceKernelAllocMemBlockKernelOpt));
-				opt.size = sizeof(SceKernelAllocMemBlockKernelOpt);
-				opt.attr = 0x1;
-				opt.field_C = (SceUInt32)load_addr - mod->patch_size;
-				res = mod->patch_blockid = kuKernelAllocMemBlock("rx_block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RX, mod->patch_size, &opt);
+				size_t patch_size = ALIGN_MEM(PATCH_SZ, mod->phdr[i].p_align);
+				uintptr_t patch_base;
+				SceUID patch_blockid = res = so_block_alloc("rx_block", 1, load_addr - patch_size, patch_size);
 				if (res < 0)
-					goto err_free_so;
+					goto err_free_stream;
 
-				sceKernelGetMemBlockBase(mod->patch_blockid, &mod->patch_base);
-				mod->patch_head = mod->patch_base;
+				so_block_info(patch_blockid, &patch_base, NULL);
+				so_arena_add(mod, patch_blockid, patch_base, patch_size);
 				
 				prog_size = ALIGN_MEM(mod->phdr[i].p_memsz, mod->phdr[i].p_align);
-				memset(&opt, 0, sizeof(SceKernelAllocMemBlockKernelOpt));
-				opt.size = sizeof(SceKernelAllocMemBlockKernelOpt);
-				opt.attr = 0x1;
-				opt.field_C = (SceUInt32)load_addr;
-				res = mod->text_blockid = kuKernelAllocMemBlock("rx_block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RX, prog_size, &opt);
+				res = mod->text_blockid = so_block_alloc("rx_block", 1, load_addr, prog_size);
 				if (res < 0)
-					goto err_free_so;
+					goto err_free_data;
 
-				sceKernelGetMemBlockBase(mod->text_blockid, &prog_data);
+				so_block_info(mod->text_blockid, &prog_data[n_load], NULL);
 
-				mod->phdr[i].p_vaddr += (Elf32_Addr)prog_data;
+				mod->phdr[i].p_vaddr += (Elf32_Addr)prog_data[n_load];
 
 				mod->text_base = mod->phdr[i].p_vaddr;
 				mod->text_size = mod->phdr[i].p_memsz;
 		
 				// Use the .text segment padding as a code cave
 				// Word-align it to make it simpler for instruction arena allocation
-				mod->cave_size = ALIGN_MEM(prog_size - mod->phdr[i].p_memsz, 0x4);
-				mod->cave_base = mod->cave_head = prog_data + mod->phdr[i].p_memsz;
-				mod->cave_base = ALIGN_MEM(mod->cave_base, 0x4);
-				mod->cave_head = mod->cave_base;
-				printf("code cave: %d bytes (@0x%08X).\n", mod->cave_size, mod->cave_base);
+				uintptr_t cave_base = ALIGN_MEM(prog_data[n_load] + mod->phdr[i].p_memsz, 0x4);
+				so_arena *cave = so_arena_add(mod, 0, cave_base, prog_data[n_load] + prog_size - cave_base);
+				printf("code cave: %zu bytes (@0x%08X).\n", cave->size, (unsigned int)cave->base);
+
+				data_addr = (uintptr_t)prog_data[n_load] + prog_size;
 
-				data_addr = (uintptr_t)prog_data + prog_size;
+				// Zero the segment tail in place, file bytes are streamed in below
+				so_zero_rx(stream->chunk, mod->phdr[i].p_vaddr + mod->phdr[i].p_filesz, prog_size - mod->phdr[i].p_filesz);
 			} else {
-				if (data_addr == 0)
-					goto err_free_so;
+				if (data_addr == 0) {
+					res = -1;
+					goto err_free_data;
+				}
 
-				if (mod->n_data >= MAX_DATA_SEG)
+				if (mod->n_data >= MAX_DATA_SEG) {
+					res = -1;
 					goto err_free_data;
+				}
 
 				prog_size = ALIGN_MEM(mod->phdr[i].p_memsz + mod->phdr[i].p_vaddr - (data_addr - mod->text_base), mod->phdr[i].p_align);
 
-				SceKernelAllocMemBlockKernelOpt opt;
-				memset(&opt, 0, sizeof(SceKernelAllocMemBlockKernelOpt));
-				opt.size = sizeof(SceKernelAllocMemBlockKernelOpt);
-				opt.attr = 0x1;
-				opt.field_C = (SceUInt32)data_addr;
-				res = mod->data_blockid[mod->n_data] = kuKernelAllocMemBlock("rw_block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, prog_size, &opt);
+				res = mod->data_blockid[mod->n_data] = so_block_alloc("rw_block", 0, data_addr, prog_size);
 				if (res < 0)
-					goto err_free_text;
+					goto err_free_data;
 
-				sceKernelGetMemBlockBase(mod->data_blockid[mod->n_data], &prog_data);
-				data_addr = (uintptr_t)prog_data + prog_size;
+				so_block_info(mod->data_blockid[mod->n_data], &prog_data[n_load], NULL);
 
 				mod->phdr[i].p_vaddr += (Elf32_Addr)mod->text_base;
 
 				mod->data_base[mod->n_data] = mod->phdr[i].p_vaddr;
 				mod->data_size[mod->n_data] = mod->phdr[i].p_memsz;
 				mod->n_data++;
+
+				// Zero everything but the file bytes in place (alignment gap and BSS)
+				uintptr_t file_end = mod->phdr[i].p_vaddr + mod->phdr[i].p_filesz;
+				memset((void *)prog_data[n_load], 0, mod->phdr[i].p_vaddr - prog_data[n_load]);
+				memset((void *)file_end, 0, prog_data[n_load] + prog_size - file_end);
+
+				data_addr = (uintptr_t)prog_data[n_load] + prog_size;
 			}
 
-			char *zero = malloc(prog_size - mod->phdr[i].p_filesz);
-			memset(zero, 0, prog_size - mod->phdr[i].p_filesz);
-			kuKernelCpuUnrestrictedMemcpy(prog_data + mod->phdr[i].p_filesz, zero, prog_size - mod->phdr[i].p_filesz);
-			free(zero);
+			load_order[n_load++] = i;
+		}
+	}
+
+	// Stream segment file bytes in file order, straight into their blocks
+	for (int i = 1; i < n_load; i++) {
+		for (int j = i; j > 0 && mod->phdr[load_order[j]].p_offset < mod->phdr[load_order[j - 1]].p_offset; j--) {
+			int tmp = load_order[j];
+			load_order[j] = load_order[j - 1];
+			load_order[j - 1] = tmp;
+		}
+	}
 
-			kuKernelCpuUnrestrictedMemcpy((void *)mod->phdr[i].p_vaddr, (void *)((uintptr_t)so_data + mod->phdr[i].p_offset), mod->phdr[i].p_filesz);
+	for (int i = 0; i < n_load; i++) {
+		Elf32_Phdr *phdr = &mod->phdr[load_order[i]];
+		if (so_stream_segment(stream, hdrs, hdrs_size, phdr->p_vaddr, phdr->p_offset, phdr->p_filesz, (phdr->p_flags & PF_X) == PF_X) < 0) {
+			res = -1;
+			goto err_free_data;
 		}
 	}
+	so_flush_caches(mod);
+
+	// Whatever follows the segments holds section headers and their names
+	sh_off = stream->pos;
+	if (ehdr.e_shoff < sh_off || ehdr.e_shoff + ehdr.e_shnum * sizeof(Elf32_Shdr) > stream->size) {
+		res = -1;
+		goto err_free_data;
+	}
+	sh_data = malloc(stream->size - sh_off);
+	if (so_stream_read(stream, sh_data, stream->size - sh_off) < 0) {
+		res = -1;
+		goto err_free_data;
+	}
+	sha1_final(&stream->sha1, mod->sha1);
+
+	mod->shdr = (Elf32_Shdr *)(sh_data + ehdr.e_shoff - sh_off);
+	if (mod->shdr[ehdr.e_shstrndx].sh_offset < sh_off) {
+		res = -1;
+		goto err_free_data;
+	}
+	mod->shstr = (char *)(sh_data + mod->shdr[ehdr.e_shstrndx].sh_offset - sh_off);
 
 	for (int i = 0; i < mod->ehdr->e_shnum; i++) {
 		char *sh_name = mod->shstr + mod->shdr[i].sh_name;
@@ -232,9 +951,20 @@ int _so_load(so_module *mod, SceUID so_blockid, void *so_data, uintptr_t load_ad
 			mod->num_init_array = sh_size / sizeof(void *);
 		} else if (strcmp(sh_name, ".hash") == 0) {
 			mod->hash = (void *)sh_addr;
+		} else if (strcmp(sh_name, ".gnu.hash") == 0) {
+			mod->gnu_hash = (void *)sh_addr;
+		} else if (strcmp(sh_name, ".ARM.exidx") == 0) {
+			mod->exidx = (void *)sh_addr;
+			mod->num_exidx = sh_size / 8;
 		}
 	}
 
+	// Section headers aren't needed past this point
+	free(sh_data);
+	sh_data = NULL;
+	mod->shdr = NULL;
+	mod->shstr = NULL;
+
 	if (mod->dynamic == NULL ||
 		mod->dynstr == NULL ||
 		mod->dynsym == NULL ||
@@ -254,7 +984,9 @@ int _so_load(so_module *mod, SceUID so_blockid, void *so_data, uintptr_t load_ad
 		}
 	}
 
-	sceKernelFreeMemBlock(so_blockid);
+	free(stream->chunk);
+
+	so_global_add(mod);
 
 	if (!head && !tail) {
 		head = mod;
@@ -268,54 +1000,105 @@ int _so_load(so_module *mod, SceUID so_blockid, void *so_data, uintptr_t load_ad
 
 err_free_data:
 	for (int i = 0; i < mod->n_data; i++)
-		sceKernelFreeMemBlock(mod->data_blockid[i]);
-err_free_text:
-	sceKernelFreeMemBlock(mod->text_blockid);
-err_free_so:
-	sceKernelFreeMemBlock(so_blockid);
+		so_block_free(mod->data_blockid[i]);
+	so_block_free(mod->text_blockid);
+	for (int i = 0; i < mod->n_arenas; i++) {
+		so_arena_range *r = mod->arenas[i].free_list;
+		while (r) {
+			so_arena_range *next = r->next;
+			free(r);
+			r = next;
+		}
+		if (mod->arenas[i].blockid > 0)
+			so_block_free(mod->arenas[i].blockid);
+	}
+	mod->n_arenas = 0;
+err_free_stream:
+	free(sh_data);
+	free(hdrs);
+	free(stream->chunk);
+	mod->ehdr = NULL;
+	mod->phdr = NULL;
 
 	return res;
 }
 
 int so_mem_load(so_module *mod, void *buffer, size_t so_size, uintptr_t load_addr) {
-	SceUID so_blockid;
-	void *so_data;
+	so_stream stream;
 
 	memset(mod, 0, sizeof(so_module));
+	memset(&stream, 0, sizeof(so_stream));
 
-	so_blockid = sceKernelAllocMemBlock("so block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, (so_size + 0xfff) & ~0xfff, NULL);
-	if (so_blockid < 0)
-		return so_blockid;
-
-	sceKernelGetMemBlockBase(so_blockid, &so_data);
-	sceClibMemcpy(so_data, buffer, so_size);
+	stream.buf = buffer;
+	stream.size = so_size;
 	
-	return _so_load(mod, so_blockid, so_data, load_addr);
+	return _so_load(mod, &stream, load_addr);
 }
 
-int so_file_load(so_module *mod, const char *filename, uintptr_t load_addr) {
-	SceUID so_blockid;
-	void *so_data;
-
-	memset(mod, 0, sizeof(so_module));
+static int so_stream_open(so_stream *stream, const char *filename) {
+	memset(stream, 0, sizeof(so_stream));
+
+	stream->fd = sceIoOpen(filename, SCE_O_RDONLY, 0);
+	if (stream->fd < 0)
+		return stream->fd;
+
+	stream->size = sceIoLseek(stream->fd, 0, SCE_SEEK_END);
+
+	// gzip files get inflated on the fly, their trailer holds the inflated size
+	uint8_t magic[2];
+	uint32_t isize;
+	sceIoLseek(stream->fd, 0, SCE_SEEK_SET);
+	if (sceIoRead(stream->fd, magic, sizeof(magic)) == sizeof(magic) && magic[0] == 0x1f && magic[1] == 0x8b) {
+		sceIoLseek(stream->fd, -(SceOff)sizeof(isize), SCE_SEEK_END);
+		sceIoRead(stream->fd, &isize, sizeof(isize));
+		sceIoLseek(stream->fd, 0, SCE_SEEK_SET);
+		stream->size = isize;
+		stream->z = so_inflate_open(stream->fd);
+		if (!stream->z) {
+			sceIoClose(stream->fd);
+			return -1;
+		}
+	} else {
+		sceIoLseek(stream->fd, 0, SCE_SEEK_SET);
+	}
 
-	SceUID fd = sceIoOpen(filename, SCE_O_RDONLY, 0);
-	if (fd < 0)
-		return fd;
+	return 0;
+}
 
-	size_t so_size = sceIoLseek(fd, 0, SCE_SEEK_END);
-	sceIoLseek(fd, 0, SCE_SEEK_SET);
+static void so_stream_close(so_stream *stream) {
+	if (stream->z)
+		so_inflate_close(stream->z);
+	sceIoClose(stream->fd);
+}
 
-	so_blockid = sceKernelAllocMemBlock("so block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, (so_size + 0xfff) & ~0xfff, NULL);
-	if (so_blockid < 0)
-		return so_blockid;
+int so_file_load(so_module *mod, const char *filename, uintptr_t load_addr) {
+	so_stream stream;
 
-	sceKernelGetMemBlockBase(so_blockid, &so_data);
+	memset(mod, 0, sizeof(so_module));
+	int res = so_stream_open(&stream, filename);
+	if (res < 0)
+		return res;
 
-	sceIoRead(fd, so_data, so_size);
-	sceIoClose(fd);
+	res = _so_load(mod, &stream, load_addr);
+	so_stream_close(&stream);
+	return res;
+}
 
-	return _so_load(mod, so_blockid, so_data, load_addr);
+// Same digest as so_file_load leaves in mod->sha1, without loading anything
+static int so_file_sha1(const char *filename, uint8_t *digest) {
+	so_stream stream;
+	int res = so_stream_open(&stream, filename);
+	if (res < 0)
+		return res;
+
+	sha1_init(&stream.sha1);
+	stream.chunk = malloc(STREAM_CHUNK_SZ);
+	res = stream.chunk && so_stream_skip(&stream, stream.size) == 0 ? 0 : -1;
+	if (res == 0)
+		sha1_final(&stream.sha1, digest);
+	free(stream.chunk);
+	so_stream_close(&stream);
+	return res;
 }
 
 int so_relocate(so_module *mod) {
@@ -327,47 +1110,27 @@ int so_relocate(so_module *mod) {
 		int type = ELF32_R_TYPE(rel->r_info);
 		switch (type) {
 		case R_ARM_ABS32:
-			if (sym->st_shndx != SHN_UNDEF)
+			if (sym->st_shndx != SHN_UNDEF) {
 				*ptr += mod->text_base + sym->st_value;
+				so_cache_record(mod, rel->r_offset, CACHE_ADD_BASE, sym->st_value);
+			}
 			break;
 		case R_ARM_RELATIVE:
 			*ptr += mod->text_base;
+			so_cache_record(mod, rel->r_offset, CACHE_ADD_BASE, 0);
 			break;
 		case R_ARM_GLOB_DAT:
 		case R_ARM_JUMP_SLOT:
 		{
-			if (sym->st_shndx != SHN_UNDEF)
+			if (sym->st_shndx != SHN_UNDEF) {
 				*ptr = mod->text_base + sym->st_value;
-			break;
-		}
-		default:
-			fatal_error("Error unknown relocation type %x\n", type);
-			break;
-		}
-	}
-
-	return 0;
-}
-
-uintptr_t so_resolve_link(so_module *mod, const char *symbol) {
-	for (int i = 0; i < mod->num_dynamic; i++) {
-		switch (mod->dynamic[i].d_tag) {
-		case DT_NEEDED:
-		{
-			so_module *curr = head;
-			while (curr) {
-				if (curr != mod && strcmp(curr->soname, mod->dynstr + mod->dynamic[i].d_un.d_ptr) == 0) {
-					uintptr_t link = so_symbol(curr, symbol);
-					if (link)
-						return link;
-				}
-				curr = curr->next;
+				so_cache_record(mod, rel->r_offset, CACHE_SET_BASE, sym->st_value);
 			}
-
 			break;
 		}
 		default:
-			break;
+			printf("Error unknown relocation type %x\n", type);
+			return -1;
 		}
 	}
 
@@ -390,6 +1153,11 @@ void reloc_err(uintptr_t got0)
 
 	if (curr) {
 		// Attempt to find symbol name and then display error
+		Elf32_Rel *rel = so_lazy_find(curr, got0);
+		if (rel)
+			fatal_error("Unknown symbol \"%s\" (%p).\n", curr->dynstr + curr->dynsym[ELF32_R_SYM(rel->r_info)].st_name, (void*)got0);
+
+		// .rel.plt out of order, go through everything
 		for (int i = 0; i < curr->num_reldyn + curr->num_relplt; i++) {
 			Elf32_Rel *rel = i < curr->num_reldyn ? &curr->reldyn[i] : &curr->relplt[i - curr->num_reldyn];
 			Elf32_Sym *sym = &curr->dynsym[ELF32_R_SYM(rel->r_info)];
@@ -412,23 +1180,484 @@ void reloc_err(uintptr_t got0)
 	fatal_error("Unknown symbol \"???\" (%p).\n", (void*)got0);
 }
 
-__attribute__((naked)) void plt0_stub()
-{
-	register uintptr_t got0 asm("r12");
-	reloc_err(got0);
+uint32_t so_hash(const uint8_t *name) {
+	uint64_t h = 0, g;
+	while (*name) {
+		h = (h << 4) + *name++;
+		if ((g = (h & 0xf0000000)) != 0)
+			h ^= g >> 24;
+		h &= 0x0fffffff;
+	}
+	return h;
 }
 
-int so_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only) {
-	for (int i = 0; i < mod->num_reldyn + mod->num_relplt; i++) {
-		Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
-		Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
-		uintptr_t *ptr = (uintptr_t *)(mod->text_base + rel->r_offset);
+/*
+ * Global symbol index: every symbol defined by a loaded module, filled at load
+ * time. Names are interned (all definitions of a name point to the string of the
+ * first one) and lookups are restricted to the importing module's DT_NEEDED list.
+ */
+typedef struct {
+	uint32_t hash;
+	const char *name;
+	so_module *mod;
+	uintptr_t addr;
+} so_global_sym;
+
+static so_global_sym *global_syms = NULL;
+static uint32_t global_syms_mask = 0, global_syms_count = 0;
+
+static so_global_sym *so_global_slot(uint32_t hash) {
+	uint32_t i = hash & global_syms_mask;
+	while (global_syms[i].name)
+		i = (i + 1) & global_syms_mask;
+	return &global_syms[i];
+}
 
-		int type = ELF32_R_TYPE(rel->r_info);
-		switch (type) {
-		case R_ARM_ABS32:
-		case R_ARM_GLOB_DAT:
-		case R_ARM_JUMP_SLOT:
+static void so_global_add(so_module *mod) {
+	for (int i = 1; i < mod->num_dynsym; i++) {
+		Elf32_Sym *sym = &mod->dynsym[i];
+		int bind = ELF32_ST_BIND(sym->st_info);
+		if (sym->st_shndx == SHN_UNDEF || (bind != STB_GLOBAL && bind != STB_WEAK))
+			continue;
+
+		// Keep load factor under 1/2, growing the table when needed
+		if ((global_syms_count + 1) * 2 > global_syms_mask + 1) {
+			so_global_sym *old = global_syms;
+			uint32_t old_size = old ? global_syms_mask + 1 : 0;
+			uint32_t size = old_size ? old_size * 2 : 4096;
+			global_syms = calloc(size, sizeof(so_global_sym));
+			global_syms_mask = size - 1;
+			for (uint32_t j = 0; j < old_size; j++) {
+				if (old[j].name)
+					*so_global_slot(old[j].hash) = old[j];
+			}
+			free(old);
+		}
+
+		const char *name = mod->dynstr + sym->st_name;
+		uint32_t hash = so_hash((const uint8_t *)name);
+		uint32_t j = hash & global_syms_mask;
+		for (; global_syms[j].name; j = (j + 1) & global_syms_mask) {
+			if (global_syms[j].hash == hash && strcmp(global_syms[j].name, name) == 0)
+				name = global_syms[j].name;
+		}
+
+		global_syms[j].hash = hash;
+		global_syms[j].name = name;
+		global_syms[j].mod = mod;
+		global_syms[j].addr = mod->text_base + sym->st_value;
+		global_syms_count++;
+	}
+}
+
+// Maps DT_NEEDED entries to the loaded modules providing them
+static void so_link_needed(so_module *mod) {
+	mod->n_needed = 0;
+	for (int i = 0; i < mod->num_dynamic; i++) {
+		if (mod->dynamic[i].d_tag != DT_NEEDED)
+			continue;
+
+		const char *name = mod->dynstr + mod->dynamic[i].d_un.d_ptr;
+		for (so_module *curr = head; curr; curr = curr->next) {
+			if (curr != mod && curr->soname && strcmp(curr->soname, name) == 0) {
+				if (mod->n_needed < MAX_NEEDED)
+					mod->needed[mod->n_needed++] = curr;
+				break;
+			}
+		}
+	}
+}
+
+uintptr_t so_resolve_link(so_module *mod, const char *symbol) {
+	uint32_t hash = so_hash((const uint8_t *)symbol);
+	const char *name = NULL;
+	uintptr_t link = 0;
+	int rank = mod->n_needed;
+
+	if (!global_syms || !mod->n_needed)
+		return 0;
+
+	// All definitions of a name share the interned string, so past the first hit only pointers are compared
+	for (uint32_t i = hash & global_syms_mask; global_syms[i].name; i = (i + 1) & global_syms_mask) {
+		so_global_sym *e = &global_syms[i];
+		if (e->hash != hash || (name ? e->name != name : strcmp(e->name, symbol) != 0))
+			continue;
+		name = e->name;
+
+		// First module in DT_NEEDED order wins
+		for (int j = 0; j < rank; j++) {
+			if (mod->needed[j] == e->mod) {
+				link = e->addr;
+				rank = j;
+				break;
+			}
+		}
+	}
+
+	return link;
+}
+
+static uintptr_t so_next_load_addr(void) {
+	uintptr_t end = 0;
+	for (so_module *curr = head; curr; curr = curr->next) {
+		if (curr->text_base + curr->text_size > end)
+			end = curr->text_base + curr->text_size;
+		for (int i = 0; i < curr->n_data; i++) {
+			if (curr->data_base[i] + curr->data_size[i] > end)
+				end = curr->data_base[i] + curr->data_size[i];
+		}
+		for (int i = 0; i < curr->n_arenas; i++) {
+			if (curr->arenas[i].base + curr->arenas[i].size > end)
+				end = curr->arenas[i].base + curr->arenas[i].size;
+		}
+	}
+
+	// Leave room for the next module's patch block, mapped right under its load address
+	return ALIGN_MEM(end + PATCH_SZ, 0x100000);
+}
+
+// Looks for name in path, as is or gzip compressed
+static int so_find_file(char *fname, size_t size, const char *path, const char *name) {
+	SceIoStat stat;
+	snprintf(fname, size, "%s/%s", path, name);
+	if (sceIoGetstat(fname, &stat) >= 0)
+		return 0;
+	snprintf(fname, size, "%s/%s.gz", path, name);
+	return sceIoGetstat(fname, &stat);
+}
+
+/*
+ * load_needed: loads, relocates and resolves the DT_NEEDED libraries of mod that
+ * are present in path, raw or as .gz (dependencies first). The ones that aren't are expected to
+ * be provided by default_dynlib or vitaGL.
+ */
+int so_load_needed(so_module *mod, const char *path, so_default_dynlib *default_dynlib, int size_default_dynlib) {
+	for (int i = 0; i < mod->num_dynamic; i++) {
+		if (mod->dynamic[i].d_tag != DT_NEEDED)
+			continue;
+
+		char *name = mod->dynstr + mod->dynamic[i].d_un.d_ptr;
+		int loaded = 0;
+		for (so_module *curr = head; curr && !loaded; curr = curr->next)
+			loaded = curr->soname && strcmp(curr->soname, name) == 0;
+		if (loaded)
+			continue;
+
+		char fname[256];
+		if (so_find_file(fname, sizeof(fname), path, name) < 0)
+			continue;
+
+		so_module *dep = malloc(sizeof(so_module));
+		uintptr_t load_addr = so_next_load_addr();
+		if (!dep || so_file_load(dep, fname, load_addr) < 0) {
+			printf("Failed to load %s\n", fname);
+			free(dep);
+			continue;
+		}
+		if (!dep->soname)
+			dep->soname = name;
+		printf("Loaded %s (@0x%08X)\n", fname, (unsigned int)dep->text_base);
+
+		so_load_needed(dep, path, default_dynlib, size_default_dynlib);
+		if (so_relocate_resolve(dep, default_dynlib, size_default_dynlib, 0) < 0)
+			printf("Failed to relocate %s\n", fname);
+		so_flush_caches(dep);
+	}
+
+	so_link_needed(mod);
+	return 0;
+}
+
+/*
+ * Import index: open addressing hash table over default_dynlib, built once per
+ * table so that every import costs a single probe sequence instead of a full
+ * strcmp scan. vitaGL fallback lookups are memoized in the same table
+ * (including misses) so vglGetProcAddress is hit at most once per symbol.
+ */
+enum {
+	DYNLIB_NATIVE,
+	DYNLIB_VGL,
+	DYNLIB_MISSING,
+};
+
+typedef struct {
+	uint32_t hash;
+	uint32_t kind;
+	const char *symbol;
+	uintptr_t func;
+	int index;
+} so_dynlib_entry;
+
+static so_dynlib_entry *dynlib_index = NULL;
+static uint32_t dynlib_index_mask = 0, dynlib_index_count = 0;
+static so_default_dynlib *dynlib_index_src = NULL;
+static int dynlib_index_src_num = 0;
+
+static so_dynlib_entry *so_dynlib_slot(const char *symbol, uint32_t hash) {
+	for (uint32_t i = hash & dynlib_index_mask;; i = (i + 1) & dynlib_index_mask) {
+		so_dynlib_entry *e = &dynlib_index[i];
+		if (!e->symbol || (e->hash == hash && strcmp(e->symbol, symbol) == 0))
+			return e;
+	}
+}
+
+static void so_dynlib_insert(const char *symbol, uint32_t hash, uint32_t kind, uintptr_t func, int index) {
+	// Keep load factor under 1/2, growing the table when needed
+	if ((dynlib_index_count + 1) * 2 > dynlib_index_mask + 1) {
+		so_dynlib_entry *old = dynlib_index;
+		uint32_t old_size = old ? dynlib_index_mask + 1 : 0;
+		uint32_t size = old_size ? old_size * 2 : 512;
+		dynlib_index = calloc(size, sizeof(so_dynlib_entry));
+		dynlib_index_mask = size - 1;
+		for (uint32_t i = 0; i < old_size; i++) {
+			if (old[i].symbol)
+				*so_dynlib_slot(old[i].symbol, old[i].hash) = old[i];
+		}
+		free(old);
+	}
+
+	so_dynlib_entry *e = so_dynlib_slot(symbol, hash);
+	if (e->symbol) // First definition wins, as with the former linear scan
+		return;
+	e->hash = hash;
+	e->kind = kind;
+	e->symbol = symbol;
+	e->func = func;
+	e->index = index;
+	dynlib_index_count++;
+}
+
+static void so_dynlib_index_build(so_default_dynlib *default_dynlib, int num) {
+	if (dynlib_index && dynlib_index_src == default_dynlib && dynlib_index_src_num == num)
+		return;
+
+	free(dynlib_index);
+	dynlib_index = NULL;
+	dynlib_index_mask = dynlib_index_count = 0;
+	for (int i = 0; i < num; i++)
+		so_dynlib_insert(default_dynlib[i].symbol, so_hash((const uint8_t *)default_dynlib[i].symbol), DYNLIB_NATIVE, default_dynlib[i].func, i);
+
+	dynlib_index_src = default_dynlib;
+	dynlib_index_src_num = num;
+}
+
+// Returns the default_dynlib entry for symbol, or NULL if the table doesn't export it
+static so_dynlib_entry *so_dynlib_lookup(const char *symbol) {
+	so_dynlib_entry *e = so_dynlib_slot(symbol, so_hash((const uint8_t *)symbol));
+	return (e->symbol && e->kind == DYNLIB_NATIVE) ? e : NULL;
+}
+
+// Memoized vglGetProcAddress, returns 0 if vitaGL doesn't export symbol
+static uintptr_t so_dynlib_vgl_lookup(const char *symbol) {
+	uint32_t hash = so_hash((const uint8_t *)symbol);
+	so_dynlib_entry *e = so_dynlib_slot(symbol, hash);
+	if (e->symbol)
+		return e->kind == DYNLIB_MISSING ? 0 : e->func;
+
+	uintptr_t f = (uintptr_t)vglGetProcAddress(symbol);
+	so_dynlib_insert(symbol, hash, f ? DYNLIB_VGL : DYNLIB_MISSING, f, -1);
+	return f;
+}
+
+#ifdef SO_HOST
+// Host builds never run module code, only the stub addresses end up in GOT slots
+void plt0_stub()
+{
+	reloc_err(0);
+}
+#else
+__attribute__((naked)) void plt0_stub()
+{
+	register uintptr_t got0 asm("r12");
+	reloc_err(got0);
+}
+#endif
+
+/*
+ * vitaGL slots: vglGetProcAddress only works once vitaGL is up, so while
+ * so_defer_vgl is set (boot links in parallel with vglInitExtended) the slots
+ * are queued, and so_resolve_vgl binds them later on from the main thread.
+ */
+typedef struct {
+	so_module *mod;
+	uint32_t offset;
+	uint32_t name; // dynstr offset
+	int plt; // JUMP_SLOT, gets plt0_stub if vitaGL doesn't have it
+} so_vgl_slot;
+
+static so_vgl_slot *vgl_slots = NULL;
+static int num_vgl_slots, cap_vgl_slots, vgl_deferred;
+
+void so_defer_vgl(int defer) {
+	vgl_deferred = defer;
+}
+
+static void so_vgl_bind(so_module *mod, uint32_t offset, uint32_t name, int plt) {
+	if (vgl_deferred) {
+		if (num_vgl_slots == cap_vgl_slots) {
+			cap_vgl_slots = cap_vgl_slots ? cap_vgl_slots * 2 : 256;
+			vgl_slots = realloc(vgl_slots, cap_vgl_slots * sizeof(so_vgl_slot));
+		}
+		vgl_slots[num_vgl_slots].mod = mod;
+		vgl_slots[num_vgl_slots].offset = offset;
+		vgl_slots[num_vgl_slots].name = name;
+		vgl_slots[num_vgl_slots].plt = plt;
+		num_vgl_slots++;
+		return;
+	}
+
+	uintptr_t *ptr = (uintptr_t *)(mod->text_base + offset);
+	uintptr_t f = so_dynlib_vgl_lookup(mod->dynstr + name);
+	if (f) {
+		*ptr = f;
+		so_rebind_note_add(mod, offset, f);
+	} else if (plt) {
+		printf("Unresolved import: %s\n", mod->dynstr + name);
+		*ptr = (uintptr_t)&plt0_stub;
+	}
+}
+
+static int so_vgl_pending(so_module *mod, uint32_t offset) {
+	for (int i = 0; i < num_vgl_slots; i++) {
+		if (vgl_slots[i].mod == mod && vgl_slots[i].offset == offset)
+			return 1;
+	}
+	return 0;
+}
+
+int so_resolve_vgl(void) {
+	int num = num_vgl_slots;
+	vgl_deferred = 0;
+	for (int i = 0; i < num; i++)
+		so_vgl_bind(vgl_slots[i].mod, vgl_slots[i].offset, vgl_slots[i].name, vgl_slots[i].plt);
+	free(vgl_slots);
+	vgl_slots = NULL;
+	num_vgl_slots = cap_vgl_slots = 0;
+	return num;
+}
+
+/*
+ * Lazy binding: JUMP_SLOTs initially point to so_lazy_stub. PLT entries leave the
+ * GOT slot address in r12, so the stub saves the argument registers, binds the
+ * slot and tail-calls the real target. Each import is resolved (and paid for)
+ * only the first time it's called; slots still on the stub at the end are the
+ * imports the game never used.
+ */
+static SceUID lazy_lock = -1;
+
+// Returns the .rel.plt entry for a GOT slot, relplt is normally sorted by r_offset
+static Elf32_Rel *so_lazy_find(so_module *mod, uintptr_t got) {
+	uint32_t offset = got - mod->text_base;
+	int lo = 0, hi = mod->num_relplt - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (mod->relplt[mid].r_offset < offset)
+			lo = mid + 1;
+		else if (mod->relplt[mid].r_offset > offset)
+			hi = mid - 1;
+		else
+			return &mod->relplt[mid];
+	}
+	return NULL;
+}
+
+uintptr_t so_lazy_bind(uintptr_t got) {
+	so_module *mod = head;
+	Elf32_Rel *rel = NULL;
+	for (; mod; mod = mod->next) {
+		if (mod->lazy_bind && (rel = so_lazy_find(mod, got)))
+			break;
+	}
+	if (!rel)
+		reloc_err(got);
+
+	sceKernelLockMutex(lazy_lock, 1, NULL);
+	const char *symbol = mod->dynstr + mod->dynsym[ELF32_R_SYM(rel->r_info)].st_name;
+	so_dynlib_index_build(mod->dynlib, mod->num_dynlib);
+	so_dynlib_entry *e = so_dynlib_lookup(symbol);
+	uintptr_t f = e ? e->func : so_resolve_link(mod, symbol);
+	if (!f)
+		f = so_dynlib_vgl_lookup(symbol);
+	sceKernelUnlockMutex(lazy_lock, 1);
+
+	if (!f)
+		reloc_err(got);
+
+	*(uintptr_t *)got = f;
+	return f;
+}
+
+#ifdef SO_HOST
+void so_lazy_stub()
+{
+	reloc_err(0);
+}
+#else
+__attribute__((naked)) void so_lazy_stub()
+{
+	asm volatile(
+		"push {r0-r3, r12, lr}\n"
+		"mov r0, r12\n"
+		"bl so_lazy_bind\n"
+		"str r0, [sp, #16]\n" // saved r12 becomes the target
+		"pop {r0-r3, r12, lr}\n"
+		"bx r12\n"
+	);
+}
+#endif
+
+static int so_lazy_init(so_module *mod) {
+	for (int i = 1; i < mod->num_relplt; i++) {
+		if (mod->relplt[i].r_offset < mod->relplt[i - 1].r_offset) {
+			printf("lazy binding: .rel.plt isn't sorted, binding eagerly.\n");
+			return -1;
+		}
+	}
+	if (lazy_lock < 0)
+		lazy_lock = sceKernelCreateMutex("so_lazy", 0, 0, NULL);
+	return 0;
+}
+
+int so_lazy_report(so_module *mod, const char *path) {
+	int num = 0, used = 0;
+	FILE *f = path ? fopen(path, "w") : NULL;
+
+	for (int i = 0; i < mod->num_relplt; i++) {
+		Elf32_Rel *rel = &mod->relplt[i];
+		Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
+		if (ELF32_R_TYPE(rel->r_info) != R_ARM_JUMP_SLOT || sym->st_shndx != SHN_UNDEF)
+			continue;
+
+		num++;
+		if (*(uintptr_t *)(mod->text_base + rel->r_offset) != (uintptr_t)&so_lazy_stub) {
+			used++;
+			if (f)
+				fprintf(f, "%s\n", mod->dynstr + sym->st_name);
+		}
+	}
+
+	if (f)
+		fclose(f);
+	printf("lazy binding: %d/%d imports used.\n", used, num);
+	return used;
+}
+
+int so_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only) {
+	so_dynlib_index_build(default_dynlib, size_default_dynlib / sizeof(so_default_dynlib));
+	mod->dynlib = default_dynlib;
+	mod->num_dynlib = size_default_dynlib / sizeof(so_default_dynlib);
+	so_link_needed(mod);
+
+	for (int i = 0; i < mod->num_reldyn + mod->num_relplt; i++) {
+		Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
+		Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
+		uintptr_t *ptr = (uintptr_t *)(mod->text_base + rel->r_offset);
+
+		int type = ELF32_R_TYPE(rel->r_info);
+		switch (type) {
+		case R_ARM_ABS32:
+		case R_ARM_GLOB_DAT:
+		case R_ARM_JUMP_SLOT:
 		{
 			if (sym->st_shndx == SHN_UNDEF) {
 				int resolved = 0;
@@ -440,31 +1669,37 @@ int so_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_defau
 							*ptr += link;
 						else
 							*ptr = link;
+						so_rebind_note_add(mod, rel->r_offset, link);
 						resolved = 1;
 					}
 				}
 
-				for (int j = 0; j < size_default_dynlib / sizeof(so_default_dynlib); j++) {
-					if (strcmp(mod->dynstr + sym->st_name, default_dynlib[j].symbol) == 0) {
-						*ptr = default_dynlib[j].func;
-						resolved = 1;
-						break;
-					}
+				so_dynlib_entry *e = so_dynlib_lookup(mod->dynstr + sym->st_name);
+				if (e) {
+					*ptr = e->func;
+					so_rebind_note_add(mod, rel->r_offset, e->func);
+					so_cache_record(mod, rel->r_offset, CACHE_IMPORT, e->index);
+					break;
 				}
-				
-				if (!resolved) {
-					void *f = vglGetProcAddress(mod->dynstr + sym->st_name);
-					if (f) {
-						*ptr = f;
-						resolved = 1;
-						break;
-					}
+
+				if (resolved) {
+					so_cache_record(mod, rel->r_offset, type == R_ARM_ABS32 ? CACHE_LINK_ADD : CACHE_LINK, sym->st_name);
+					break;
+				}
+
+				uintptr_t f = so_dynlib_vgl_lookup(mod->dynstr + sym->st_name);
+				if (f) {
+					*ptr = f;
+					so_rebind_note_add(mod, rel->r_offset, f);
+					so_cache_record(mod, rel->r_offset, CACHE_VGL, sym->st_name);
+					break;
 				}
 
 				if (!resolved) {
 					if (type == R_ARM_JUMP_SLOT) {
 						printf("Unresolved import: %s\n", mod->dynstr + sym->st_name);
 						*ptr = (uintptr_t)&plt0_stub;
+						so_cache_record(mod, rel->r_offset, CACHE_PLT0, 0);
 					}
 					else {
 						//printf("Unresolved import: %s\n", mod->dynstr + sym->st_name);
@@ -483,6 +1718,8 @@ int so_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_defau
 }
 
 int so_resolve_with_dummy(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only) {
+	so_dynlib_index_build(default_dynlib, size_default_dynlib / sizeof(so_default_dynlib));
+
 	for (int i = 0; i < mod->num_reldyn + mod->num_relplt; i++) {
 		Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
 		Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
@@ -495,12 +1732,8 @@ int so_resolve_with_dummy(so_module *mod, so_default_dynlib *default_dynlib, int
 		case R_ARM_JUMP_SLOT:
 		{
 			if (sym->st_shndx == SHN_UNDEF) {
-				for (int j = 0; j < size_default_dynlib / sizeof(so_default_dynlib); j++) {
-					if (strcmp(mod->dynstr + sym->st_name, default_dynlib[j].symbol) == 0) {
-						*ptr = &ret0;
-						break;
-					}
-				}
+				if (so_dynlib_lookup(mod->dynstr + sym->st_name))
+					*ptr = (uintptr_t)&ret0;
 			}
 
 			break;
@@ -513,130 +1746,826 @@ int so_resolve_with_dummy(so_module *mod, so_default_dynlib *default_dynlib, int
 	return 0;
 }
 
-void so_initialize(so_module *mod) {
-	for (int i = 0; i < mod->num_init_array; i++) {
-		if (mod->init_array[i])
-			mod->init_array[i]();
-	}
+/*
+ * Rebinding: the slots importing each symbol are grouped on the first so_rebind,
+ * in an open-addressing table keyed by name, so a rebind is one store per slot.
+ * ABS32 slots keep whatever addend they were resolved with, the target each slot
+ * was bound to is noted by whichever path bound it (relocation, cache, image,
+ * vitaGL), unbound slots count as 0. Every store is a single aligned word, a
+ * thread sees either the old or the new target of a slot, but slots of the same
+ * symbol don't all switch at the same instant.
+ */
+typedef struct so_rebind_slot {
+	const char *name;
+	uint32_t offset;
+	uint32_t abs; // R_ARM_ABS32, the target is added to the slot
+	uintptr_t target; // current target
+} so_rebind_slot;
+
+typedef struct so_rebind_entry {
+	const char *name; // NULL if the entry is free
+	uint32_t hash;
+	uint32_t first, count; // range in rebind_slots
+} so_rebind_entry;
+
+static int so_rebind_cmp(const void *a, const void *b) {
+	const so_rebind_slot *sa = a, *sb = b;
+	int res = strcmp(sa->name, sb->name);
+	return res ? res : sa->offset < sb->offset ? -1 : sa->offset > sb->offset;
 }
 
-uint32_t so_hash(const uint8_t *name) {
-	uint64_t h = 0, g;
-	while (*name) {
-		h = (h << 4) + *name++;
-		if ((g = (h & 0xf0000000)) != 0)
-			h ^= g >> 24;
-		h &= 0x0fffffff;
+static so_rebind_entry *so_rebind_entry_get(so_module *mod, const char *symbol, uint32_t hash) {
+	for (uint32_t i = hash & mod->rebind_mask;; i = (i + 1) & mod->rebind_mask) {
+		so_rebind_entry *e = &mod->rebind_index[i];
+		if (!e->name || (e->hash == hash && strcmp(e->name, symbol) == 0))
+			return e;
 	}
-	return h;
 }
 
-static int so_symbol_index(so_module *mod, const char *symbol)
-{
-	if (mod->hash) {
-		uint32_t hash = so_hash((const uint8_t *)symbol);
-		uint32_t nbucket = mod->hash[0];
-		uint32_t *bucket = &mod->hash[2];
-		uint32_t *chain = &bucket[nbucket];
-		for (int i = bucket[hash % nbucket]; i; i = chain[i]) {
-			if (mod->dynsym[i].st_shndx == SHN_UNDEF)
-				continue;
-			if (mod->dynsym[i].st_info != SHN_UNDEF && strcmp(mod->dynstr + mod->dynsym[i].st_name, symbol) == 0)
-				return i;
+static int so_rebind_note_cmp(const void *a, const void *b) {
+	const so_rebind_note *na = a, *nb = b;
+	return na->offset < nb->offset ? -1 : na->offset > nb->offset;
+}
+
+
+// Notes taken since the last call, e.g. vitaGL imports bound after the first rebind
+static void so_rebind_notes_apply(so_module *mod) {
+	// A slot is bound once per boot, so offsets are unique
+	qsort(mod->rebind_notes, mod->num_rebind_notes, sizeof(so_rebind_note), so_rebind_note_cmp);
+	for (uint32_t i = 0; i <= mod->rebind_mask; i++) {
+		so_rebind_entry *e = &mod->rebind_index[i];
+		for (uint32_t j = e->first; e->name && j < e->first + e->count; j++) {
+			so_rebind_note key = { mod->rebind_slots[j].offset, 0 };
+			so_rebind_note *n = bsearch(&key, mod->rebind_notes, mod->num_rebind_notes, sizeof(so_rebind_note), so_rebind_note_cmp);
+			if (n)
+				mod->rebind_slots[j].target = n->target;
 		}
 	}
+	free(mod->rebind_notes);
+	mod->rebind_notes = NULL;
+	mod->num_rebind_notes = mod->cap_rebind_notes = 0;
+}
 
-	for (int i = 0; i < mod->num_dynsym; i++) {
-		if (mod->dynsym[i].st_shndx == SHN_UNDEF)
+static void so_rebind_index_build(so_module *mod) {
+	int num = 0, distinct = 0;
+	so_rebind_slot *slots = malloc((mod->num_reldyn + mod->num_relplt) * sizeof(so_rebind_slot));
+
+	for (int i = 0; i < mod->num_reldyn + mod->num_relplt; i++) {
+		Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
+		int type = ELF32_R_TYPE(rel->r_info);
+		if ((type != R_ARM_ABS32 && type != R_ARM_GLOB_DAT && type != R_ARM_JUMP_SLOT) ||
+			!ELF32_R_SYM(rel->r_info) || mod->dynsym[ELF32_R_SYM(rel->r_info)].st_shndx != SHN_UNDEF)
 			continue;
-		if (mod->dynsym[i].st_info != SHN_UNDEF && strcmp(mod->dynstr + mod->dynsym[i].st_name, symbol) == 0)
-			return i;
+		slots[num].name = mod->dynstr + mod->dynsym[ELF32_R_SYM(rel->r_info)].st_name;
+		slots[num].offset = rel->r_offset;
+		slots[num].abs = type == R_ARM_ABS32;
+		slots[num].target = 0;
+		num++;
 	}
+	qsort(slots, num, sizeof(so_rebind_slot), so_rebind_cmp);
+	for (int i = 0; i < num; i++)
+		distinct += !i || strcmp(slots[i].name, slots[i - 1].name) != 0;
+
+	uint32_t size = 16;
+	while (size < (uint32_t)distinct * 2)
+		size *= 2;
+	mod->rebind_index = calloc(size, sizeof(so_rebind_entry));
+	mod->rebind_mask = size - 1;
+	mod->rebind_slots = slots;
+
+	for (int i = 0; i < num;) {
+		const char *name = slots[i].name;
+		uint32_t hash = so_hash((const uint8_t *)name);
+		so_rebind_entry *e = so_rebind_entry_get(mod, name, hash);
+		int first = i;
+		while (i < num && strcmp(slots[i].name, name) == 0)
+			i++;
+		e->name = name;
+		e->hash = hash;
+		e->first = first;
+		e->count = i - first;
+	}
+}
 
-	return -1;
+int so_rebind(so_module *mod, const char *symbol, uintptr_t func) {
+	if (!mod->rebind_index)
+		so_rebind_index_build(mod);
+	if (mod->num_rebind_notes)
+		so_rebind_notes_apply(mod);
+
+	so_rebind_entry *e = so_rebind_entry_get(mod, symbol, so_hash((const uint8_t *)symbol));
+	if (!e->name)
+		return -1;
+
+	for (uint32_t i = e->first; i < e->first + e->count; i++) {
+		so_rebind_slot *slot = &mod->rebind_slots[i];
+		uintptr_t *ptr = (uintptr_t *)(mod->text_base + slot->offset);
+		uintptr_t value = slot->abs ? *ptr - slot->target + func : func;
+		__atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+		slot->target = func;
+	}
+	return e->count;
 }
 
 /*
- * alloc_arena: allocates space on either patch or cave arenas, 
- * range: maximum range from allocation to dst (ignored if NULL)
- * dst: destination address
-*/
-static uintptr_t so_alloc_arena(so_module *so, uintptr_t range, uintptr_t dst, size_t sz) {
-	// Is address in range?
-	#define inrange(lsr, gtr, range) \
-		(((uintptr_t)(range) == (uintptr_t)NULL) || ((uintptr_t)(range) >= ((uintptr_t)(gtr) - (uintptr_t)(lsr))))
-	// Space left on block
-	#define blkavail(type) (so->type##_size - (so->type##_head - so->type##_base))
-	
-	// keep allocations 4-byte aligned for simplicity
-	sz = ALIGN_MEM(sz, 4);
-
-	if (sz <= (blkavail(patch)) && inrange(so->patch_base, dst, range)) {
-		so->patch_head += sz;
-		return (so->patch_head - sz);
-	} else if (sz <= (blkavail(cave)) && inrange(dst, so->cave_base, range)) {
-		so->cave_head += sz;
-		return (so->cave_head - sz);
+ * Relocation: so_relocate and so_resolve fused into a single pass over .rel.dyn
+ * and .rel.plt, so every slot is read and written once. Imports found neither in
+ * default_dynlib nor in the needed modules are deferred to the vitaGL fallback at
+ * the end of the pass, as that lookup memoizes into the import index.
+ */
+typedef struct {
+	so_module *mod;
+	int default_dynlib_only;
+	Elf32_Rel **deferred;
+	int num_deferred, cap_deferred;
+	int bad_type; // first unknown relocation type, 0 if none
+} so_reloc_job;
+
+static void so_reloc_defer(so_reloc_job *job, Elf32_Rel *rel) {
+	if (job->num_deferred == job->cap_deferred) {
+		job->cap_deferred = job->cap_deferred ? job->cap_deferred * 2 : 64;
+		job->deferred = realloc(job->deferred, job->cap_deferred * sizeof(Elf32_Rel *));
 	}
+	job->deferred[job->num_deferred++] = rel;
+}
 
-	return (uintptr_t)NULL;
+// *ptr += base over a run of R_ARM_RELATIVE entries, four at a time where targets are contiguous
+static void so_reloc_relative(uintptr_t base, const Elf32_Rel *rel, int num) {
+	int i = 0;
+#ifdef __ARM_NEON
+	static const uint32_t steps[4] = { 0, 4, 8, 12 };
+	uint32x4_t vbase = vdupq_n_u32(base);
+	uint32x4_t vsteps = vld1q_u32(steps);
+	while (i + 4 <= num) {
+		uint32x4_t offs = vld2q_u32((const uint32_t *)&rel[i]).val[0];
+		uint32x4_t eq = vceqq_u32(offs, vaddq_u32(vdupq_n_u32(rel[i].r_offset), vsteps));
+		uint32x2_t all = vpmin_u32(vget_low_u32(eq), vget_high_u32(eq));
+		if (vget_lane_u32(vpmin_u32(all, all), 0)) {
+			uint32_t *ptr = (uint32_t *)(base + rel[i].r_offset);
+			vst1q_u32(ptr, vaddq_u32(vld1q_u32(ptr), vbase));
+			i += 4;
+		} else {
+			*(uintptr_t *)(base + rel[i].r_offset) += base;
+			i++;
+		}
+	}
+#endif
+	for (; i < num; i++)
+		*(uintptr_t *)(base + rel[i].r_offset) += base;
 }
 
-static void trampoline_ldm(so_module *mod, uint32_t *dst) {
-	uint32_t trampoline[1];
-	uint32_t funct[20] = {0xFAFAFAFA};
-	uint32_t *ptr = funct;
+static void so_reloc_run(so_reloc_job *job, Elf32_Rel *rels, int num) {
+	so_module *mod = job->mod;
+	uintptr_t base = mod->text_base;
 
-	int cur = 0;
-	int baseReg = ((*dst) >> 16) & 0xF;
-	int bitMask = (*dst) & 0xFFFF;
+	for (int i = 0; i < num; i++) {
+		Elf32_Rel *rel = &rels[i];
+		int type = ELF32_R_TYPE(rel->r_info);
 
-	uint32_t stored = NULL;
-	for (int i = 0; i < 16; i++) {
-		if (bitMask & (1 << i)) {
-			// If the register we're reading the offset from is the same as the one we're writing,
-			// delay it to the very end so that the base pointer ins't clobbered
-			if (baseReg == i)
-				stored = LDR_OFFS(i, baseReg, cur).raw;
-			else
-				*ptr++ = LDR_OFFS(i, baseReg, cur).raw;
-			cur += 4;
+		if (type == R_ARM_RELATIVE) {
+			int j = i + 1;
+			while (j < num && ELF32_R_TYPE(rels[j].r_info) == R_ARM_RELATIVE)
+				j++;
+			so_reloc_relative(base, rel, j - i);
+			if (mod == cache_mod) {
+				for (int k = i; k < j; k++)
+					so_cache_record(mod, rels[k].r_offset, CACHE_ADD_BASE, 0);
+			}
+			i = j - 1;
+			continue;
 		}
-	}
 
-	// Perform the delayed load if needed
-	if (stored) {
-		*ptr++ = stored;
-	}
+		Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
+		uintptr_t *ptr = (uintptr_t *)(base + rel->r_offset);
+		switch (type) {
+		case R_ARM_ABS32:
+		case R_ARM_GLOB_DAT:
+		case R_ARM_JUMP_SLOT:
+		{
+			if (sym->st_shndx != SHN_UNDEF) {
+				if (type == R_ARM_ABS32)
+					*ptr += base + sym->st_value;
+				else
+					*ptr = base + sym->st_value;
+				so_cache_record(mod, rel->r_offset, type == R_ARM_ABS32 ? CACHE_ADD_BASE : CACHE_SET_BASE, sym->st_value);
+				break;
+			}
 
-	*ptr++ = 0xe51ff004; // LDR PC, [PC, -0x4] ; jmp to [dst+0x4]
-	*ptr++ = dst+1; // .dword <...>	; [dst+0x4]
+			if (type == R_ARM_JUMP_SLOT && mod->lazy_bind) {
+				*ptr = (uintptr_t)&so_lazy_stub;
+				so_cache_record(mod, rel->r_offset, CACHE_LAZY, 0);
+				break;
+			}
 
-	size_t trampoline_sz =	((uintptr_t)ptr - (uintptr_t)&funct[0]);
-	uintptr_t patch_addr = so_alloc_arena(mod, B_RANGE, B_OFFSET(dst), trampoline_sz);
+			so_dynlib_entry *e = so_dynlib_lookup(mod->dynstr + sym->st_name);
+			if (e) {
+				*ptr = e->func;
+				so_rebind_note_add(mod, rel->r_offset, e->func);
+				so_cache_record(mod, rel->r_offset, CACHE_IMPORT, e->index);
+				break;
+			}
 
-	if (!patch_addr) {
-		fatal_error("Failed to patch LDMIA at 0x%08X, unable to allocate space.\n", dst);
+			uintptr_t link = job->default_dynlib_only ? 0 : so_resolve_link(mod, mod->dynstr + sym->st_name);
+			if (link) {
+				if (type == R_ARM_ABS32)
+					*ptr += link;
+				else
+					*ptr = link;
+				so_rebind_note_add(mod, rel->r_offset, link);
+				so_cache_record(mod, rel->r_offset, type == R_ARM_ABS32 ? CACHE_LINK_ADD : CACHE_LINK, sym->st_name);
+				break;
+			}
+
+			so_reloc_defer(job, rel);
+			break;
+		}
+		default:
+			if (!job->bad_type)
+				job->bad_type = type;
+			break;
+		}
+	}
+}
+
+int so_relocate_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only) {
+	so_dynlib_index_build(default_dynlib, size_default_dynlib / sizeof(so_default_dynlib));
+	so_link_needed(mod);
+	mod->dynlib = default_dynlib;
+	mod->num_dynlib = size_default_dynlib / sizeof(so_default_dynlib);
+	if (mod->lazy_bind && so_lazy_init(mod) < 0)
+		mod->lazy_bind = 0;
+
+	so_reloc_job job;
+	memset(&job, 0, sizeof(job));
+	job.mod = mod;
+	job.default_dynlib_only = default_dynlib_only;
+	so_reloc_run(&job, mod->reldyn, mod->num_reldyn);
+	so_reloc_run(&job, mod->relplt, mod->num_relplt);
+
+	// Left to the caller to report, this can run off the main thread
+	if (job.bad_type) {
+		printf("Error unknown relocation type %x\n", job.bad_type);
+		free(job.deferred);
+		return -1;
 	}
-	
-	// Create sign extended relative address rel_addr
-	trampoline[0] = B(dst, patch_addr).raw;
 
-	kuKernelCpuUnrestrictedMemcpy((void*)patch_addr, funct, trampoline_sz);
-	kuKernelCpuUnrestrictedMemcpy(dst, trampoline, sizeof(trampoline));
+	for (int i = 0; i < job.num_deferred; i++) {
+		Elf32_Rel *rel = job.deferred[i];
+		Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
+		int plt = ELF32_R_TYPE(rel->r_info) == R_ARM_JUMP_SLOT;
+		so_vgl_bind(mod, rel->r_offset, sym->st_name, plt);
+		so_cache_record(mod, rel->r_offset, plt ? CACHE_VGL_PLT : CACHE_VGL, sym->st_name);
+	}
+
+	free(job.deferred);
+	return 0;
 }
 
-uintptr_t so_symbol(so_module *mod, const char *symbol) {
-	int index = so_symbol_index(mod, symbol);
-	if (index == -1)
-		return NULL;
+static so_init_observer init_observer = NULL;
 
-	return mod->text_base + mod->dynsym[index].st_value;
+void so_set_init_observer(so_init_observer observer) {
+	init_observer = observer;
 }
 
-void so_symbol_fix_ldmia(so_module *mod, const char *symbol) {
-	// This is meant to work around crashes due to unaligned accesses (SIGBUS :/) due to certain
-	// kernels not having the fault trap enabled, e.g. certain RK3326 Odroid Go Advance clone distros.
+void so_initialize(so_module *mod) {
+	if (mod->initialized)
+		return;
+	mod->initialized = 1;
+
+	// Dependencies get their constructors run first
+	for (int i = 0; i < mod->n_needed; i++)
+		so_initialize(mod->needed[i]);
+
+	for (int i = 0; i < mod->num_init_array; i++) {
+		if (!mod->init_array[i])
+			continue;
+		if (init_observer)
+			init_observer(mod, (uintptr_t)mod->init_array[i], 0);
+		mod->init_array[i]();
+		if (init_observer)
+			init_observer(mod, (uintptr_t)mod->init_array[i], 1);
+	}
+}
+
+/*
+ * Symbol lookup: DT_GNU_HASH first (its Bloom filter rejects most misses without
+ * touching dynsym), then the SysV .hash. Modules carrying neither get an open
+ * addressing index over their defined symbols, built on first lookup.
+ */
+typedef struct so_sym_slot {
+	uint32_t hash;
+	uint32_t index; // 0 for empty slots, dynsym[0] is never defined
+} so_sym_slot;
+
+static uint32_t so_gnu_hash(const uint8_t *name) {
+	uint32_t h = 5381;
+	while (*name)
+		h = h * 33 + *name++;
+	return h;
+}
+
+static int so_symbol_defined(so_module *mod, int i, const char *symbol) {
+	return mod->dynsym[i].st_shndx != SHN_UNDEF && mod->dynsym[i].st_info != SHN_UNDEF && strcmp(mod->dynstr + mod->dynsym[i].st_name, symbol) == 0;
+}
+
+static int so_symbol_gnu_hash(so_module *mod, const char *symbol) {
+	uint32_t nbucket = mod->gnu_hash[0];
+	uint32_t symoffset = mod->gnu_hash[1];
+	uint32_t bloom_size = mod->gnu_hash[2];
+	uint32_t bloom_shift = mod->gnu_hash[3];
+	uint32_t *bloom = &mod->gnu_hash[4];
+	uint32_t *bucket = &bloom[bloom_size];
+	uint32_t *chain = &bucket[nbucket];
+
+	uint32_t h = so_gnu_hash((const uint8_t *)symbol);
+	uint32_t word = bloom[(h / 32) % bloom_size];
+	uint32_t mask = (1u << (h % 32)) | (1u << ((h >> bloom_shift) % 32));
+	if ((word & mask) != mask)
+		return -1;
+
+	uint32_t i = bucket[h % nbucket];
+	if (i < symoffset)
+		return -1;
+
+	// Chains are runs of symbols sharing a bucket, the low bit of the stored hash ends them
+	for (;; i++) {
+		uint32_t h2 = chain[i - symoffset];
+		if ((h | 1) == (h2 | 1) && so_symbol_defined(mod, i, symbol))
+			return i;
+		if (h2 & 1)
+			return -1;
+	}
+}
+
+static int so_symbol_sysv_hash(so_module *mod, const char *symbol) {
+	uint32_t hash = so_hash((const uint8_t *)symbol);
+	uint32_t nbucket = mod->hash[0];
+	uint32_t *bucket = &mod->hash[2];
+	uint32_t *chain = &bucket[nbucket];
+	for (int i = bucket[hash % nbucket]; i; i = chain[i]) {
+		if (so_symbol_defined(mod, i, symbol))
+			return i;
+	}
+	return -1;
+}
+
+static void so_symbol_index_build(so_module *mod) {
+	// Power of two size keeping the load factor under 1/2
+	uint32_t size = 64;
+	while (size < (uint32_t)mod->num_dynsym * 2)
+		size *= 2;
+	mod->sym_index = calloc(size, sizeof(so_sym_slot));
+	mod->sym_index_mask = size - 1;
+
+	for (int i = 1; i < mod->num_dynsym; i++) {
+		if (mod->dynsym[i].st_shndx == SHN_UNDEF || mod->dynsym[i].st_info == SHN_UNDEF)
+			continue;
+		uint32_t hash = so_hash((const uint8_t *)mod->dynstr + mod->dynsym[i].st_name);
+		uint32_t j = hash & mod->sym_index_mask;
+		while (mod->sym_index[j].index)
+			j = (j + 1) & mod->sym_index_mask;
+		mod->sym_index[j].hash = hash;
+		mod->sym_index[j].index = i;
+	}
+}
+
+static int so_symbol_index(so_module *mod, const char *symbol)
+{
+	if (mod->gnu_hash)
+		return so_symbol_gnu_hash(mod, symbol);
+	if (mod->hash)
+		return so_symbol_sysv_hash(mod, symbol);
+
+	if (!mod->sym_index)
+		so_symbol_index_build(mod);
+
+	uint32_t hash = so_hash((const uint8_t *)symbol);
+	for (uint32_t j = hash & mod->sym_index_mask; mod->sym_index[j].index; j = (j + 1) & mod->sym_index_mask) {
+		int i = mod->sym_index[j].index;
+		if (mod->sym_index[j].hash == hash && strcmp(mod->dynstr + mod->dynsym[i].st_name, symbol) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+static int so_arena_inrange(uintptr_t addr, uintptr_t dst, uintptr_t range) {
+	if (range == (uintptr_t)NULL)
+		return 1;
+	return (addr < dst ? dst - addr : addr - dst) <= range;
+}
+
+static so_arena *so_arena_add(so_module *mod, SceUID blockid, uintptr_t base, size_t size) {
+	so_arena *arena = &mod->arenas[mod->n_arenas++];
+	memset(arena, 0, sizeof(so_arena));
+	arena->blockid = blockid;
+	arena->base = base;
+	arena->size = size;
+	if (size) {
+		arena->free_list = malloc(sizeof(so_arena_range));
+		arena->free_list->next = NULL;
+		arena->free_list->addr = base;
+		arena->free_list->size = size;
+	}
+	return arena;
+}
+
+// Maps a new arena block next to the module, either under the lowest arena or past the last segment
+static so_arena *so_arena_grow(so_module *mod, uintptr_t range, uintptr_t dst, size_t sz) {
+	if (mod->n_arenas >= MAX_ARENAS)
+		return NULL;
+
+	size_t size = ALIGN_MEM(sz, PATCH_SZ);
+	uintptr_t lowest = mod->text_base, highest = mod->text_base + mod->text_size;
+	for (int i = 0; i < mod->n_data; i++) {
+		if (mod->data_base[i] + mod->data_size[i] > highest)
+			highest = mod->data_base[i] + mod->data_size[i];
+	}
+	for (int i = 0; i < mod->n_arenas; i++) {
+		if (mod->arenas[i].base < lowest)
+			lowest = mod->arenas[i].base;
+		if (mod->arenas[i].base + mod->arenas[i].size > highest)
+			highest = mod->arenas[i].base + mod->arenas[i].size;
+	}
+
+	uintptr_t candidates[2] = { (lowest & ~(PATCH_SZ - 1)) - size, ALIGN_MEM(highest, PATCH_SZ) };
+	for (int i = 0; i < 2; i++) {
+		if (!so_arena_inrange(candidates[i], dst, range) && !so_arena_inrange(candidates[i] + size - sz, dst, range))
+			continue;
+
+		SceUID blockid = so_block_alloc("rx_block", 1, candidates[i], size);
+		if (blockid < 0)
+			continue;
+
+		uintptr_t base;
+		so_block_info(blockid, &base, NULL);
+		printf("new patch arena: %zu bytes (@0x%08X).\n", size, (unsigned int)base);
+		return so_arena_add(mod, blockid, base, size);
+	}
+
+	return NULL;
+}
+
+// First fit within arena, taken from whichever end of a free range is in reach of dst
+static uintptr_t so_arena_take(so_arena *arena, uintptr_t range, uintptr_t dst, size_t sz) {
+	so_arena_range **prev = &arena->free_list;
+	for (so_arena_range *r = arena->free_list; r; prev = &r->next, r = r->next) {
+		if (r->size < sz)
+			continue;
+
+		uintptr_t addr;
+		if (so_arena_inrange(r->addr, dst, range)) {
+			addr = r->addr;
+			r->addr += sz;
+		} else if (so_arena_inrange(r->addr + r->size - sz, dst, range)) {
+			addr = r->addr + r->size - sz;
+		} else {
+			continue;
+		}
+
+		r->size -= sz;
+		if (!r->size) {
+			*prev = r->next;
+			free(r);
+		}
+
+		arena->used += sz;
+		if (arena->used > arena->peak)
+			arena->peak = arena->used;
+		arena->num_allocs++;
+		return addr;
+	}
+
+	return (uintptr_t)NULL;
+}
+
+/*
+ * alloc_arena: allocates space on the module arenas (patch blocks and .text cave),
+ * mapping a new patch block near the module if none has room
+ * range: maximum range from allocation to dst (ignored if NULL)
+ * dst: destination address
+*/
+uintptr_t so_alloc_arena(so_module *so, uintptr_t range, uintptr_t dst, size_t sz) {
+	// keep allocations 4-byte aligned for simplicity
+	sz = ALIGN_MEM(sz, 4);
+
+	for (int i = 0; i < so->n_arenas; i++) {
+		uintptr_t addr = so_arena_take(&so->arenas[i], range, dst, sz);
+		if (addr)
+			return addr;
+	}
+
+	so_arena *arena = so_arena_grow(so, range, dst, sz);
+	if (arena)
+		return so_arena_take(arena, range, dst, sz);
+
+	return (uintptr_t)NULL;
+}
+
+void so_free_arena(so_module *so, uintptr_t addr, size_t sz) {
+	sz = ALIGN_MEM(sz, 4);
+	if (!addr || !sz)
+		return;
+
+	for (int i = 0; i < so->n_arenas; i++) {
+		so_arena *arena = &so->arenas[i];
+		if (addr < arena->base || addr + sz > arena->base + arena->size)
+			continue;
+
+		// Insert sorted, merging with the neighbouring free ranges
+		so_arena_range **prev = &arena->free_list, *r = arena->free_list, *before = NULL;
+		while (r && r->addr < addr) {
+			before = r;
+			prev = &r->next;
+			r = r->next;
+		}
+
+		if (before && before->addr + before->size == addr) {
+			before->size += sz;
+			if (r && addr + sz == r->addr) {
+				before->size += r->size;
+				before->next = r->next;
+				free(r);
+			}
+		} else if (r && addr + sz == r->addr) {
+			r->addr = addr;
+			r->size += sz;
+		} else {
+			so_arena_range *n = malloc(sizeof(so_arena_range));
+			n->addr = addr;
+			n->size = sz;
+			n->next = r;
+			*prev = n;
+		}
+
+		arena->used -= sz;
+		arena->num_allocs--;
+		return;
+	}
+}
+
+void so_arena_stats(so_module *mod) {
+	for (int i = 0; i < mod->n_arenas; i++) {
+		so_arena *arena = &mod->arenas[i];
+		int num_free = 0;
+		size_t largest = 0;
+		for (so_arena_range *r = arena->free_list; r; r = r->next) {
+			num_free++;
+			if (r->size > largest)
+				largest = r->size;
+		}
+		printf("arena %d (@0x%08X%s): %zu/%zu bytes used, peak %zu, %d allocs, %d free ranges (largest %zu).\n",
+			i, (unsigned int)arena->base, arena->blockid ? "" : ", cave", arena->used, arena->size, arena->peak, arena->num_allocs, num_free, largest);
+	}
+}
+
+static int trampoline_ldm(so_module *mod, uint32_t *dst) {
+	uint32_t trampoline[1];
+	uint32_t funct[20] = {0xFAFAFAFA};
+	uint32_t *ptr = funct;
+
+	int cur = 0;
+	int baseReg = ((*dst) >> 16) & 0xF;
+	int bitMask = (*dst) & 0xFFFF;
+
+	uint32_t stored = 0;
+	for (int i = 0; i < 16; i++) {
+		if (bitMask & (1 << i)) {
+			// If the register we're reading the offset from is the same as the one we're writing,
+			// delay it to the very end so that the base pointer ins't clobbered
+			if (baseReg == i)
+				stored = LDR_OFFS(i, baseReg, cur).raw;
+			else
+				*ptr++ = LDR_OFFS(i, baseReg, cur).raw;
+			cur += 4;
+		}
+	}
+
+	// Perform the delayed load if needed
+	if (stored) {
+		*ptr++ = stored;
+	}
+
+	*ptr++ = 0xe51ff004; // LDR PC, [PC, -0x4] ; jmp to [dst+0x4]
+	*ptr++ = (uint32_t)(dst + 1); // .dword <...>	; [dst+0x4]
+
+	size_t trampoline_sz =	((uintptr_t)ptr - (uintptr_t)&funct[0]);
+	uintptr_t patch_addr = so_alloc_arena(mod, B_RANGE, B_OFFSET(dst), trampoline_sz);
+
+	if (!patch_addr) {
+		printf("Failed to patch LDMIA at 0x%08X, unable to allocate space.\n", (unsigned int)dst);
+		return -1;
+	}
+	
+	// Create sign extended relative address rel_addr
+	trampoline[0] = B(dst, patch_addr).raw;
+
+	so_patch_write(patch_addr, funct, trampoline_sz);
+	so_patch_write((uintptr_t)dst, trampoline, sizeof(trampoline));
+	return 0;
+}
+
+static int trampoline_ldrd(so_module *mod, uint32_t *dst) {
+	uint32_t trampoline[1];
+	uint32_t funct[4];
+	uint32_t *ptr = funct;
+
+	int baseReg = ((*dst) >> 16) & 0xF;
+	int reg = ((*dst) >> 12) & 0xF;
+	int lo = (((*dst) >> 4) & 0xF0) | ((*dst) & 0xF);
+	if (!((*dst) & 0x00800000))
+		lo = -lo;
+	int hi = lo + 4;
+
+	// Same as LDM: if the base register is overwritten, load it last
+	if (reg == baseReg) {
+		*ptr++ = LDR_OFFS(reg + 1, baseReg, hi).raw;
+		*ptr++ = LDR_OFFS(reg, baseReg, lo).raw;
+	} else {
+		*ptr++ = LDR_OFFS(reg, baseReg, lo).raw;
+		*ptr++ = LDR_OFFS(reg + 1, baseReg, hi).raw;
+	}
+
+	*ptr++ = 0xe51ff004; // LDR PC, [PC, -0x4] ; jmp to [dst+0x4]
+	*ptr++ = (uint32_t)(dst + 1); // .dword <...>	; [dst+0x4]
+
+	uintptr_t patch_addr = so_alloc_arena(mod, B_RANGE, B_OFFSET(dst), sizeof(funct));
+	if (!patch_addr)
+		return -1;
+
+	trampoline[0] = B(dst, patch_addr).raw;
+
+	so_patch_write(patch_addr, funct, sizeof(funct));
+	so_patch_write((uintptr_t)dst, trampoline, sizeof(trampoline));
+	return 0;
+}
+
+// Thumb-2 LDM/LDRD, split into LDR.W in a trampoline reached through B.W
+static int trampoline_thumb_load(so_module *mod, uintptr_t dst) {
+	uint16_t hw1 = *(uint16_t *)dst, hw2 = *(uint16_t *)(dst + 2);
+	int baseReg = hw1 & 0xF;
+	int regs[16], offs[16], n = 0;
+
+	if ((hw1 & 0xFE50) == 0xE850) {
+		// LDRD Rt, Rt2, [Rn, #imm8]
+		int imm = (hw1 & 0x80) ? (hw2 & 0xFF) * 4 : -(hw2 & 0xFF) * 4;
+		regs[n] = hw2 >> 12;
+		offs[n++] = imm;
+		regs[n] = (hw2 >> 8) & 0xF;
+		offs[n++] = imm + 4;
+	} else {
+		// LDMIA/LDMDB Rn, {...}
+		int cur = ((hw1 & 0xFF80) == 0xE900) ? -4 * __builtin_popcount(hw2) : 0;
+		for (int i = 0; i < 16; i++) {
+			if (hw2 & (1 << i)) {
+				regs[n] = i;
+				offs[n++] = cur;
+				cur += 4;
+			}
+		}
+	}
+
+	// Negative offsets only have the 8-bit LDR.W form
+	for (int i = 0; i < n; i++) {
+		if (offs[i] < -255)
+			return -1;
+	}
+
+	thumb_emitter t;
+	t.base = so_alloc_arena(mod, T_B_RANGE, dst + 4, TRAMPOLINE_THUMB_SZ);
+	t.n = 0;
+	if (!t.base)
+		return -1;
+
+	int stored = -1;
+	for (int i = 0; i < n; i++) {
+		if (regs[i] == baseReg)
+			stored = i;
+		else
+			t_ldr(&t, regs[i], baseReg, offs[i]);
+	}
+	if (stored >= 0)
+		t_ldr(&t, regs[stored], baseReg, offs[stored]);
+	t_jump(&t, (dst + 4) | 1);
+
+	size_t size = ALIGN_MEM(t.n * 2, 4);
+	so_free_arena(mod, t.base + size, TRAMPOLINE_THUMB_SZ - size);
+
+	uint16_t trampoline[2];
+	T_B(trampoline, dst, t.base);
+	so_patch_write(t.base, t.code, t.n * 2);
+	so_patch_write(dst, trampoline, sizeof(trampoline));
+	return 0;
+}
+
+int so_fix_misaligned(so_module *mod, uintptr_t addr, int kind, int thumb) {
+	int res = 0;
+
+	if (kind == SCAN_VLD) {
+		// Dropping the alignment qualifier is enough, the access is then allowed to be unaligned
+		if (thumb) {
+			uint16_t hw2 = *(uint16_t *)(addr + 2) & ~0x30;
+			so_patch_write(addr + 2, &hw2, sizeof(hw2));
+		} else {
+			uint32_t instr = *(uint32_t *)addr & ~0x30;
+			so_patch_write(addr, &instr, sizeof(instr));
+		}
+	} else if (thumb) {
+		res = trampoline_thumb_load(mod, addr);
+	} else if (kind == SCAN_LDRD) {
+		res = trampoline_ldrd(mod, (uint32_t *)addr);
+	} else {
+		res = trampoline_ldm(mod, (uint32_t *)addr);
+	}
+
+	if (res == 0)
+		so_cache_record_fix(mod, addr, kind | (thumb << 2));
+	return res;
+}
+
+uintptr_t so_symbol(so_module *mod, const char *symbol) {
+	int index = so_symbol_index(mod, symbol);
+	if (index == -1)
+		return 0;
+
+	return mod->text_base + mod->dynsym[index].st_value;
+}
+
+/*
+ * Reverse lookup: defined functions sorted by start offset, so any PC maps to
+ * its symbol in O(log n). Symbols without a size extend up to the next one.
+ */
+typedef struct so_addr_entry {
+	uint32_t start; // offset from text_base, Thumb bit cleared
+	uint32_t size;
+	uint32_t name; // offset into dynstr
+} so_addr_entry;
+
+static int so_addr_cmp(const void *a, const void *b) {
+	const so_addr_entry *x = a, *y = b;
+	if (x->start != y->start)
+		return x->start < y->start ? -1 : 1;
+	return x->size > y->size ? -1 : x->size < y->size;
+}
+
+static void so_addr_index_build(so_module *mod) {
+	so_addr_entry *index = malloc(mod->num_dynsym * sizeof(so_addr_entry));
+	int num = 0;
+	for (int i = 0; i < mod->num_dynsym; i++) {
+		Elf32_Sym *sym = &mod->dynsym[i];
+		if (ELF32_ST_TYPE(sym->st_info) != STT_FUNC || sym->st_shndx == SHN_UNDEF)
+			continue;
+		index[num].start = sym->st_value & ~1;
+		index[num].size = sym->st_size;
+		index[num].name = sym->st_name;
+		num++;
+	}
+	qsort(index, num, sizeof(so_addr_entry), so_addr_cmp);
+
+	// Aliases share a start, keep the largest one
+	int n = 0;
+	for (int i = 0; i < num; i++) {
+		if (n && index[n - 1].start == index[i].start)
+			continue;
+		index[n++] = index[i];
+	}
+
+	mod->addr_index = realloc(index, (n ? n : 1) * sizeof(so_addr_entry));
+	mod->num_addr_index = n;
+}
+
+// The index is built on first use, call it once outside of exception handlers
+const char *so_addr2sym(so_module *mod, uintptr_t addr, uintptr_t *offset) {
+	if (!mod->addr_index)
+		so_addr_index_build(mod);
+
+	// Last entry starting at or before addr
+	uint32_t off = addr - mod->text_base;
+	int lo = 0, hi = mod->num_addr_index - 1, best = -1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (mod->addr_index[mid].start <= off) {
+			best = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	if (best < 0 || off >= mod->text_size)
+		return NULL;
+
+	so_addr_entry *e = &mod->addr_index[best];
+	if (e->size && off - e->start >= e->size)
+		return NULL;
+
+	if (offset)
+		*offset = off - e->start;
+	return mod->dynstr + e->name;
+}
+
+void so_symbol_fix_ldmia(so_module *mod, const char *symbol) {
+	// This is meant to work around crashes due to unaligned accesses (SIGBUS :/) due to certain
+	// kernels not having the fault trap enabled, e.g. certain RK3326 Odroid Go Advance clone distros.
 	// TODO:: Maybe enable this only with a config flag? maybe with a list of known broken functions?
 	// Known to trigger on GM:S's "_Z11Shader_LoadPhjS_" - if it starts happening on other places,
 	// might be worth enabling it globally.
@@ -651,8 +2580,787 @@ void so_symbol_fix_ldmia(so_module *mod, const char *symbol) {
 		
 		//Is this an LDMIA instruction with a R0-R12 base register?
 		if (((inst & 0xFFF00000) == 0xE8900000) && (((inst >> 16) & 0xF) < 13) ) {
-			debugPrintf("Found possibly misaligned LDMIA on 0x%08X, trying to fix it... (instr: 0x%08X, to 0x%08X)\n", addr, *(uint32_t*)addr, mod->patch_head);
-			trampoline_ldm(mod, addr);
+			debugPrintf("Found possibly misaligned LDMIA on 0x%08X, trying to fix it... (instr: 0x%08X)\n", addr, *(uint32_t*)addr);
+			so_fix_misaligned(mod, addr, SCAN_LDM, 0);
+		}
+	}
+}
+
+static int so_scan_cmp_func(const void *a, const void *b) {
+	uintptr_t x = *(const uintptr_t *)a & ~1, y = *(const uintptr_t *)b & ~1;
+	return x < y ? -1 : x > y;
+}
+
+int so_scan_misaligned(so_module *mod, int fix) {
+	static const char *kinds[] = { "LDM", "LDRD", "VLDn" };
+	int counts[3] = {0}, num = 0, num_funcs = 0, num_fixed = 0;
+
+	// Function bounds from dynsym as (address | thumb, size) pairs, aliases are skipped once sorted
+	uintptr_t *funcs = malloc(mod->num_dynsym * 2 * sizeof(uintptr_t));
+	if (!funcs)
+		return -1;
+	for (int i = 0; i < mod->num_dynsym; i++) {
+		Elf32_Sym *sym = &mod->dynsym[i];
+		if (ELF32_ST_TYPE(sym->st_info) != STT_FUNC || sym->st_shndx == SHN_UNDEF || !sym->st_size)
+			continue;
+		if ((sym->st_value & ~1) + sym->st_size > mod->text_size)
+			continue;
+		funcs[num * 2 + 0] = mod->text_base + sym->st_value;
+		funcs[num * 2 + 1] = sym->st_size;
+		num++;
+	}
+	qsort(funcs, num, 2 * sizeof(uintptr_t), so_scan_cmp_func);
+
+	so_scan s;
+	so_scan_init(&s);
+	uintptr_t end = 0;
+	for (int i = 0; i < num; i++) {
+		uintptr_t start = funcs[i * 2] & ~1;
+		size_t size = funcs[i * 2 + 1];
+		if (start < end)
+			continue;
+		end = start + size;
+		if (funcs[i * 2] & 1)
+			so_scan_thumb(&s, (uint16_t *)start, size, start);
+		else
+			so_scan_arm(&s, (uint32_t *)start, size, start);
+		num_funcs++;
+	}
+	free(funcs);
+
+	for (int i = 0; i < s.num_sites; i++) {
+		so_scan_site *site = &s.sites[i];
+		counts[site->kind]++;
+		debugPrintf("Possibly misaligned %s%s at 0x%08X (instr: 0x%08X)%s\n", kinds[site->kind], site->thumb ? " (thumb)" : "",
+			site->addr, site->instr, site->fixable ? "" : ", not fixable");
+		if (fix && site->fixable && so_fix_misaligned(mod, site->addr, site->kind, site->thumb) == 0)
+			num_fixed++;
+	}
+
+	printf("misaligned load scan: %d functions, %d LDM, %d LDRD, %d VLDn, %d fixed.\n", num_funcs, counts[SCAN_LDM], counts[SCAN_LDRD], counts[SCAN_VLD], num_fixed);
+	num = s.num_sites;
+	so_scan_free(&s);
+	return num;
+}
+
+int so_hook_symbols(so_module *mod, so_default_hook *default_hooks, int size_default_hooks) {
+	int num = size_default_hooks / sizeof(so_default_hook);
+	int missing = 0;
+	for (int i = 0; i < num; i++) {
+		uintptr_t addr = so_symbol(mod, default_hooks[i].symbol);
+		if (mod == cache_mod && i < cache_num_hooks)
+			cache_hooks[i] = addr ? addr - mod->text_base : 0;
+		if (!addr) {
+			printf("Missing hook target: %s\n", default_hooks[i].symbol);
+			missing++;
+			continue;
+		}
+		so_hook h = hook_addr(addr, default_hooks[i].func);
+		if (default_hooks[i].hook)
+			*default_hooks[i].hook = h;
+	}
+
+	return missing;
+}
+
+static uint32_t so_cache_signature(void *table, int num, size_t stride) {
+	// Tables are matched by symbol names only, function addresses are taken from the running build
+	uint32_t sig = num;
+	for (int i = 0; i < num; i++)
+		sig = sig * 31 + so_hash(*(const uint8_t **)((uintptr_t)table + i * stride));
+	return sig;
+}
+
+// Loaded dependencies change which imports resolve to them, so they're part of the cache key (as is lazy binding)
+static uint32_t so_cache_needed_signature(so_module *mod) {
+	uint32_t sig = mod->n_needed | (mod->lazy_bind << 31);
+	for (int i = 0; i < mod->n_needed; i++) {
+		sig = sig * 31 + so_hash((const uint8_t *)mod->needed[i]->soname);
+		for (int j = 0; j < SHA1_BLOCK_SIZE; j++)
+			sig = sig * 31 + mod->needed[i]->sha1[j];
+	}
+	return sig;
+}
+
+/*
+ * so_cache_begin: starts recording relocation, import resolution and hooking
+ * outcomes for mod, to be written out with so_cache_save once patching is done.
+ */
+void so_cache_begin(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, so_default_hook *default_hooks, int size_default_hooks) {
+	cache_mod = mod;
+	cache_num_patches = 0;
+	cache_num_fixes = 0;
+	cache_num_hooks = size_default_hooks / sizeof(so_default_hook);
+	cache_hooks = realloc(cache_hooks, (cache_num_hooks + 1) * sizeof(uint32_t));
+	memset(cache_hooks, 0, cache_num_hooks * sizeof(uint32_t));
+	so_link_needed(mod);
+	cache_dynlib_sig = so_cache_signature(default_dynlib, size_default_dynlib / sizeof(so_default_dynlib), sizeof(so_default_dynlib)) ^ so_cache_needed_signature(mod);
+	cache_hooks_sig = so_cache_signature(default_hooks, cache_num_hooks, sizeof(so_default_hook));
+}
+
+static void so_cache_end(void) {
+	free(cache_patches);
+	free(cache_hooks);
+	free(cache_fixes);
+	cache_patches = NULL;
+	cache_hooks = cache_fixes = NULL;
+	cache_num_patches = cache_cap_patches = cache_num_hooks = cache_num_fixes = cache_cap_fixes = 0;
+	cache_mod = NULL;
+}
+
+int so_cache_save(so_module *mod, const char *filename) {
+	if (mod != cache_mod)
+		return -1;
+
+	so_cache_header hdr;
+	hdr.magic = CACHE_MAGIC;
+	memcpy(hdr.sha1, mod->sha1, SHA1_BLOCK_SIZE);
+	hdr.dynlib_sig = cache_dynlib_sig;
+	hdr.hooks_sig = cache_hooks_sig;
+	hdr.num_patches = cache_num_patches;
+	hdr.num_hooks = cache_num_hooks;
+	hdr.num_fixes = cache_num_fixes;
+
+	int res = -1;
+	SceUID fd = sceIoOpen(filename, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (fd >= 0) {
+		if (sceIoWrite(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+			sceIoWrite(fd, cache_patches, cache_num_patches * sizeof(so_cache_patch)) == (int)(cache_num_patches * sizeof(so_cache_patch)) &&
+			sceIoWrite(fd, cache_hooks, cache_num_hooks * sizeof(uint32_t)) == (int)(cache_num_hooks * sizeof(uint32_t)) &&
+			sceIoWrite(fd, cache_fixes, cache_num_fixes * sizeof(uint32_t)) == (int)(cache_num_fixes * sizeof(uint32_t)))
+			res = 0;
+		sceIoClose(fd);
+		if (res < 0)
+			sceIoRemove(filename);
+	}
+
+	printf("relocation cache: %d patches, %d hooks, %d fixes (%s).\n", cache_num_patches, cache_num_hooks, cache_num_fixes, res < 0 ? "not saved" : "saved");
+	so_cache_end();
+	return res;
+}
+
+/*
+ * so_cache_load: replays a cache written by so_cache_save in place of so_relocate,
+ * so_resolve and symbol hooking. Fails without touching mod if the cache doesn't
+ * match the loaded .so or the import/hook tables, so the caller can take the full path.
+ */
+int so_cache_load(so_module *mod, const char *filename, so_default_dynlib *default_dynlib, int size_default_dynlib, so_default_hook *default_hooks, int size_default_hooks) {
+	int num_dynlib = size_default_dynlib / sizeof(so_default_dynlib);
+	int num_hooks = size_default_hooks / sizeof(so_default_hook);
+	so_cache_header hdr;
+
+	so_link_needed(mod);
+	if (mod->lazy_bind && so_lazy_init(mod) < 0)
+		mod->lazy_bind = 0;
+	SceUID fd = sceIoOpen(filename, SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return fd;
+
+	if (sceIoRead(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+		hdr.magic != CACHE_MAGIC ||
+		memcmp(hdr.sha1, mod->sha1, SHA1_BLOCK_SIZE) != 0 ||
+		hdr.dynlib_sig != (so_cache_signature(default_dynlib, num_dynlib, sizeof(so_default_dynlib)) ^ so_cache_needed_signature(mod)) ||
+		hdr.hooks_sig != so_cache_signature(default_hooks, num_hooks, sizeof(so_default_hook)) ||
+		hdr.num_hooks != (uint32_t)num_hooks) {
+		sceIoClose(fd);
+		return -1;
+	}
+
+	size_t size = hdr.num_patches * sizeof(so_cache_patch) + (hdr.num_hooks + hdr.num_fixes) * sizeof(uint32_t);
+	so_cache_patch *patches = malloc(size);
+	int read = sceIoRead(fd, patches, size);
+	sceIoClose(fd);
+	if (read != (int)size) {
+		free(patches);
+		return -1;
+	}
+	uint32_t *hooks = (uint32_t *)&patches[hdr.num_patches];
+	uint32_t *fixes = &hooks[hdr.num_hooks];
+
+	so_dynlib_index_build(default_dynlib, num_dynlib);
+	mod->dynlib = default_dynlib;
+	mod->num_dynlib = num_dynlib;
+
+	for (uint32_t i = 0; i < hdr.num_patches; i++) {
+		uintptr_t *ptr = (uintptr_t *)(mod->text_base + (patches[i].info & CACHE_OFFSET_MASK));
+		uint32_t value = patches[i].value;
+		switch (patches[i].info >> CACHE_KIND_SHIFT) {
+		case CACHE_ADD_BASE:
+			*ptr += mod->text_base + value;
+			break;
+		case CACHE_SET_BASE:
+			*ptr = mod->text_base + value;
+			break;
+		case CACHE_IMPORT:
+			if (value < (uint32_t)num_dynlib) {
+				*ptr = default_dynlib[value].func;
+				so_rebind_note_add(mod, (uintptr_t)ptr - mod->text_base, *ptr);
+			}
+			break;
+		case CACHE_VGL:
+		case CACHE_VGL_PLT:
+			so_vgl_bind(mod, patches[i].info & CACHE_OFFSET_MASK, value, (patches[i].info >> CACHE_KIND_SHIFT) == CACHE_VGL_PLT);
+			break;
+		case CACHE_LINK:
+			*ptr = so_resolve_link(mod, mod->dynstr + value);
+			so_rebind_note_add(mod, (uintptr_t)ptr - mod->text_base, *ptr);
+			break;
+		case CACHE_LINK_ADD:
+		{
+			uintptr_t link = so_resolve_link(mod, mod->dynstr + value);
+			*ptr += link;
+			so_rebind_note_add(mod, (uintptr_t)ptr - mod->text_base, link);
+			break;
+		}
+		case CACHE_PLT0:
+			*ptr = (uintptr_t)&plt0_stub;
+			break;
+		case CACHE_LAZY:
+			*ptr = (uintptr_t)&so_lazy_stub;
+			break;
+		default:
+			break;
+		}
+	}
+
+	for (int i = 0; i < num_hooks; i++) {
+		if (!hooks[i])
+			continue;
+		so_hook h = hook_addr(mod->text_base + hooks[i], default_hooks[i].func);
+		if (default_hooks[i].hook)
+			*default_hooks[i].hook = h;
+	}
+
+	for (uint32_t i = 0; i < hdr.num_fixes; i++) {
+		int kind = fixes[i] >> CACHE_KIND_SHIFT;
+		so_fix_misaligned(mod, mod->text_base + (fixes[i] & CACHE_OFFSET_MASK), kind & 3, kind >> 2);
+	}
+
+	printf("relocation cache: applied %d patches, %d hooks, %d fixes.\n", hdr.num_patches, hdr.num_hooks, hdr.num_fixes);
+	free(patches);
+	return 0;
+}
+
+/*
+ * Prelinked image: the module as it stands after relocation, resolution, hooking
+ * and misaligned load fixes, dumped block by block at its final addresses along
+ * with the few slots that point into the loader (imports, hook targets, stubs).
+ * Later boots map it back with one sequential read and only redo those slots,
+ * without touching the .so or parsing any ELF structure. Images are keyed on the
+ * SHA-1 of the .so, which is only taken again when its size or mtime changed
+ * (e.g. on the first boot with an image made by so_prelink).
+ */
+#define IMAGE_MAGIC 0x32494F53 // SOI2
+
+typedef struct {
+	uint32_t magic;
+	uint32_t hdr_size;
+	uint32_t so_stat; // size and mtime of the .so when it was last found to match sha1
+	uint32_t dynlib_sig;
+	uint32_t hooks_sig;
+	uint32_t needed_sig;
+	uint32_t num_blocks; // .text, data segments, then mapped arenas
+	uint32_t num_arenas;
+	uint32_t num_ranges;
+	uint32_t num_hooks;
+	uint32_t num_fixups;
+
+	uint32_t text_base, text_size;
+	uint32_t data_base[MAX_DATA_SEG], data_size[MAX_DATA_SEG];
+	uint32_t n_data;
+	uint32_t dynamic, dynsym, reldyn, relplt, init_array, hash, gnu_hash, exidx, dynstr, soname;
+	uint32_t num_dynamic, num_dynsym, num_reldyn, num_relplt, num_init_array, num_exidx;
+	uint8_t sha1[SHA1_BLOCK_SIZE];
+} so_image_header;
+
+typedef struct {
+	uint32_t base;
+	uint32_t size;
+} so_image_block;
+
+typedef struct {
+	uint32_t base, size;
+	uint32_t used, peak, num_allocs;
+	uint32_t num_ranges;
+	uint32_t mapped; // 0 for the .text padding cave
+} so_image_arena;
+
+static uint32_t so_image_file_signature(uint32_t sig, const char *filename) {
+	SceIoStat stat;
+	if (sceIoGetstat(filename, &stat) < 0)
+		return sig * 31;
+
+	const uint8_t *mtime = (const uint8_t *)&stat.st_mtime;
+	sig = sig * 31 + (uint32_t)stat.st_size;
+	for (size_t i = 0; i < sizeof(stat.st_mtime); i++)
+		sig = sig * 31 + mtime[i];
+	return sig;
+}
+
+// Dependencies are keyed by their files too, they're still loaded the regular way after the image
+static uint32_t so_image_needed_signature(so_module *mod, const char *path) {
+	uint32_t sig = mod->lazy_bind;
+	for (int i = 0; i < mod->num_dynamic; i++) {
+		if (mod->dynamic[i].d_tag != DT_NEEDED)
+			continue;
+
+		char fname[256];
+		const char *name = mod->dynstr + mod->dynamic[i].d_un.d_ptr;
+		so_find_file(fname, sizeof(fname), path, name);
+		sig = so_image_file_signature(sig * 31 + so_hash((const uint8_t *)name), fname);
+	}
+	return sig;
+}
+
+// Where a hook writes its target, the word following LDR PC
+static uintptr_t so_image_hook_literal(uintptr_t addr) {
+	if (addr & 1) {
+		addr &= ~1;
+		if (addr & 2)
+			addr += 2;
+	}
+	return addr + 4;
+}
+
+static void so_image_poke(uintptr_t addr, uintptr_t value) {
+	so_memcpy_rx((void *)addr, &value, sizeof(value));
+}
+
+/*
+ * so_image_save: writes the prelinked image of mod, to be called once patching
+ * is committed and before so_initialize (constructors would leave their state in it).
+ */
+int so_image_save(so_module *mod, const char *filename, const char *so_path, const char *needed_path, so_default_dynlib *default_dynlib, int size_default_dynlib, so_default_hook *default_hooks, int size_default_hooks) {
+	int num_dynlib = size_default_dynlib / sizeof(so_default_dynlib);
+	int num_hooks = size_default_hooks / sizeof(so_default_hook);
+	so_image_header hdr;
+	so_image_block blocks[1 + MAX_DATA_SEG + MAX_ARENAS];
+	so_image_arena arenas[MAX_ARENAS];
+	so_image_block *ranges = NULL;
+	so_hook *hooks = NULL;
+	so_cache_patch *fixups = NULL;
+	int num_fixups = 0, cap_fixups = 0;
+	int res = -1;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = IMAGE_MAGIC;
+	hdr.hdr_size = sizeof(so_image_header);
+	hdr.so_stat = so_image_file_signature(0, so_path);
+	hdr.dynlib_sig = so_cache_signature(default_dynlib, num_dynlib, sizeof(so_default_dynlib));
+	hdr.hooks_sig = so_cache_signature(default_hooks, num_hooks, sizeof(so_default_hook));
+	hdr.needed_sig = so_image_needed_signature(mod, needed_path);
+
+	// Whole memory blocks, so the .text padding and alignment gaps come along
+	SceUID blockids[1 + MAX_DATA_SEG];
+	blockids[0] = mod->text_blockid;
+	for (int i = 0; i < mod->n_data; i++)
+		blockids[i + 1] = mod->data_blockid[i];
+	for (int i = 0; i <= mod->n_data; i++) {
+		uintptr_t base;
+		size_t size;
+		if (so_block_info(blockids[i], &base, &size) < 0)
+			return -1;
+		blocks[hdr.num_blocks].base = base;
+		blocks[hdr.num_blocks].size = size;
+		hdr.num_blocks++;
+	}
+
+	for (int i = 0; i < mod->n_arenas; i++) {
+		so_arena *arena = &mod->arenas[i];
+		arenas[i].base = arena->base;
+		arenas[i].size = arena->size;
+		arenas[i].used = arena->used;
+		arenas[i].peak = arena->peak;
+		arenas[i].num_allocs = arena->num_allocs;
+		arenas[i].mapped = arena->blockid > 0;
+		arenas[i].num_ranges = 0;
+		for (so_arena_range *r = arena->free_list; r; r = r->next) {
+			ranges = realloc(ranges, (hdr.num_ranges + 1) * sizeof(so_image_block));
+			ranges[hdr.num_ranges].base = r->addr;
+			ranges[hdr.num_ranges].size = r->size;
+			hdr.num_ranges++;
+			arenas[i].num_ranges++;
+		}
+		if (arenas[i].mapped) {
+			blocks[hdr.num_blocks].base = arena->base;
+			blocks[hdr.num_blocks].size = arena->size;
+			hdr.num_blocks++;
+		}
+	}
+	hdr.num_arenas = mod->n_arenas;
+
+	// Hook targets live in the loader, the rest of the hook state is at fixed addresses
+	hooks = calloc(num_hooks + 1, sizeof(so_hook));
+	for (int i = 0; i < num_hooks; i++) {
+		uintptr_t addr = so_symbol(mod, default_hooks[i].symbol);
+		if (!addr)
+			continue;
+		if (default_hooks[i].hook)
+			hooks[i] = *default_hooks[i].hook;
+		hooks[i].addr = so_image_hook_literal(addr) - 4;
+		hooks[i].thumb_addr = addr & 1 ? addr : 0;
+	}
+	hdr.num_hooks = num_hooks;
+
+	// Classify import slots by what they ended up pointing to
+	so_dynlib_index_build(default_dynlib, num_dynlib);
+	for (int i = 0; i < mod->num_reldyn + mod->num_relplt; i++) {
+		Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
+		Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
+		int type = ELF32_R_TYPE(rel->r_info);
+		if (sym->st_shndx != SHN_UNDEF || (type != R_ARM_ABS32 && type != R_ARM_GLOB_DAT && type != R_ARM_JUMP_SLOT))
+			continue;
+
+		const char *name = mod->dynstr + sym->st_name;
+		uintptr_t slot = *(uintptr_t *)(mod->text_base + rel->r_offset);
+		uint32_t value = sym->st_name;
+		so_dynlib_entry *e;
+		int kind;
+		if (slot == (uintptr_t)&plt0_stub) {
+			kind = CACHE_PLT0;
+		} else if (slot == (uintptr_t)&so_lazy_stub) {
+			kind = CACHE_LAZY;
+		} else if ((e = so_dynlib_lookup(name)) && slot == e->func) {
+			kind = CACHE_IMPORT;
+			value = e->index;
+		} else if (so_resolve_link(mod, name)) {
+			kind = type == R_ARM_ABS32 ? CACHE_LINK_ADD : CACHE_LINK;
+		} else if (so_vgl_pending(mod, rel->r_offset) || (!vgl_deferred && slot && slot == so_dynlib_vgl_lookup(name))) {
+			kind = type == R_ARM_JUMP_SLOT ? CACHE_VGL_PLT : CACHE_VGL;
+		} else {
+			continue;
+		}
+
+		if (num_fixups == cap_fixups) {
+			cap_fixups = cap_fixups ? cap_fixups * 2 : 0x400;
+			fixups = realloc(fixups, cap_fixups * sizeof(so_cache_patch));
+		}
+		fixups[num_fixups].info = (rel->r_offset & CACHE_OFFSET_MASK) | (kind << CACHE_KIND_SHIFT);
+		fixups[num_fixups].value = value;
+		num_fixups++;
+	}
+	hdr.num_fixups = num_fixups;
+
+	hdr.text_base = mod->text_base;
+	hdr.text_size = mod->text_size;
+	hdr.n_data = mod->n_data;
+	for (int i = 0; i < mod->n_data; i++) {
+		hdr.data_base[i] = mod->data_base[i];
+		hdr.data_size[i] = mod->data_size[i];
+	}
+	hdr.dynamic = (uintptr_t)mod->dynamic;
+	hdr.dynsym = (uintptr_t)mod->dynsym;
+	hdr.reldyn = (uintptr_t)mod->reldyn;
+	hdr.relplt = (uintptr_t)mod->relplt;
+	hdr.init_array = (uintptr_t)mod->init_array;
+	hdr.hash = (uintptr_t)mod->hash;
+	hdr.gnu_hash = (uintptr_t)mod->gnu_hash;
+	hdr.exidx = (uintptr_t)mod->exidx;
+	hdr.dynstr = (uintptr_t)mod->dynstr;
+	hdr.soname = (uintptr_t)mod->soname;
+	hdr.num_dynamic = mod->num_dynamic;
+	hdr.num_dynsym = mod->num_dynsym;
+	hdr.num_reldyn = mod->num_reldyn;
+	hdr.num_relplt = mod->num_relplt;
+	hdr.num_init_array = mod->num_init_array;
+	hdr.num_exidx = mod->num_exidx;
+	memcpy(hdr.sha1, mod->sha1, SHA1_BLOCK_SIZE);
+
+	// ABS32 slots bound to a dependency keep their addend in the image
+	for (int i = 0; i < num_fixups; i++) {
+		if ((fixups[i].info >> CACHE_KIND_SHIFT) == CACHE_LINK_ADD) {
+			uintptr_t *ptr = (uintptr_t *)(mod->text_base + (fixups[i].info & CACHE_OFFSET_MASK));
+			so_image_poke((uintptr_t)ptr, *ptr - so_resolve_link(mod, mod->dynstr + fixups[i].value));
+		}
+	}
+
+	SceUID fd = sceIoOpen(filename, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (fd >= 0) {
+		res = 0;
+		if (sceIoWrite(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+			sceIoWrite(fd, blocks, hdr.num_blocks * sizeof(so_image_block)) != (int)(hdr.num_blocks * sizeof(so_image_block)) ||
+			sceIoWrite(fd, arenas, hdr.num_arenas * sizeof(so_image_arena)) != (int)(hdr.num_arenas * sizeof(so_image_arena)) ||
+			sceIoWrite(fd, ranges, hdr.num_ranges * sizeof(so_image_block)) != (int)(hdr.num_ranges * sizeof(so_image_block)) ||
+			sceIoWrite(fd, hooks, hdr.num_hooks * sizeof(so_hook)) != (int)(hdr.num_hooks * sizeof(so_hook)) ||
+			sceIoWrite(fd, fixups, hdr.num_fixups * sizeof(so_cache_patch)) != (int)(hdr.num_fixups * sizeof(so_cache_patch)))
+			res = -1;
+		for (uint32_t i = 0; i < hdr.num_blocks && res == 0; i++) {
+			if (sceIoWrite(fd, (void *)blocks[i].base, blocks[i].size) != (int)blocks[i].size)
+				res = -1;
+		}
+		sceIoClose(fd);
+		if (res < 0)
+			sceIoRemove(filename);
+	}
+
+	for (int i = 0; i < num_fixups; i++) {
+		if ((fixups[i].info >> CACHE_KIND_SHIFT) == CACHE_LINK_ADD) {
+			uintptr_t *ptr = (uintptr_t *)(mod->text_base + (fixups[i].info & CACHE_OFFSET_MASK));
+			so_image_poke((uintptr_t)ptr, *ptr + so_resolve_link(mod, mod->dynstr + fixups[i].value));
+		}
+	}
+
+	printf("prelinked image: %d blocks, %d fixups, %d hooks (%s).\n", hdr.num_blocks, num_fixups, num_hooks, res < 0 ? "not saved" : "saved");
+	free(ranges);
+	free(hooks);
+	free(fixups);
+	return res;
+}
+
+static so_module *image_mod = NULL;
+static void *image_tables = NULL;
+static so_hook *image_hooks = NULL;
+static so_cache_patch *image_fixups = NULL;
+static int image_num_hooks, image_num_fixups;
+
+/*
+ * so_image_load: maps a prelinked image written by so_image_save in place of
+ * so_file_load. Fails without leaving anything mapped if the .so, its dependencies
+ * or the import/hook tables changed since. mod->lazy_bind has to be set to the
+ * wanted mode beforehand. Loader owned slots are only valid after so_image_fixup.
+ */
+int so_image_load(so_module *mod, const char *filename, const char *so_path, const char *needed_path, so_default_dynlib *default_dynlib, int size_default_dynlib, so_default_hook *default_hooks, int size_default_hooks) {
+	int num_dynlib = size_default_dynlib / sizeof(so_default_dynlib);
+	int num_hooks = size_default_hooks / sizeof(so_default_hook);
+	int lazy_bind = mod->lazy_bind;
+	so_image_header hdr;
+	so_stream stream;
+	int n_blocks = 0;
+	SceUID blockids[1 + MAX_DATA_SEG + MAX_ARENAS];
+
+	memset(&stream, 0, sizeof(so_stream));
+	stream.fd = sceIoOpen(filename, SCE_O_RDONLY, 0);
+	if (stream.fd < 0)
+		return stream.fd;
+	stream.size = sceIoLseek(stream.fd, 0, SCE_SEEK_END);
+	sceIoLseek(stream.fd, 0, SCE_SEEK_SET);
+	stream.chunk = malloc(STREAM_CHUNK_SZ);
+
+	if (!stream.chunk ||
+		so_stream_read(&stream, &hdr, sizeof(hdr)) < 0 ||
+		hdr.magic != IMAGE_MAGIC ||
+		hdr.hdr_size != sizeof(so_image_header) ||
+		hdr.dynlib_sig != so_cache_signature(default_dynlib, num_dynlib, sizeof(so_default_dynlib)) ||
+		hdr.hooks_sig != so_cache_signature(default_hooks, num_hooks, sizeof(so_default_hook)) ||
+		hdr.num_hooks != (uint32_t)num_hooks ||
+		hdr.n_data > MAX_DATA_SEG ||
+		hdr.num_arenas > MAX_ARENAS ||
+		hdr.num_blocks > 1 + MAX_DATA_SEG + MAX_ARENAS) {
+		goto err_close;
+	}
+
+	uint32_t so_stat = so_image_file_signature(0, so_path);
+	if (hdr.so_stat != so_stat) {
+		uint8_t sha1[SHA1_BLOCK_SIZE];
+		if (so_file_sha1(so_path, sha1) < 0 || memcmp(sha1, hdr.sha1, SHA1_BLOCK_SIZE) != 0)
+			goto err_close;
+	}
+
+	size_t size = hdr.num_blocks * sizeof(so_image_block) + hdr.num_arenas * sizeof(so_image_arena) + hdr.num_ranges * sizeof(so_image_block) +
+		hdr.num_hooks * sizeof(so_hook) + hdr.num_fixups * sizeof(so_cache_patch);
+	free(image_tables);
+	image_tables = malloc(size);
+	if (!image_tables || so_stream_read(&stream, image_tables, size) < 0)
+		goto err_close;
+	so_image_block *blocks = image_tables;
+	so_image_arena *arenas = (so_image_arena *)&blocks[hdr.num_blocks];
+	so_image_block *ranges = (so_image_block *)&arenas[hdr.num_arenas];
+	image_hooks = (so_hook *)&ranges[hdr.num_ranges];
+	image_fixups = (so_cache_patch *)&image_hooks[hdr.num_hooks];
+
+	int num_mapped = 0;
+	for (uint32_t i = 0; i < hdr.num_arenas; i++)
+		num_mapped += arenas[i].mapped;
+	if (hdr.num_blocks != 1 + hdr.n_data + num_mapped)
+		goto err_close;
+
+	// Every block goes back exactly where it was, everything in it is already absolute
+	for (; n_blocks < (int)hdr.num_blocks; n_blocks++) {
+		int rx = n_blocks == 0 || n_blocks > (int)hdr.n_data;
+		blockids[n_blocks] = so_block_alloc(rx ? "rx_block" : "rw_block", rx, blocks[n_blocks].base, blocks[n_blocks].size);
+		if (blockids[n_blocks] < 0)
+			goto err_free_blocks;
+
+		uintptr_t base;
+		so_block_info(blockids[n_blocks], &base, NULL);
+		if (base != blocks[n_blocks].base ||
+			so_stream_segment(&stream, NULL, 0, base, stream.pos, blocks[n_blocks].size, rx) < 0) {
+			n_blocks++;
+			goto err_free_blocks;
+		}
+	}
+	sceIoClose(stream.fd);
+	free(stream.chunk);
+
+	memset(mod, 0, sizeof(so_module));
+	mod->lazy_bind = lazy_bind;
+	mod->text_blockid = blockids[0];
+	mod->text_base = hdr.text_base;
+	mod->text_size = hdr.text_size;
+	mod->n_data = hdr.n_data;
+	for (int i = 0; i < mod->n_data; i++) {
+		mod->data_blockid[i] = blockids[i + 1];
+		mod->data_base[i] = hdr.data_base[i];
+		mod->data_size[i] = hdr.data_size[i];
+	}
+	mod->dynamic = (Elf32_Dyn *)hdr.dynamic;
+	mod->dynsym = (Elf32_Sym *)hdr.dynsym;
+	mod->reldyn = (Elf32_Rel *)hdr.reldyn;
+	mod->relplt = (Elf32_Rel *)hdr.relplt;
+	mod->init_array = (void *)hdr.init_array;
+	mod->hash = (uint32_t *)hdr.hash;
+	mod->gnu_hash = (uint32_t *)hdr.gnu_hash;
+	mod->exidx = (uint32_t *)hdr.exidx;
+	mod->dynstr = (char *)hdr.dynstr;
+	mod->soname = (char *)hdr.soname;
+	mod->num_dynamic = hdr.num_dynamic;
+	mod->num_dynsym = hdr.num_dynsym;
+	mod->num_reldyn = hdr.num_reldyn;
+	mod->num_relplt = hdr.num_relplt;
+	mod->num_init_array = hdr.num_init_array;
+	mod->num_exidx = hdr.num_exidx;
+	memcpy(mod->sha1, hdr.sha1, SHA1_BLOCK_SIZE);
+
+	if (hdr.needed_sig != so_image_needed_signature(mod, needed_path)) {
+		for (int i = 0; i < n_blocks; i++)
+			so_block_free(blockids[i]);
+		memset(mod, 0, sizeof(so_module));
+		mod->lazy_bind = lazy_bind;
+		free(image_tables);
+		image_tables = NULL;
+		return -1;
+	}
+
+	for (uint32_t i = 0, b = 1 + hdr.n_data; i < hdr.num_arenas; i++) {
+		so_arena *arena = &mod->arenas[mod->n_arenas++];
+		arena->blockid = arenas[i].mapped ? blockids[b++] : 0;
+		arena->base = arenas[i].base;
+		arena->size = arenas[i].size;
+		arena->used = arenas[i].used;
+		arena->peak = arenas[i].peak;
+		arena->num_allocs = arenas[i].num_allocs;
+
+		so_arena_range **prev = &arena->free_list;
+		for (uint32_t j = 0; j < arenas[i].num_ranges; j++, ranges++) {
+			so_arena_range *r = malloc(sizeof(so_arena_range));
+			r->addr = ranges->base;
+			r->size = ranges->size;
+			r->next = NULL;
+			*prev = r;
+			prev = &r->next;
+		}
+	}
+	so_flush_caches(mod);
+
+	image_mod = mod;
+	image_num_hooks = hdr.num_hooks;
+	image_num_fixups = hdr.num_fixups;
+
+	so_global_add(mod);
+
+	if (!head && !tail) {
+		head = mod;
+		tail = mod;
+	} else {
+		tail->next = mod;
+		tail = mod;
+	}
+
+	// The .so matched by digest, spare the next boots from hashing it again
+	if (hdr.so_stat != so_stat) {
+		SceUID fd = sceIoOpen(filename, SCE_O_WRONLY, 0777);
+		if (fd >= 0) {
+			hdr.so_stat = so_stat;
+			sceIoWrite(fd, &hdr, sizeof(hdr));
+			sceIoClose(fd);
+		}
+	}
+
+	printf("prelinked image: mapped %d blocks (@0x%08X).\n", n_blocks, (unsigned int)mod->text_base);
+	return 0;
+
+err_free_blocks:
+	for (int i = 0; i < n_blocks; i++) {
+		if (blockids[i] >= 0)
+			so_block_free(blockids[i]);
+	}
+err_close:
+	sceIoClose(stream.fd);
+	free(stream.chunk);
+	free(image_tables);
+	image_tables = NULL;
+	return -1;
+}
+
+/*
+ * so_image_fixup: points the slots recorded by so_image_save back into this
+ * loader build (imports, stubs, hook targets), once the dependencies are loaded.
+ */
+int so_image_fixup(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, so_default_hook *default_hooks, int size_default_hooks) {
+	int num_dynlib = size_default_dynlib / sizeof(so_default_dynlib);
+	if (mod != image_mod)
+		return -1;
+
+	so_link_needed(mod);
+	so_dynlib_index_build(default_dynlib, num_dynlib);
+	mod->dynlib = default_dynlib;
+	mod->num_dynlib = num_dynlib;
+	if (mod->lazy_bind && so_lazy_init(mod) < 0)
+		mod->lazy_bind = 0;
+
+	for (int i = 0; i < image_num_fixups; i++) {
+		uintptr_t *ptr = (uintptr_t *)(mod->text_base + (image_fixups[i].info & CACHE_OFFSET_MASK));
+		uint32_t value = image_fixups[i].value;
+		switch (image_fixups[i].info >> CACHE_KIND_SHIFT) {
+		case CACHE_IMPORT:
+			if (value < (uint32_t)num_dynlib) {
+				*ptr = default_dynlib[value].func;
+				so_rebind_note_add(mod, (uintptr_t)ptr - mod->text_base, *ptr);
+			}
+			break;
+		case CACHE_VGL:
+		case CACHE_VGL_PLT:
+			// so_prelink can't tell vitaGL imports from unresolved ones, only calls get the stub
+			*ptr = 0;
+			so_vgl_bind(mod, image_fixups[i].info & CACHE_OFFSET_MASK, value, (image_fixups[i].info >> CACHE_KIND_SHIFT) == CACHE_VGL_PLT);
+			break;
+		case CACHE_LINK:
+			*ptr = so_resolve_link(mod, mod->dynstr + value);
+			so_rebind_note_add(mod, (uintptr_t)ptr - mod->text_base, *ptr);
+			break;
+		case CACHE_LINK_ADD:
+		{
+			uintptr_t link = so_resolve_link(mod, mod->dynstr + value);
+			*ptr += link;
+			so_rebind_note_add(mod, (uintptr_t)ptr - mod->text_base, link);
+			break;
+		}
+		case CACHE_PLT0:
+			*ptr = (uintptr_t)&plt0_stub;
+			break;
+		case CACHE_LAZY:
+			*ptr = (uintptr_t)&so_lazy_stub;
+			break;
+		default:
+			break;
 		}
 	}
+
+	for (int i = 0; i < image_num_hooks; i++) {
+		so_hook h = image_hooks[i];
+		if (!h.addr)
+			continue;
+		h.patch_instr[1] = default_hooks[i].func;
+		so_patch_write(h.addr + 4, &h.patch_instr[1], sizeof(uint32_t));
+		if (default_hooks[i].hook)
+			*default_hooks[i].hook = h;
+	}
+
+	printf("prelinked image: applied %d fixups, %d hooks.\n", image_num_fixups, image_num_hooks);
+	free(image_tables);
+	image_tables = NULL;
+	image_hooks = NULL;
+	image_fixups = NULL;
+	image_mod = NULL;
+	return 0;
 }
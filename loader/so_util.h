@@ -2,25 +2,55 @@
 #define __SO_UTIL_H__
 
 #include "elf.h"
+#include "sha1.h"
+#include "so_platform.h"
 
 #define ALIGN_MEM(x, align) (((x) + ((align) - 1)) & ~((align) - 1))
 #define MAX_DATA_SEG 4
+#define MAX_ARENAS 8
+#define MAX_NEEDED 16
 
 typedef struct {
 	uintptr_t addr;
 	uintptr_t thumb_addr;
+	uintptr_t trampoline; // relocated prologue + jump back, 0 if unavailable
+	size_t trampoline_size;
+	uint16_t orig_pad; // first halfword of word-unaligned Thumb functions, replaced by a NOP
 	uint32_t orig_instr[2];
 	uint32_t patch_instr[2];
 } so_hook;
 
+typedef struct so_arena_range {
+  struct so_arena_range *next;
+  uintptr_t addr;
+  size_t size;
+} so_arena_range;
+
+typedef struct {
+  SceUID blockid; // 0 for the .text padding cave
+  uintptr_t base;
+  size_t size;
+  size_t used, peak;
+  int num_allocs;
+  so_arena_range *free_list; // sorted by address, coalesced on free
+} so_arena;
+
+typedef struct {
+  char *symbol;
+  uintptr_t func;
+} so_default_dynlib;
+
 typedef struct so_module {
   struct so_module *next;
 
-  SceUID patch_blockid, text_blockid, data_blockid[MAX_DATA_SEG];
-  uintptr_t patch_base, patch_head, cave_base, cave_head, text_base, data_base[MAX_DATA_SEG];
-  size_t patch_size, cave_size, text_size, data_size[MAX_DATA_SEG];
+  SceUID text_blockid, data_blockid[MAX_DATA_SEG];
+  uintptr_t text_base, data_base[MAX_DATA_SEG];
+  size_t text_size, data_size[MAX_DATA_SEG];
   int n_data;
 
+  so_arena arenas[MAX_ARENAS];
+  int n_arenas;
+
   Elf32_Ehdr *ehdr;
   Elf32_Phdr *phdr;
   Elf32_Shdr *shdr;
@@ -32,43 +62,102 @@ typedef struct so_module {
 
   int (** init_array)(void);
   uint32_t *hash;
+  uint32_t *gnu_hash;
+  uint32_t *exidx; // .ARM.exidx, pairs of prel31 function offset and unwind data
+  struct so_sym_slot *sym_index; // built on demand when there's neither hash table
+  uint32_t sym_index_mask;
+  struct so_addr_entry *addr_index; // sorted functions for so_addr2sym, built on demand
+  int num_addr_index;
+  struct so_rebind_entry *rebind_index; // imported symbols to their slots, built on the first so_rebind
+  uint32_t rebind_mask;
+  struct so_rebind_slot *rebind_slots;
+  struct so_rebind_note *rebind_notes; // import slot targets as bound, until the first so_rebind
+  int num_rebind_notes, cap_rebind_notes;
 
   int num_dynamic;
   int num_dynsym;
   int num_reldyn;
   int num_relplt;
   int num_init_array;
+  int num_exidx;
 
   char *soname;
   char *shstr;
   char *dynstr;
+
+  uint8_t sha1[SHA1_BLOCK_SIZE];
+
+  struct so_module *needed[MAX_NEEDED]; // loaded DT_NEEDED modules, in lookup order
+  int n_needed;
+  int initialized;
+
+  int lazy_bind; // JUMP_SLOTs start on so_lazy_stub and get bound on first call
+  so_default_dynlib *dynlib;
+  int num_dynlib;
 } so_module;
 
 typedef struct {
   char *symbol;
   uintptr_t func;
-} so_default_dynlib;
+  so_hook *hook;
+} so_default_hook;
+
+// Called around every constructor so_initialize runs, done is 0 before and 1 after
+typedef void (*so_init_observer)(so_module *mod, uintptr_t func, int done);
 
 so_hook hook_thumb(uintptr_t addr, uintptr_t dst);
 so_hook hook_arm(uintptr_t addr, uintptr_t dst);
 so_hook hook_addr(uintptr_t addr, uintptr_t dst);
+void unhook(so_hook *h);
+
+uintptr_t so_alloc_arena(so_module *mod, uintptr_t range, uintptr_t dst, size_t sz);
+void so_free_arena(so_module *mod, uintptr_t addr, size_t sz);
+void so_arena_stats(so_module *mod);
 
 void so_flush_caches(so_module *mod);
+void so_patch_begin(so_module *mod);
+int so_patch_commit(so_module *mod);
 int so_file_load(so_module *mod, const char *filename, uintptr_t load_addr);
 int so_mem_load(so_module *mod, void * buffer, size_t so_size, uintptr_t load_addr);
 int so_relocate(so_module *mod);
+int so_load_needed(so_module *mod, const char *path, so_default_dynlib *default_dynlib, int size_default_dynlib);
 int so_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only);
+int so_relocate_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only);
+// While set, vitaGL imports are left unbound until so_resolve_vgl, which returns how many it bound
+void so_defer_vgl(int defer);
+int so_resolve_vgl(void);
 int so_resolve_with_dummy(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only);
 void so_symbol_fix_ldmia(so_module *mod, const char *symbol);
+int so_scan_misaligned(so_module *mod, int fix);
+int so_fix_misaligned(so_module *mod, uintptr_t addr, int kind, int thumb);
+const char *so_addr2sym(so_module *mod, uintptr_t addr, uintptr_t *offset);
+int so_lazy_report(so_module *mod, const char *path);
+int so_rebind(so_module *mod, const char *symbol, uintptr_t func);
 void so_initialize(so_module *mod);
+void so_set_init_observer(so_init_observer observer);
 uintptr_t so_symbol(so_module *mod, const char *symbol);
+// Returns the number of hook targets missing from the module
+int so_hook_symbols(so_module *mod, so_default_hook *default_hooks, int size_default_hooks);
+
+void so_cache_begin(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, so_default_hook *default_hooks, int size_default_hooks);
+int so_cache_save(so_module *mod, const char *filename);
+int so_cache_load(so_module *mod, const char *filename, so_default_dynlib *default_dynlib, int size_default_dynlib, so_default_hook *default_hooks, int size_default_hooks);
+
+int so_image_save(so_module *mod, const char *filename, const char *so_path, const char *needed_path, so_default_dynlib *default_dynlib, int size_default_dynlib, so_default_hook *default_hooks, int size_default_hooks);
+int so_image_load(so_module *mod, const char *filename, const char *so_path, const char *needed_path, so_default_dynlib *default_dynlib, int size_default_dynlib, so_default_hook *default_hooks, int size_default_hooks);
+int so_image_fixup(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, so_default_hook *default_hooks, int size_default_hooks);
 
 #define SO_CONTINUE(type, h, ...) ({ \
-  kuKernelCpuUnrestrictedMemcpy((void *)h.addr, h.orig_instr, sizeof(h.orig_instr)); \
-  kuKernelFlushCaches((void *)h.addr, sizeof(h.orig_instr)); \
-  type r = h.thumb_addr ? ((type(*)())h.thumb_addr)(__VA_ARGS__) : ((type(*)())h.addr)(__VA_ARGS__); \
-  kuKernelCpuUnrestrictedMemcpy((void *)h.addr, h.patch_instr, sizeof(h.patch_instr)); \
-  kuKernelFlushCaches((void *)h.addr, sizeof(h.patch_instr)); \
+  type r; \
+  if (h.trampoline) { \
+    r = ((type(*)())h.trampoline)(__VA_ARGS__); \
+  } else { \
+    so_memcpy_rx((void *)h.addr, h.orig_instr, sizeof(h.orig_instr)); \
+    so_flush_rx((void *)h.addr, sizeof(h.orig_instr)); \
+    r = h.thumb_addr ? ((type(*)())h.thumb_addr)(__VA_ARGS__) : ((type(*)())h.addr)(__VA_ARGS__); \
+    so_memcpy_rx((void *)h.addr, h.patch_instr, sizeof(h.patch_instr)); \
+    so_flush_rx((void *)h.addr, sizeof(h.patch_instr)); \
+  } \
   r; \
 })
 
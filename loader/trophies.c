@@ -2,6 +2,8 @@
 #include <vitaGL.h>
 #include <stdio.h>
 
+#include "trophies.h"
+
 static char comm_id[12] = {0};
 static char signature[160] = {0xb9,0xdd,0xe1,0x3b,0x01,0x00};
 
@@ -32,6 +34,8 @@ int sceNpTrophyUnlockTrophy(int ctx, int handle, int id, int *plat_id);
 int sceNpTrophyGetTrophyUnlockState(int ctx, int handle, SceNpTrophyUnlockState *state, uint32_t *count);
 
 int trophies_available = 0;
+static volatile int trophies_dialog = 0;
+static uint32_t trophies_pending[4]; // unlocks requested before the context was ready
 
 volatile int trp_id;
 SceUID trp_request_mutex, trp_delivered_mutex;
@@ -47,18 +51,27 @@ int trophies_unlocker(SceSize args, void *argp) {
 	}
 }
 
-int trophies_init() {
-	// Starting sceNpTrophy
-	strcpy(comm_id, "SMBS00001");
-	sceSysmoduleLoadModule(SCE_SYSMODULE_NP_TROPHY);
-	sceNpTrophyInit(NULL);
-	int res = sceNpTrophyCreateContext(&trp_ctx, comm_id, signature, 0);
-	if (res < 0) {
-#ifdef DEBUG
-		printf("sceNpTrophyCreateContext returned 0x%08X\n", res);
-#endif	
-		return res;
+static void trophies_deliver(uint32_t id) {
+	// Unlocks can come from several threads, only the one setting the bit delivers
+	uint32_t bit = 1 << (id & 31);
+	if (!(__atomic_fetch_or(&trophies_unlocks.unk[id >> 5], bit, __ATOMIC_ACQ_REL) & bit)) {
+		sceKernelWaitSema(trp_delivered_mutex, 1, NULL);
+		trp_id = id;
+		sceKernelSignalSema(trp_request_mutex, 1);
+	}
+}
+
+static void trophies_flush() {
+	for (int i = 0; i < 4; i++) {
+		uint32_t pending = __atomic_exchange_n(&trophies_pending[i], 0, __ATOMIC_ACQ_REL);
+		for (int j = 0; j < 32; j++) {
+			if (pending & (1 << j))
+				trophies_deliver(i * 32 + j);
+		}
 	}
+}
+
+static int trophies_setup(SceSize args, void *argp) {
 	SceNpTrophySetupDialogParam setupParam;
 	sceClibMemset(&setupParam, 0, sizeof(SceNpTrophySetupDialogParam));
 	_sceCommonDialogSetMagicNumber(&setupParam.commonParam);
@@ -66,12 +79,11 @@ int trophies_init() {
 	setupParam.options = 0;
 	setupParam.context = trp_ctx;
 	sceNpTrophySetupDialogInit(&setupParam);
-	static int trophy_setup = SCE_COMMON_DIALOG_STATUS_RUNNING;
-	while (trophy_setup == SCE_COMMON_DIALOG_STATUS_RUNNING) {
-		trophy_setup = sceNpTrophySetupDialogGetStatus();
-		vglSwapBuffers(GL_TRUE);
-	}
+	// Drawn by the main thread, which swaps with common dialogs on while trophies_dialog is set
+	while (sceNpTrophySetupDialogGetStatus() == SCE_COMMON_DIALOG_STATUS_RUNNING)
+		sceKernelDelayThread(10000);
 	sceNpTrophySetupDialogTerm();
+	trophies_dialog = 0;
 	
 	// Starting trophy unlocker thread
 	trp_delivered_mutex = sceKernelCreateSema("trps delivery", 0, 1, 1, NULL);
@@ -86,22 +98,49 @@ int trophies_init() {
 	sceNpTrophyGetTrophyUnlockState(trp_ctx, trp_handle, &trophies_unlocks, &dummy);
 	sceNpTrophyDestroyHandle(trp_handle);
 	
-	trophies_available = 1;
+	__atomic_store_n(&trophies_available, 1, __ATOMIC_RELEASE);
+	trophies_flush();
+	return sceKernelExitDeleteThread(0);
+}
+
+int trophies_init() {
+	// Starting sceNpTrophy
+	strcpy(comm_id, "SMBS00001");
+	sceSysmoduleLoadModule(SCE_SYSMODULE_NP_TROPHY);
+	sceNpTrophyInit(NULL);
+	int res = sceNpTrophyCreateContext(&trp_ctx, comm_id, signature, 0);
+	if (res < 0) {
+#ifdef DEBUG
+		printf("sceNpTrophyCreateContext returned 0x%08X\n", res);
+#endif	
+		return res;
+	}
+	
+	// Setup dialog and unlocks state go on in the background, unlocks requested meanwhile are queued
+	trophies_dialog = 1;
+	SceUID trophies_setup_thd = sceKernelCreateThread("trophies setup", &trophies_setup, 0x10000100, 0x10000, 0, 0, NULL);
+	sceKernelStartThread(trophies_setup_thd, 0, NULL);
 	return res;
 }
 
+int trophies_dialog_running() {
+	return trophies_dialog;
+}
+
 uint8_t trophies_is_unlocked(uint32_t id) {
-	if (trophies_available) {
+	if (__atomic_load_n(&trophies_available, __ATOMIC_ACQUIRE)) {
 		return (trophies_unlocks.unk[id >> 5] & (1 << (id & 31))) > 0;
 	}
 	return 0;
 }
 
 void trophies_unlock(uint32_t id) {
-	if (trophies_available && !trophies_is_unlocked(id)) {
-		trophies_unlocks.unk[id >> 5] |= (1 << (id & 31));
-		sceKernelWaitSema(trp_delivered_mutex, 1, NULL);
-		trp_id = id;
-		sceKernelSignalSema(trp_request_mutex, 1);
+	if (!__atomic_load_n(&trophies_available, __ATOMIC_ACQUIRE)) {
+		__atomic_fetch_or(&trophies_pending[id >> 5], 1 << (id & 31), __ATOMIC_ACQ_REL);
+		// The setup thread may have flushed the queue in between
+		if (__atomic_load_n(&trophies_available, __ATOMIC_ACQUIRE))
+			trophies_flush();
+		return;
 	}
+	trophies_deliver(id);
 }
@@ -6,6 +6,7 @@ extern "C" {
 #endif
 
 int trophies_init();
+int trophies_dialog_running();
 void trophies_unlock(uint32_t id);
 uint8_t trophies_is_unlocked(uint32_t id);
 